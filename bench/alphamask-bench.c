@@ -0,0 +1,501 @@
+/* GStreamer AlphaMask plugin
+ * Copyright (C) 2016 Oblong Industries
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Times the alpha kernels on their own and the whole per-frame path of the
+ * alphamask element over a matrix of sizes and formats. Every result is
+ * printed as one JSON object per line on stdout, progress and skipped cases
+ * go to stderr.
+ *
+ * The element cases need the plugin, "make bench" points GST_PLUGIN_PATH at
+ * the build tree. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <string.h>
+
+#include "alphakernels.h"
+
+/* odd sizes go through the tail of the SIMD kernels */
+static const struct
+{
+  gint width;
+  gint height;
+} sizes[] = {
+  {640, 480},
+  {1281, 721},
+  {1920, 1080},
+  {3840, 2160},
+};
+
+static const GstVideoFormat fuse_in_formats[] = {
+  GST_VIDEO_FORMAT_I420, GST_VIDEO_FORMAT_NV12, GST_VIDEO_FORMAT_YUY2,
+  GST_VIDEO_FORMAT_Y444, GST_VIDEO_FORMAT_RGB, GST_VIDEO_FORMAT_BGRx,
+};
+
+static const GstVideoFormat fuse_out_formats[] = {
+  GST_VIDEO_FORMAT_AYUV, GST_VIDEO_FORMAT_ARGB, GST_VIDEO_FORMAT_BGRA,
+};
+
+static const gchar *element_in_formats[] = {
+  "I420", "NV12", "NV21", "YUY2", "RGB", "BGRx",
+};
+
+static const gchar *element_out_formats[] = {
+  "A420", "AYUV", "ARGB", "BGRA",
+};
+
+/* every case runs at least this long and this many times */
+#define MIN_RUN_TIME (200 * GST_MSECOND)
+#define MIN_RUNS 5
+
+#define TIME_RUNS(runs, total, stmt) G_STMT_START {                     \
+  GstClockTime _start = gst_util_get_timestamp ();                      \
+  (runs) = 0;                                                           \
+  do {                                                                  \
+    stmt;                                                               \
+    (runs)++;                                                           \
+    (total) = gst_util_get_timestamp () - _start;                       \
+  } while ((total) < MIN_RUN_TIME || (runs) < MIN_RUNS);                \
+} G_STMT_END
+
+static gint n_frames = 200;
+static gboolean kernels_only = FALSE;
+static gboolean element_only = FALSE;
+static gboolean quick = FALSE;
+
+static GOptionEntry entries[] = {
+  {"frames", 'n', 0, G_OPTION_ARG_INT, &n_frames,
+      "Frames pushed through the element per case", "N"},
+  {"kernels", 'k', 0, G_OPTION_ARG_NONE, &kernels_only,
+      "Only time the kernels", NULL},
+  {"element", 'e', 0, G_OPTION_ARG_NONE, &element_only,
+      "Only time the element", NULL},
+  {"quick", 'q', 0, G_OPTION_ARG_NONE, &quick,
+      "Only run 1920x1080", NULL},
+  {NULL}
+};
+
+static void
+report (const gchar * bench, const gchar * variant, gint width, gint height,
+    const gchar * in, const gchar * out, guint64 runs, GstClockTime total)
+{
+  gdouble ns = runs ? (gdouble) total / runs : 0;
+
+  g_print ("{\"bench\": \"%s\", \"variant\": \"%s\", \"width\": %d, "
+      "\"height\": %d, \"in\": \"%s\", \"out\": \"%s\", \"runs\": %"
+      G_GUINT64_FORMAT ", \"ns_per_frame\": %.0f, \"mpix_per_s\": %.2f}\n",
+      bench, variant, width, height, in, out, runs, ns,
+      ns > 0 ? width * height * 1000.0 / ns : 0);
+}
+
+/* ball on a transparent background, like videotestsrc pattern=ball */
+static void
+make_mask (guint8 * dst, gint stride, gint width, gint height)
+{
+  gint cx = width / 2, cy = height / 2, r = MIN (width, height) / 3;
+  gint i, j;
+
+  for (j = 0; j < height; j++)
+    for (i = 0; i < width; i++)
+      dst[j * stride + i] = (i - cx) * (i - cx) + (j - cy) * (j - cy) < r * r
+          ? 0xff : 0x00;
+}
+
+/* times every kernel @get returns for the CPU, used for both the plain
+ * alpha copy and the one that premultiplies */
+static void
+bench_copy_alpha_packed (const gchar * bench,
+    GstAlphaMaskCopyAlphaFunc (*get) (GstAlphaMaskCpuFlags), gint width,
+    gint height, const guint8 * mask)
+{
+  static const struct
+  {
+    const gchar *name;
+    GstAlphaMaskCpuFlags flags;
+  } impls[] = {
+    {"c", 0},
+    {"sse2", GST_ALPHA_MASK_CPU_SSE2},
+    {"avx2", GST_ALPHA_MASK_CPU_AVX2},
+    {"neon", GST_ALPHA_MASK_CPU_NEON},
+  };
+  GstAlphaMaskCpuFlags cpu = gst_alpha_mask_get_cpu_flags ();
+  GstAlphaMaskCopyAlphaFunc seen[G_N_ELEMENTS (impls)];
+  guint8 *dst = g_malloc0 (width * 4 * height);
+  guint i, j, n_seen = 0;
+
+  for (i = 0; i < G_N_ELEMENTS (impls); i++) {
+    GstAlphaMaskCopyAlphaFunc func;
+    GstClockTime total;
+    guint64 runs;
+
+    if ((impls[i].flags & cpu) != impls[i].flags)
+      continue;
+
+    /* flags the build has no kernel for fall back to another one */
+    func = get (impls[i].flags);
+    for (j = 0; j < n_seen && seen[j] != func; j++);
+    if (j < n_seen)
+      continue;
+    seen[n_seen++] = func;
+
+    TIME_RUNS (runs, total, func (dst, width * 4, 3, mask, width, width,
+            height));
+    report (bench, impls[i].name, width, height, "GRAY8", "BGRA", runs,
+        total);
+  }
+
+  g_free (dst);
+}
+
+static void
+bench_premultiply (gint width, gint height, const guint8 * mask)
+{
+  static const struct
+  {
+    const gchar *name;
+    GstAlphaMaskCpuFlags flags;
+  } impls[] = {
+    {"c", 0},
+    {"sse2", GST_ALPHA_MASK_CPU_SSE2},
+    {"avx2", GST_ALPHA_MASK_CPU_AVX2},
+    {"neon", GST_ALPHA_MASK_CPU_NEON},
+  };
+  GstAlphaMaskCpuFlags cpu = gst_alpha_mask_get_cpu_flags ();
+  GstAlphaMaskPremultiplyFunc seen[G_N_ELEMENTS (impls)];
+  guint8 *dst = g_malloc (width * 4 * height);
+  guint i, j, n_seen = 0;
+
+  memset (dst, 0x80, width * 4 * height);
+  gst_alpha_mask_get_copy_alpha_packed (0) (dst, width * 4, 3, mask, width,
+      width, height);
+
+  for (i = 0; i < G_N_ELEMENTS (impls); i++) {
+    GstAlphaMaskPremultiplyFunc func;
+    GstClockTime total;
+    guint64 runs;
+
+    if ((impls[i].flags & cpu) != impls[i].flags)
+      continue;
+
+    func = gst_alpha_mask_get_premultiply (impls[i].flags);
+    for (j = 0; j < n_seen && seen[j] != func; j++);
+    if (j < n_seen)
+      continue;
+    seen[n_seen++] = func;
+
+    TIME_RUNS (runs, total, func (dst, width * 4, 3, width, height));
+    report ("premultiply", impls[i].name, width, height, "BGRA", "BGRA",
+        runs, total);
+  }
+
+  g_free (dst);
+}
+
+static void
+bench_copy_alpha_planar (gint width, gint height, const guint8 * mask)
+{
+  guint stride = GST_ROUND_UP_4 (width);
+  guint8 *src = g_malloc (stride * height);
+  guint8 *dst = g_malloc0 (stride * height);
+  GstClockTime total;
+  guint64 runs;
+
+  make_mask (src, stride, width, height);
+
+  /* what the element does for A420 and AV12 output, whose alpha plane has
+   * the same rounded stride as a GRAY8 mask, and for an unpadded mask */
+  TIME_RUNS (runs, total, gst_alpha_mask_copy_plane (dst, stride, src,
+          stride, width, height));
+  report ("copy_alpha_planar", "same_stride", width, height, "GRAY8", "A420",
+      runs, total);
+  TIME_RUNS (runs, total, gst_alpha_mask_copy_plane (dst, stride, mask,
+          width, width, height));
+  report ("copy_alpha_planar", "per_line", width, height, "GRAY8", "A420",
+      runs, total);
+
+  g_free (src);
+  g_free (dst);
+}
+
+static void
+bench_scale_alpha (gint width, gint height, const guint8 * mask)
+{
+  gint sw = width / 2, sh = height / 2;
+  guint8 *src = g_malloc (sw * sh);
+  guint8 *dst = g_malloc0 (width * 4 * height);
+  GstClockTime total;
+  guint64 runs;
+  guint bilinear, step;
+
+  make_mask (src, sw, sw, sh);
+
+  for (bilinear = 0; bilinear < 2; bilinear++) {
+    for (step = 1; step <= 4; step += 3) {
+      TIME_RUNS (runs, total, gst_alpha_mask_scale_alpha (dst, width * step,
+              step, width, height, 0, height, src, sw, sw, sh, bilinear));
+      report ("scale_alpha", bilinear ? "bilinear" : "nearest", width, height,
+          "GRAY8", step == 1 ? "A420" : "BGRA", runs, total);
+    }
+  }
+
+  g_free (src);
+  g_free (dst);
+}
+
+static void
+bench_fuse (gint width, gint height, const guint8 * mask)
+{
+  guint i, o;
+
+  for (i = 0; i < G_N_ELEMENTS (fuse_in_formats); i++) {
+    GstVideoInfo info;
+    GstVideoFrame frame;
+    GstBuffer *buf;
+    GstAlphaMaskYuvMatrix matrix;
+
+    gst_video_info_set_format (&info, fuse_in_formats[i], width, height);
+    gst_alpha_mask_yuv_matrix_init (&matrix, &info);
+    buf = gst_buffer_new_allocate (NULL, GST_VIDEO_INFO_SIZE (&info), NULL);
+    gst_buffer_memset (buf, 0, 0x80, GST_VIDEO_INFO_SIZE (&info));
+    gst_video_frame_map (&frame, &info, buf, GST_MAP_READ);
+
+    for (o = 0; o < G_N_ELEMENTS (fuse_out_formats); o++) {
+      GstAlphaMaskFuseLineFunc fuse;
+      const guint8 *comp[3];
+      guint8 *dst;
+      GstClockTime total;
+      guint64 runs;
+      gint j, c;
+
+      fuse = gst_alpha_mask_get_fuse_line (fuse_in_formats[i],
+          fuse_out_formats[o]);
+      if (!fuse)
+        continue;
+
+      dst = g_malloc0 (width * 4 * height);
+      TIME_RUNS (runs, total, {
+            for (j = 0; j < height; j++) {
+              for (c = 0; c < 3; c++)
+                comp[c] = (const guint8 *) GST_VIDEO_FRAME_COMP_DATA (&frame,
+                    c) + (j >> GST_VIDEO_FORMAT_INFO_H_SUB (info.finfo,
+                        c)) * GST_VIDEO_FRAME_COMP_STRIDE (&frame, c);
+              fuse (dst + j * width * 4, comp, mask + j * width, 0xff,
+                  &matrix, width);
+            }
+          });
+      report ("fuse_line", "c", width, height,
+          gst_video_format_to_string (fuse_in_formats[i]),
+          gst_video_format_to_string (fuse_out_formats[o]), runs, total);
+      g_free (dst);
+    }
+
+    gst_video_frame_unmap (&frame);
+    gst_buffer_unref (buf);
+  }
+}
+
+static gsize
+encode_rle (guint8 * dst, const guint8 * mask, gint width, gint height)
+{
+  gsize n = 0;
+  gint i, j, len;
+
+  for (j = 0; j < height; j++) {
+    const guint8 *sp = mask + j * width;
+
+    for (i = 0; i < width; i += len) {
+      guint v;
+
+      for (len = 1; i + len < width && sp[i + len] == sp[i]; len++);
+      for (v = len; v >= 0x80; v >>= 7)
+        dst[n++] = (v & 0x7f) | 0x80;
+      dst[n++] = v;
+      dst[n++] = sp[i];
+    }
+  }
+
+  return n;
+}
+
+static void
+bench_decode (gint width, gint height, const guint8 * mask)
+{
+  gint bs = (width + 7) / 8, i;
+  guint8 *bitmap = g_malloc0 (bs * height);
+  guint8 *rle = g_malloc (width * height * 3);
+  guint8 *dst = g_malloc0 (width * height);
+  GstClockTime total;
+  guint64 runs;
+  gsize size;
+
+  for (i = 0; i < width * height; i++)
+    if (mask[i])
+      bitmap[(i / width) * bs + (i % width) / 8] |= 0x80 >> (i % width % 8);
+  size = encode_rle (rle, mask, width, height);
+
+  TIME_RUNS (runs, total, gst_alpha_mask_decode_bitmap (dst, width, 1, 8,
+          width, height, 0, height, bitmap, bs * height, width, height));
+  report ("decode_alpha", "bitmap", width, height, "bitmap", "A420", runs,
+      total);
+
+  TIME_RUNS (runs, total, gst_alpha_mask_decode_rle (dst, width, 1, 8,
+          width, height, rle, size, width, height, NULL, 0));
+  report ("decode_alpha", "rle", width, height, "rle", "A420", runs, total);
+
+  g_free (bitmap);
+  g_free (rle);
+  g_free (dst);
+}
+
+static void
+bench_analysis (gint width, gint height, const guint8 * mask)
+{
+  GstClockTime total;
+  guint64 runs;
+  gint x, y;
+
+  TIME_RUNS (runs, total, {
+        for (y = 0; y < height; y += 32)
+          for (x = 0; x < width; x += 32)
+            gst_alpha_mask_classify_block (mask + y * width + x, width,
+                MIN (32, width - x), MIN (32, height - y));
+      });
+  report ("classify_block", "32x32", width, height, "GRAY8", "", runs, total);
+
+  TIME_RUNS (runs, total, gst_alpha_mask_hash_plane (mask, width, width,
+          height));
+  report ("hash_plane", "c", width, height, "GRAY8", "", runs, total);
+}
+
+/* Pushes generated frames through alphamask and reads back the time it
+ * spent per frame from its stats, leaving the sources out */
+static void
+bench_element (gint width, gint height, const gchar * in, const gchar * out)
+{
+  GstElement *pipeline, *am;
+  GstStructure *stats = NULL;
+  GstMessage *msg;
+  GError *err = NULL;
+  guint64 frames = 0, average = 0;
+  gchar *desc;
+
+  desc = g_strdup_printf ("videotestsrc num-buffers=%d ! "
+      "video/x-raw,format=%s,width=%d,height=%d,framerate=30/1 ! "
+      "alphamask name=am ! video/x-raw,format=%s ! fakesink sync=false "
+      "videotestsrc pattern=ball num-buffers=%d ! "
+      "video/x-raw,format=GRAY8,width=%d,height=%d,framerate=30/1 ! "
+      "am.alpha_sink", n_frames, in, width, height, out, n_frames, width,
+      height);
+  pipeline = gst_parse_launch (desc, &err);
+  g_free (desc);
+  if (!pipeline) {
+    g_printerr ("skipping %s to %s: %s\n", in, out, err->message);
+    g_clear_error (&err);
+    return;
+  }
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  msg = gst_bus_timed_pop_filtered (GST_ELEMENT_BUS (pipeline),
+      GST_CLOCK_TIME_NONE, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+
+  if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR) {
+    gst_message_parse_error (msg, &err, NULL);
+    g_printerr ("skipping %dx%d %s to %s: %s\n", width, height, in, out,
+        err->message);
+    g_clear_error (&err);
+  } else {
+    am = gst_bin_get_by_name (GST_BIN (pipeline), "am");
+    g_object_get (am, "stats", &stats, NULL);
+    if (stats && gst_structure_get_uint64 (stats, "frames-out", &frames) &&
+        gst_structure_get_uint64 (stats, "convert-average", &average))
+      report ("alphamask", "element", width, height, in, out, frames,
+          average * frames);
+    else
+      g_printerr ("skipping %dx%d %s to %s: no stats\n", width, height, in,
+          out);
+    if (stats)
+      gst_structure_free (stats);
+    gst_object_unref (am);
+  }
+
+  gst_message_unref (msg);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+}
+
+int
+main (int argc, char **argv)
+{
+  GOptionContext *ctx;
+  GError *err = NULL;
+  guint s, i, o;
+
+  ctx = g_option_context_new ("- time the alphamask kernels and element");
+  g_option_context_add_main_entries (ctx, entries, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+    g_printerr ("%s\n", err->message);
+    g_clear_error (&err);
+    g_option_context_free (ctx);
+    return 1;
+  }
+  g_option_context_free (ctx);
+
+  gst_init (&argc, &argv);
+  gst_alpha_mask_kernels_init ();
+
+  for (s = 0; s < G_N_ELEMENTS (sizes); s++) {
+    gint width = sizes[s].width, height = sizes[s].height;
+
+    if (quick && (width != 1920 || height != 1080))
+      continue;
+
+    g_printerr ("%dx%d\n", width, height);
+
+    if (!element_only) {
+      guint8 *mask = g_malloc (width * height);
+
+      make_mask (mask, width, width, height);
+      bench_copy_alpha_packed ("copy_alpha_packed",
+          gst_alpha_mask_get_copy_alpha_packed, width, height, mask);
+      bench_copy_alpha_packed ("copy_alpha_premultiply",
+          gst_alpha_mask_get_copy_alpha_premultiply, width, height, mask);
+      bench_premultiply (width, height, mask);
+      bench_copy_alpha_planar (width, height, mask);
+      bench_scale_alpha (width, height, mask);
+      bench_fuse (width, height, mask);
+      bench_decode (width, height, mask);
+      bench_analysis (width, height, mask);
+      g_free (mask);
+    }
+
+    if (!kernels_only) {
+      for (i = 0; i < G_N_ELEMENTS (element_in_formats); i++)
+        for (o = 0; o < G_N_ELEMENTS (element_out_formats); o++)
+          bench_element (width, height, element_in_formats[i],
+              element_out_formats[o]);
+    }
+  }
+
+  return 0;
+}
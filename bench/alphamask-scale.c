@@ -0,0 +1,326 @@
+/* GStreamer AlphaMask plugin
+ * Copyright (C) 2016 Oblong Industries
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Runs many videotestsrc ! alphamask ! fakesink pairs at once in a single
+ * pipeline, to see how the element scales with the number of instances
+ * under contention. Prints one JSON object per instance with its latency
+ * percentiles and one for the whole run with the aggregate frame rate, the
+ * CPU time and the peak RSS, progress goes to stderr.
+ *
+ * The latency of a frame is the time from reaching alphamask to reaching
+ * its fakesink, taken from the stage-meta timestamps. Jitter is added by
+ * sleeping a random time in the streaming thread of every mask branch. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <gst/gst.h>
+#ifdef G_OS_UNIX
+#include <sys/resource.h>       /* for getrusage */
+#endif
+
+static gint n_instances = 4;
+static gint n_frames = 300;
+static gint width = 1920;
+static gint height = 1080;
+static gchar *in_format = NULL;
+static gchar *out_format = NULL;
+static gint mask_rate = 30;
+static gint jitter_ms = 0;
+static gint n_threads = 1;
+static gboolean live = FALSE;
+
+#define FRAME_RATE 30
+
+static GOptionEntry entries[] = {
+  {"instances", 'i', 0, G_OPTION_ARG_INT, &n_instances,
+      "alphamask instances in the pipeline", "N"},
+  {"frames", 'n', 0, G_OPTION_ARG_INT, &n_frames,
+      "Video frames per instance", "N"},
+  {"width", 0, 0, G_OPTION_ARG_INT, &width, "Frame width", "W"},
+  {"height", 0, 0, G_OPTION_ARG_INT, &height, "Frame height", "H"},
+  {"in", 0, 0, G_OPTION_ARG_STRING, &in_format,
+      "Video input format (default I420)", "FORMAT"},
+  {"out", 0, 0, G_OPTION_ARG_STRING, &out_format,
+      "Output format (default A420)", "FORMAT"},
+  {"mask-rate", 'm', 0, G_OPTION_ARG_INT, &mask_rate,
+      "Masks per second, the video runs at 30", "FPS"},
+  {"jitter", 'j', 0, G_OPTION_ARG_INT, &jitter_ms,
+      "Up to this much random delay per mask", "MS"},
+  {"n-threads", 't', 0, G_OPTION_ARG_INT, &n_threads,
+      "n-threads of every alphamask, 0 for one per CPU", "N"},
+  {"live", 'l', 0, G_OPTION_ARG_NONE, &live,
+      "Live sources and synchronised sinks", NULL},
+  {NULL}
+};
+
+typedef struct
+{
+  guint index;
+  guint64 frames;
+  GArray *latencies;            /* GstClockTime, one per stamped frame */
+} Instance;
+
+#if GST_CHECK_VERSION (1,14,0)
+static GstCaps *video_in_caps;
+#endif
+
+static GstPadProbeReturn
+sink_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  Instance *instance = user_data;
+#if GST_CHECK_VERSION (1,14,0)
+  GstReferenceTimestampMeta *meta;
+  GstClockTime now = gst_util_get_timestamp ();
+#endif
+
+  instance->frames++;
+
+#if GST_CHECK_VERSION (1,14,0)
+  meta = gst_buffer_get_reference_timestamp_meta (GST_PAD_PROBE_INFO_BUFFER
+      (info), video_in_caps);
+  if (meta) {
+    GstClockTime latency = now - meta->timestamp;
+
+    g_array_append_val (instance->latencies, latency);
+  }
+#endif
+
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn
+jitter_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  g_usleep (g_random_int_range (0, jitter_ms * 1000 + 1));
+
+  return GST_PAD_PROBE_OK;
+}
+
+static gint
+compare_time (gconstpointer a, gconstpointer b)
+{
+  GstClockTime ta = *(const GstClockTime *) a;
+  GstClockTime tb = *(const GstClockTime *) b;
+
+  return ta < tb ? -1 : ta > tb;
+}
+
+/* nearest rank on the sorted @times */
+static GstClockTime
+percentile (GArray * times, guint p)
+{
+  guint rank;
+
+  if (times->len == 0)
+    return 0;
+  rank = (times->len * p + 99) / 100;
+
+  return g_array_index (times, GstClockTime, MAX (rank, 1) - 1);
+}
+
+static gchar *
+make_description (void)
+{
+  GString *desc = g_string_new (NULL);
+  gint mask_frames = (n_frames * mask_rate + FRAME_RATE - 1) / FRAME_RATE;
+  const gchar *is_live = live ? "true" : "false";
+  gint i;
+
+  for (i = 0; i < n_instances; i++) {
+    g_string_append_printf (desc, "videotestsrc num-buffers=%d is-live=%s ! "
+        "video/x-raw,format=%s,width=%d,height=%d,framerate=%d/1 ! "
+        "alphamask name=am%d n-threads=%d stage-meta=true ! "
+        "video/x-raw,format=%s ! fakesink name=sink%d sync=%s "
+        "videotestsrc pattern=ball num-buffers=%d is-live=%s ! "
+        "video/x-raw,format=GRAY8,width=%d,height=%d,framerate=%d/1 ! "
+        "queue name=mq%d ! am%d.alpha_sink ", n_frames, is_live, in_format,
+        width, height, FRAME_RATE, i, n_threads, out_format, i, is_live,
+        mask_frames, is_live, width, height, mask_rate, i, i);
+  }
+
+  return g_string_free (desc, FALSE);
+}
+
+static void
+report_instance (Instance * instance)
+{
+  GArray *times = instance->latencies;
+
+  g_array_sort (times, compare_time);
+  g_print ("{\"bench\": \"scale\", \"variant\": \"instance\", "
+      "\"instance\": %u, \"frames\": %" G_GUINT64_FORMAT ", "
+      "\"p50_us\": %.1f, \"p90_us\": %.1f, \"p99_us\": %.1f, "
+      "\"max_us\": %.1f}\n", instance->index, instance->frames,
+      percentile (times, 50) / 1000.0, percentile (times, 90) / 1000.0,
+      percentile (times, 99) / 1000.0, percentile (times, 100) / 1000.0);
+}
+
+static void
+report_total (guint64 frames, GstClockTime wall, GArray * all)
+{
+  gdouble cpu_s = 0, rss_mb = 0;
+#ifdef G_OS_UNIX
+  struct rusage usage;
+
+  if (getrusage (RUSAGE_SELF, &usage) == 0) {
+    cpu_s = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+        usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    /* kilobytes on Linux */
+    rss_mb = usage.ru_maxrss / 1024.0;
+  }
+#endif
+
+  g_array_sort (all, compare_time);
+  g_print ("{\"bench\": \"scale\", \"variant\": \"total\", "
+      "\"instances\": %d, \"width\": %d, \"height\": %d, \"in\": \"%s\", "
+      "\"out\": \"%s\", \"mask_rate\": %d, \"jitter_ms\": %d, "
+      "\"live\": %s, \"frames\": %" G_GUINT64_FORMAT ", \"fps\": %.1f, "
+      "\"p50_us\": %.1f, \"p99_us\": %.1f, \"cpu_s\": %.2f, "
+      "\"peak_rss_mb\": %.1f}\n", n_instances, width, height, in_format,
+      out_format, mask_rate, jitter_ms, live ? "true" : "false", frames,
+      wall ? frames * (gdouble) GST_SECOND / wall : 0,
+      percentile (all, 50) / 1000.0, percentile (all, 99) / 1000.0, cpu_s,
+      rss_mb);
+}
+
+int
+main (int argc, char **argv)
+{
+  GOptionContext *ctx;
+  GError *err = NULL;
+  GstElement *pipeline;
+  GstMessage *msg;
+  GstClockTime start, wall;
+  Instance *instances;
+  GArray *all;
+  guint64 frames = 0;
+  gchar *desc;
+  gint i, ret = 0;
+
+  ctx = g_option_context_new ("- run many alphamask instances at once");
+  g_option_context_add_main_entries (ctx, entries, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+    g_printerr ("%s\n", err->message);
+    g_clear_error (&err);
+    g_option_context_free (ctx);
+    return 1;
+  }
+  g_option_context_free (ctx);
+
+  if (n_instances < 1 || n_frames < 1 || mask_rate < 1 || jitter_ms < 0) {
+    g_printerr ("instances, frames and mask rate must be positive\n");
+    return 1;
+  }
+  if (!in_format)
+    in_format = g_strdup ("I420");
+  if (!out_format)
+    out_format = g_strdup ("A420");
+
+  gst_init (&argc, &argv);
+#if GST_CHECK_VERSION (1,14,0)
+  video_in_caps = gst_caps_new_empty_simple ("timestamp/x-alphamask-video-in");
+#else
+  g_printerr ("GStreamer older than 1.14, no latencies\n");
+#endif
+
+  desc = make_description ();
+  pipeline = gst_parse_launch (desc, &err);
+  g_free (desc);
+  if (!pipeline) {
+    g_printerr ("could not build the pipeline: %s\n", err->message);
+    g_clear_error (&err);
+    return 1;
+  }
+
+  instances = g_new0 (Instance, n_instances);
+  for (i = 0; i < n_instances; i++) {
+    GstElement *element;
+    GstPad *pad;
+    gchar *name;
+
+    instances[i].index = i;
+    instances[i].latencies = g_array_sized_new (FALSE, FALSE,
+        sizeof (GstClockTime), n_frames);
+
+    name = g_strdup_printf ("sink%d", i);
+    element = gst_bin_get_by_name (GST_BIN (pipeline), name);
+    g_free (name);
+    pad = gst_element_get_static_pad (element, "sink");
+    gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, sink_probe,
+        &instances[i], NULL);
+    gst_object_unref (pad);
+    gst_object_unref (element);
+
+    if (jitter_ms > 0) {
+      name = g_strdup_printf ("mq%d", i);
+      element = gst_bin_get_by_name (GST_BIN (pipeline), name);
+      g_free (name);
+      pad = gst_element_get_static_pad (element, "src");
+      gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, jitter_probe, NULL,
+          NULL);
+      gst_object_unref (pad);
+      gst_object_unref (element);
+    }
+  }
+
+  g_printerr ("%d instances of %dx%d %s to %s\n", n_instances, width, height,
+      in_format, out_format);
+
+  start = gst_util_get_timestamp ();
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  msg = gst_bus_timed_pop_filtered (GST_ELEMENT_BUS (pipeline),
+      GST_CLOCK_TIME_NONE, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  wall = gst_util_get_timestamp () - start;
+
+  if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR) {
+    gst_message_parse_error (msg, &err, NULL);
+    g_printerr ("pipeline failed: %s\n", err->message);
+    g_clear_error (&err);
+    ret = 1;
+  }
+  gst_message_unref (msg);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+
+  if (ret == 0) {
+    all = g_array_new (FALSE, FALSE, sizeof (GstClockTime));
+    for (i = 0; i < n_instances; i++) {
+      report_instance (&instances[i]);
+      frames += instances[i].frames;
+      g_array_append_vals (all, instances[i].latencies->data,
+          instances[i].latencies->len);
+    }
+    report_total (frames, wall, all);
+    g_array_free (all, TRUE);
+  }
+
+  for (i = 0; i < n_instances; i++)
+    g_array_free (instances[i].latencies, TRUE);
+  g_free (instances);
+#if GST_CHECK_VERSION (1,14,0)
+  gst_caps_unref (video_in_caps);
+#endif
+  g_free (in_format);
+  g_free (out_format);
+
+  return ret;
+}
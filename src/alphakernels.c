@@ -0,0 +1,1303 @@
+/* GStreamer AlphaMask plugin
+ * Copyright (C) 2016 Oblong Industries
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "alphakernels.h"
+#include <string.h>             /* for memcpy */
+
+#ifdef HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#if defined (__ARM_NEON) || defined (__ARM_NEON__)
+#define HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+static GstAlphaMaskCpuFlags cpu_flags = 0;
+
+static inline void
+copy_alpha_packed_line_c (guint8 * dst, const guint8 * src, guint width)
+{
+  guint j;
+
+  for (j = 0; j + 8 <= width; j += 8) {
+    dst[0] = src[0];
+    dst[4] = src[1];
+    dst[8] = src[2];
+    dst[12] = src[3];
+    dst[16] = src[4];
+    dst[20] = src[5];
+    dst[24] = src[6];
+    dst[28] = src[7];
+    dst += 32;
+    src += 8;
+  }
+
+  /* only the last few pixels of each line take the slow path */
+  for (; j < width; j++) {
+    *dst = *src++;
+    dst += 4;
+  }
+}
+
+static void
+copy_alpha_packed_c (guint8 * dst, guint dstride, guint offset,
+    const guint8 * src, guint sstride, guint width, guint height)
+{
+  guint i;
+
+  dst += offset;
+  for (i = 0; i < height; i++) {
+    copy_alpha_packed_line_c (dst, src, width);
+    dst += dstride;
+    src += sstride;
+  }
+}
+
+#ifdef HAVE_X86_SIMD
+/* Expands 16 alpha bytes to 16 dwords with the alpha in byte @offset and
+ * merges those into 64 bytes of destination */
+__attribute__ ((target ("sse2")))
+static void
+copy_alpha_packed_sse2 (guint8 * dst, guint dstride, guint offset,
+    const guint8 * src, guint sstride, guint width, guint height)
+{
+  const __m128i shift = _mm_cvtsi32_si128 (offset * 8);
+  const __m128i keep = _mm_set1_epi32 (~(0xffu << (offset * 8)));
+  const __m128i zero = _mm_setzero_si128 ();
+  guint i, j;
+
+  for (i = 0; i < height; i++) {
+    guint8 *d = dst;
+    const guint8 *s = src;
+
+    for (j = 0; j + 16 <= width; j += 16) {
+      __m128i a = _mm_loadu_si128 ((const __m128i *) s);
+      __m128i lo = _mm_unpacklo_epi8 (a, zero);
+      __m128i hi = _mm_unpackhi_epi8 (a, zero);
+      __m128i a0 = _mm_unpacklo_epi16 (lo, zero);
+      __m128i a1 = _mm_unpackhi_epi16 (lo, zero);
+      __m128i a2 = _mm_unpacklo_epi16 (hi, zero);
+      __m128i a3 = _mm_unpackhi_epi16 (hi, zero);
+      __m128i d0 = _mm_loadu_si128 ((__m128i *) (d + 0));
+      __m128i d1 = _mm_loadu_si128 ((__m128i *) (d + 16));
+      __m128i d2 = _mm_loadu_si128 ((__m128i *) (d + 32));
+      __m128i d3 = _mm_loadu_si128 ((__m128i *) (d + 48));
+
+      d0 = _mm_or_si128 (_mm_and_si128 (d0, keep), _mm_sll_epi32 (a0, shift));
+      d1 = _mm_or_si128 (_mm_and_si128 (d1, keep), _mm_sll_epi32 (a1, shift));
+      d2 = _mm_or_si128 (_mm_and_si128 (d2, keep), _mm_sll_epi32 (a2, shift));
+      d3 = _mm_or_si128 (_mm_and_si128 (d3, keep), _mm_sll_epi32 (a3, shift));
+
+      _mm_storeu_si128 ((__m128i *) (d + 0), d0);
+      _mm_storeu_si128 ((__m128i *) (d + 16), d1);
+      _mm_storeu_si128 ((__m128i *) (d + 32), d2);
+      _mm_storeu_si128 ((__m128i *) (d + 48), d3);
+
+      d += 64;
+      s += 16;
+    }
+    copy_alpha_packed_line_c (d + offset, s, width - j);
+
+    dst += dstride;
+    src += sstride;
+  }
+}
+
+/* Same as the SSE2 version for 32 pixels at a time */
+__attribute__ ((target ("avx2")))
+static void
+copy_alpha_packed_avx2 (guint8 * dst, guint dstride, guint offset,
+    const guint8 * src, guint sstride, guint width, guint height)
+{
+  const __m128i shift = _mm_cvtsi32_si128 (offset * 8);
+  const __m256i keep = _mm256_set1_epi32 (~(0xffu << (offset * 8)));
+  guint i, j, k;
+
+  for (i = 0; i < height; i++) {
+    guint8 *d = dst;
+    const guint8 *s = src;
+
+    for (j = 0; j + 32 <= width; j += 32) {
+      for (k = 0; k < 4; k++) {
+        __m256i a = _mm256_cvtepu8_epi32 (_mm_loadl_epi64 ((const __m128i *)
+                (s + k * 8)));
+        __m256i v = _mm256_loadu_si256 ((__m256i *) (d + k * 32));
+
+        v = _mm256_or_si256 (_mm256_and_si256 (v, keep),
+            _mm256_sll_epi32 (a, shift));
+        _mm256_storeu_si256 ((__m256i *) (d + k * 32), v);
+      }
+      d += 128;
+      s += 32;
+    }
+    copy_alpha_packed_line_c (d + offset, s, width - j);
+
+    dst += dstride;
+    src += sstride;
+  }
+}
+#endif
+
+#ifdef HAVE_NEON
+/* De-interleave 16 pixels, replace the alpha channel and interleave back */
+static void
+copy_alpha_packed_neon (guint8 * dst, guint dstride, guint offset,
+    const guint8 * src, guint sstride, guint width, guint height)
+{
+  guint i, j;
+
+  for (i = 0; i < height; i++) {
+    guint8 *d = dst;
+    const guint8 *s = src;
+
+    for (j = 0; j + 16 <= width; j += 16) {
+      uint8x16x4_t v = vld4q_u8 (d);
+
+      v.val[offset] = vld1q_u8 (s);
+      vst4q_u8 (d, v);
+
+      d += 64;
+      s += 16;
+    }
+    copy_alpha_packed_line_c (d + offset, s, width - j);
+
+    dst += dstride;
+    src += sstride;
+  }
+}
+#endif
+
+void
+gst_alpha_mask_kernels_init (void)
+{
+  cpu_flags = 0;
+
+#ifdef HAVE_X86_SIMD
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("sse2"))
+    cpu_flags |= GST_ALPHA_MASK_CPU_SSE2;
+  if (__builtin_cpu_supports ("avx2"))
+    cpu_flags |= GST_ALPHA_MASK_CPU_AVX2;
+#endif
+
+#ifdef HAVE_NEON
+  cpu_flags |= GST_ALPHA_MASK_CPU_NEON;
+#endif
+}
+
+GstAlphaMaskCpuFlags
+gst_alpha_mask_get_cpu_flags (void)
+{
+  return cpu_flags;
+}
+
+/* Returns the fastest implementation usable with @flags */
+GstAlphaMaskCopyAlphaFunc
+gst_alpha_mask_get_copy_alpha_packed (GstAlphaMaskCpuFlags flags)
+{
+#ifdef HAVE_X86_SIMD
+  if (flags & GST_ALPHA_MASK_CPU_AVX2)
+    return copy_alpha_packed_avx2;
+  if (flags & GST_ALPHA_MASK_CPU_SSE2)
+    return copy_alpha_packed_sse2;
+#endif
+
+#ifdef HAVE_NEON
+  if (flags & GST_ALPHA_MASK_CPU_NEON)
+    return copy_alpha_packed_neon;
+#endif
+
+  return copy_alpha_packed_c;
+}
+
+/* x * a / 255 rounded, exact for 8 bit values */
+#define MUL_DIV_255(x, a) \
+    ((((x) * (a) + 128) + (((x) * (a) + 128) >> 8)) >> 8)
+
+static inline void
+premultiply_line_c (guint8 * dst, guint offset, guint width)
+{
+  guint i, c;
+
+  for (i = 0; i < width; i++) {
+    guint a = dst[offset];
+
+    for (c = 0; c < 4; c++)
+      if (c != offset)
+        dst[c] = MUL_DIV_255 (dst[c], a);
+    dst += 4;
+  }
+}
+
+static void
+premultiply_c (guint8 * dst, guint dstride, guint offset, guint width,
+    guint height)
+{
+  guint i;
+
+  for (i = 0; i < height; i++) {
+    premultiply_line_c (dst, offset, width);
+    dst += dstride;
+  }
+}
+
+#ifdef HAVE_X86_SIMD
+/* 4 pixels at a time in 16 bit lanes, the alpha of each pixel is broadcast
+ * by a shuffle, which needs the alpha offset as an immediate. The division
+ * by 255 is a multiply high by 257 of the rounded product. */
+#define DEFINE_PREMULTIPLY_SSE2(o)                                            \
+__attribute__ ((target ("sse2")))                                             \
+static void                                                                   \
+premultiply_sse2_##o (guint8 * dst, guint dstride, guint width,               \
+    guint height)                                                             \
+{                                                                             \
+  const __m128i zero = _mm_setzero_si128 ();                                  \
+  const __m128i round = _mm_set1_epi16 (128);                                 \
+  const __m128i div = _mm_set1_epi16 (257);                                   \
+  const __m128i amask = _mm_set1_epi32 (0xffu << (o * 8));                    \
+  guint i, j;                                                                 \
+                                                                              \
+  for (i = 0; i < height; i++) {                                              \
+    guint8 *d = dst;                                                          \
+                                                                              \
+    for (j = 0; j + 4 <= width; j += 4) {                                     \
+      __m128i v = _mm_loadu_si128 ((__m128i *) d);                            \
+      __m128i lo = _mm_unpacklo_epi8 (v, zero);                               \
+      __m128i hi = _mm_unpackhi_epi8 (v, zero);                               \
+      __m128i alo = _mm_shufflehi_epi16 (_mm_shufflelo_epi16 (lo,             \
+              _MM_SHUFFLE (o, o, o, o)), _MM_SHUFFLE (o, o, o, o));           \
+      __m128i ahi = _mm_shufflehi_epi16 (_mm_shufflelo_epi16 (hi,             \
+              _MM_SHUFFLE (o, o, o, o)), _MM_SHUFFLE (o, o, o, o));           \
+                                                                              \
+      lo = _mm_mulhi_epu16 (_mm_add_epi16 (_mm_mullo_epi16 (lo, alo),         \
+              round), div);                                                   \
+      hi = _mm_mulhi_epu16 (_mm_add_epi16 (_mm_mullo_epi16 (hi, ahi),         \
+              round), div);                                                   \
+      lo = _mm_packus_epi16 (lo, hi);                                         \
+      v = _mm_or_si128 (_mm_andnot_si128 (amask, lo),                         \
+          _mm_and_si128 (amask, v));                                          \
+      _mm_storeu_si128 ((__m128i *) d, v);                                    \
+      d += 16;                                                                \
+    }                                                                         \
+    premultiply_line_c (d, o, width - j);                                     \
+                                                                              \
+    dst += dstride;                                                           \
+  }                                                                           \
+}
+
+DEFINE_PREMULTIPLY_SSE2 (0);
+DEFINE_PREMULTIPLY_SSE2 (3);
+
+static void
+premultiply_sse2 (guint8 * dst, guint dstride, guint offset, guint width,
+    guint height)
+{
+  /* the RGB formats keep their alpha first or last */
+  if (offset == 0)
+    premultiply_sse2_0 (dst, dstride, width, height);
+  else if (offset == 3)
+    premultiply_sse2_3 (dst, dstride, width, height);
+  else
+    premultiply_c (dst, dstride, offset, width, height);
+}
+#endif
+
+#ifdef HAVE_X86_SIMD
+/* Multiplies the colors of 8 pixels by @a, which has the alpha of each pixel
+ * in all of its four bytes, and puts the alpha in the bytes of @amask */
+__attribute__ ((target ("avx2")))
+static inline __m256i
+premultiply8_avx2 (__m256i v, __m256i a, __m256i amask)
+{
+  const __m256i zero = _mm256_setzero_si256 ();
+  const __m256i round = _mm256_set1_epi16 (128);
+  const __m256i div = _mm256_set1_epi16 (257);
+  __m256i lo = _mm256_unpacklo_epi8 (v, zero);
+  __m256i hi = _mm256_unpackhi_epi8 (v, zero);
+
+  lo = _mm256_mulhi_epu16 (_mm256_add_epi16 (_mm256_mullo_epi16 (lo,
+              _mm256_unpacklo_epi8 (a, zero)), round), div);
+  hi = _mm256_mulhi_epu16 (_mm256_add_epi16 (_mm256_mullo_epi16 (hi,
+              _mm256_unpackhi_epi8 (a, zero)), round), div);
+
+  return _mm256_blendv_epi8 (_mm256_packus_epi16 (lo, hi), a, amask);
+}
+
+/* Same math as the SSE2 version for 8 pixels at a time. The alpha is spread
+ * over its pixel by a multiply, which works for any alpha offset. */
+__attribute__ ((target ("avx2")))
+static void
+premultiply_avx2 (guint8 * dst, guint dstride, guint offset, guint width,
+    guint height)
+{
+  const __m128i shift = _mm_cvtsi32_si128 (offset * 8);
+  const __m256i spread = _mm256_set1_epi32 (0x01010101);
+  const __m256i low = _mm256_set1_epi32 (0xff);
+  const __m256i amask = _mm256_set1_epi32 (0xffu << (offset * 8));
+  guint i, j;
+
+  for (i = 0; i < height; i++) {
+    guint8 *d = dst;
+
+    for (j = 0; j + 8 <= width; j += 8) {
+      __m256i v = _mm256_loadu_si256 ((__m256i *) d);
+      __m256i a = _mm256_and_si256 (_mm256_srl_epi32 (v, shift), low);
+
+      v = premultiply8_avx2 (v, _mm256_mullo_epi32 (a, spread), amask);
+      _mm256_storeu_si256 ((__m256i *) d, v);
+      d += 32;
+    }
+    premultiply_line_c (d, offset, width - j);
+
+    dst += dstride;
+  }
+}
+#endif
+
+#ifdef HAVE_NEON
+/* x * a / 255 rounded for 8 lanes, exact like MUL_DIV_255 */
+static inline uint8x8_t
+mul_div_255_neon (uint8x8_t x, uint8x8_t a)
+{
+  uint16x8_t t = vmull_u8 (x, a);
+
+  return vraddhn_u16 (t, vrshrq_n_u16 (t, 8));
+}
+
+static inline void
+premultiply16_neon (uint8x16x4_t * v, guint offset)
+{
+  uint8x16_t a = v->val[offset];
+  guint c;
+
+  for (c = 0; c < 4; c++) {
+    if (c == offset)
+      continue;
+    v->val[c] = vcombine_u8 (mul_div_255_neon (vget_low_u8 (v->val[c]),
+            vget_low_u8 (a)), mul_div_255_neon (vget_high_u8 (v->val[c]),
+            vget_high_u8 (a)));
+  }
+}
+
+/* De-interleave 16 pixels and multiply the color channels by the alpha */
+static void
+premultiply_neon (guint8 * dst, guint dstride, guint offset, guint width,
+    guint height)
+{
+  guint i, j;
+
+  for (i = 0; i < height; i++) {
+    guint8 *d = dst;
+
+    for (j = 0; j + 16 <= width; j += 16) {
+      uint8x16x4_t v = vld4q_u8 (d);
+
+      premultiply16_neon (&v, offset);
+      vst4q_u8 (d, v);
+      d += 64;
+    }
+    premultiply_line_c (d, offset, width - j);
+
+    dst += dstride;
+  }
+}
+#endif
+
+/* Returns the fastest implementation usable with @flags */
+GstAlphaMaskPremultiplyFunc
+gst_alpha_mask_get_premultiply (GstAlphaMaskCpuFlags flags)
+{
+#ifdef HAVE_X86_SIMD
+  if (flags & GST_ALPHA_MASK_CPU_AVX2)
+    return premultiply_avx2;
+  if (flags & GST_ALPHA_MASK_CPU_SSE2)
+    return premultiply_sse2;
+#endif
+
+#ifdef HAVE_NEON
+  if (flags & GST_ALPHA_MASK_CPU_NEON)
+    return premultiply_neon;
+#endif
+
+  return premultiply_c;
+}
+
+static inline void
+copy_alpha_premultiply_line_c (guint8 * dst, guint offset,
+    const guint8 * src, guint width)
+{
+  guint i, c;
+
+  for (i = 0; i < width; i++) {
+    guint a = src[i];
+
+    for (c = 0; c < 4; c++)
+      dst[c] = c == offset ? a : MUL_DIV_255 (dst[c], a);
+    dst += 4;
+  }
+}
+
+static void
+copy_alpha_premultiply_c (guint8 * dst, guint dstride, guint offset,
+    const guint8 * src, guint sstride, guint width, guint height)
+{
+  guint i;
+
+  for (i = 0; i < height; i++) {
+    copy_alpha_premultiply_line_c (dst, offset, src, width);
+    dst += dstride;
+    src += sstride;
+  }
+}
+
+#ifdef HAVE_X86_SIMD
+/* Multiplies the colors of 4 pixels by @a, which has the alpha of each pixel
+ * in all of its four bytes, and puts the alpha in the bytes of @amask */
+__attribute__ ((target ("sse2")))
+static inline __m128i
+premultiply4_sse2 (__m128i v, __m128i a, __m128i amask)
+{
+  const __m128i zero = _mm_setzero_si128 ();
+  const __m128i round = _mm_set1_epi16 (128);
+  const __m128i div = _mm_set1_epi16 (257);
+  __m128i lo = _mm_unpacklo_epi8 (v, zero);
+  __m128i hi = _mm_unpackhi_epi8 (v, zero);
+
+  lo = _mm_mulhi_epu16 (_mm_add_epi16 (_mm_mullo_epi16 (lo,
+              _mm_unpacklo_epi8 (a, zero)), round), div);
+  hi = _mm_mulhi_epu16 (_mm_add_epi16 (_mm_mullo_epi16 (hi,
+              _mm_unpackhi_epi8 (a, zero)), round), div);
+  v = _mm_packus_epi16 (lo, hi);
+
+  return _mm_or_si128 (_mm_andnot_si128 (amask, v), _mm_and_si128 (amask, a));
+}
+
+/* Like premultiply_sse2(), but the alpha comes from the mask: each alpha
+ * byte is repeated over its pixel by unpacking it with itself, so the
+ * offset only matters for the final blend */
+__attribute__ ((target ("sse2")))
+static void
+copy_alpha_premultiply_sse2 (guint8 * dst, guint dstride, guint offset,
+    const guint8 * src, guint sstride, guint width, guint height)
+{
+  const __m128i amask = _mm_set1_epi32 (0xffu << (offset * 8));
+  guint i, j;
+
+  for (i = 0; i < height; i++) {
+    guint8 *d = dst;
+    const guint8 *s = src;
+
+    for (j = 0; j + 16 <= width; j += 16) {
+      __m128i a = _mm_loadu_si128 ((const __m128i *) s);
+      __m128i a2lo = _mm_unpacklo_epi8 (a, a);
+      __m128i a2hi = _mm_unpackhi_epi8 (a, a);
+      __m128i a4[4];
+      guint k;
+
+      a4[0] = _mm_unpacklo_epi16 (a2lo, a2lo);
+      a4[1] = _mm_unpackhi_epi16 (a2lo, a2lo);
+      a4[2] = _mm_unpacklo_epi16 (a2hi, a2hi);
+      a4[3] = _mm_unpackhi_epi16 (a2hi, a2hi);
+
+      for (k = 0; k < 4; k++) {
+        __m128i v = _mm_loadu_si128 ((__m128i *) (d + k * 16));
+
+        _mm_storeu_si128 ((__m128i *) (d + k * 16),
+            premultiply4_sse2 (v, a4[k], amask));
+      }
+      d += 64;
+      s += 16;
+    }
+    copy_alpha_premultiply_line_c (d, offset, s, width - j);
+
+    dst += dstride;
+    src += sstride;
+  }
+}
+
+/* 8 alpha bytes at a time widened to dwords and spread over their pixel */
+__attribute__ ((target ("avx2")))
+static void
+copy_alpha_premultiply_avx2 (guint8 * dst, guint dstride, guint offset,
+    const guint8 * src, guint sstride, guint width, guint height)
+{
+  const __m256i spread = _mm256_set1_epi32 (0x01010101);
+  const __m256i amask = _mm256_set1_epi32 (0xffu << (offset * 8));
+  guint i, j;
+
+  for (i = 0; i < height; i++) {
+    guint8 *d = dst;
+    const guint8 *s = src;
+
+    for (j = 0; j + 8 <= width; j += 8) {
+      __m256i a = _mm256_cvtepu8_epi32 (_mm_loadl_epi64 ((const __m128i *)
+              s));
+      __m256i v = _mm256_loadu_si256 ((__m256i *) d);
+
+      v = premultiply8_avx2 (v, _mm256_mullo_epi32 (a, spread), amask);
+      _mm256_storeu_si256 ((__m256i *) d, v);
+      d += 32;
+      s += 8;
+    }
+    copy_alpha_premultiply_line_c (d, offset, s, width - j);
+
+    dst += dstride;
+    src += sstride;
+  }
+}
+#endif
+
+#ifdef HAVE_NEON
+/* De-interleave 16 pixels, replace the alpha channel and multiply */
+static void
+copy_alpha_premultiply_neon (guint8 * dst, guint dstride, guint offset,
+    const guint8 * src, guint sstride, guint width, guint height)
+{
+  guint i, j;
+
+  for (i = 0; i < height; i++) {
+    guint8 *d = dst;
+    const guint8 *s = src;
+
+    for (j = 0; j + 16 <= width; j += 16) {
+      uint8x16x4_t v = vld4q_u8 (d);
+
+      v.val[offset] = vld1q_u8 (s);
+      premultiply16_neon (&v, offset);
+      vst4q_u8 (d, v);
+
+      d += 64;
+      s += 16;
+    }
+    copy_alpha_premultiply_line_c (d, offset, s, width - j);
+
+    dst += dstride;
+    src += sstride;
+  }
+}
+#endif
+
+/* Returns the fastest implementation usable with @flags */
+GstAlphaMaskCopyAlphaFunc
+gst_alpha_mask_get_copy_alpha_premultiply (GstAlphaMaskCpuFlags flags)
+{
+#ifdef HAVE_X86_SIMD
+  if (flags & GST_ALPHA_MASK_CPU_AVX2)
+    return copy_alpha_premultiply_avx2;
+  if (flags & GST_ALPHA_MASK_CPU_SSE2)
+    return copy_alpha_premultiply_sse2;
+#endif
+
+#ifdef HAVE_NEON
+  if (flags & GST_ALPHA_MASK_CPU_NEON)
+    return copy_alpha_premultiply_neon;
+#endif
+
+  return copy_alpha_premultiply_c;
+}
+
+/* YUV to AYUV. The chroma samples are replicated horizontally, which is what
+ * the video converter fast paths do too. @ys and @cs are the pixel strides of
+ * the luma and chroma components and @csub the horizontal chroma subsampling
+ * shift, all constants once inlined. */
+static inline void
+fuse_yuv_ayuv (guint8 * dst, const guint8 * comp[3], const guint8 * alpha,
+    guint8 value, guint width, guint ys, guint cs, guint csub)
+{
+  const guint8 *y = comp[0];
+  const guint8 *u = comp[1];
+  const guint8 *v = comp[2];
+  guint i;
+
+  if (alpha) {
+    for (i = 0; i < width; i++) {
+      guint c = (i >> csub) * cs;
+      dst[0] = alpha[i];
+      dst[1] = y[i * ys];
+      dst[2] = u[c];
+      dst[3] = v[c];
+      dst += 4;
+    }
+  } else {
+    for (i = 0; i < width; i++) {
+      guint c = (i >> csub) * cs;
+      dst[0] = value;
+      dst[1] = y[i * ys];
+      dst[2] = u[c];
+      dst[3] = v[c];
+      dst += 4;
+    }
+  }
+}
+
+#define FIX_SHIFT 14
+#define FIX(x) ((gint) ((x) * (1 << FIX_SHIFT) + 0.5))
+#define CLAMP_BYTE(x) ((x) < 0 ? 0 : (x) > 255 ? 255 : (x))
+
+/* YUV to packed RGB with alpha, same sampling as fuse_yuv_ayuv() and the
+ * output channels at byte offsets @ao, @ro, @go and @bo */
+static inline void
+fuse_yuv_argb (guint8 * dst, const guint8 * comp[3], const guint8 * alpha,
+    guint8 value, const GstAlphaMaskYuvMatrix * m, guint width, guint ys,
+    guint cs, guint csub, guint ao, guint ro, guint go, guint bo)
+{
+  const guint8 *y = comp[0];
+  const guint8 *u = comp[1];
+  const guint8 *v = comp[2];
+  guint i;
+
+  for (i = 0; i < width; i++) {
+    guint c = (i >> csub) * cs;
+    gint yv = (y[i * ys] - m->y_offset) * m->y + (1 << (FIX_SHIFT - 1));
+    gint uv = u[c] - m->c_offset;
+    gint vv = v[c] - m->c_offset;
+    gint r = (yv + m->rv * vv) >> FIX_SHIFT;
+    gint g = (yv - m->gu * uv - m->gv * vv) >> FIX_SHIFT;
+    gint b = (yv + m->bu * uv) >> FIX_SHIFT;
+
+    dst[ao] = alpha ? alpha[i] : value;
+    dst[ro] = CLAMP_BYTE (r);
+    dst[go] = CLAMP_BYTE (g);
+    dst[bo] = CLAMP_BYTE (b);
+    dst += 4;
+  }
+}
+
+/* RGB to packed RGB with alpha, @ps is the pixel stride of the input and
+ * @ao, @ro, @go, @bo the byte offsets of the output channels */
+static inline void
+fuse_rgb_argb (guint8 * dst, const guint8 * comp[3], const guint8 * alpha,
+    guint8 value, guint width, guint ps, guint ao, guint ro, guint go,
+    guint bo)
+{
+  const guint8 *r = comp[0];
+  const guint8 *g = comp[1];
+  const guint8 *b = comp[2];
+  guint i;
+
+  if (alpha) {
+    for (i = 0; i < width; i++) {
+      dst[ao] = alpha[i];
+      dst[ro] = r[i * ps];
+      dst[go] = g[i * ps];
+      dst[bo] = b[i * ps];
+      dst += 4;
+    }
+  } else {
+    for (i = 0; i < width; i++) {
+      dst[ao] = value;
+      dst[ro] = r[i * ps];
+      dst[go] = g[i * ps];
+      dst[bo] = b[i * ps];
+      dst += 4;
+    }
+  }
+}
+
+/* I420, YV12, Y42B */
+static void
+fuse_planar_ayuv (guint8 * dst, const guint8 * comp[3],
+    const guint8 * alpha, guint8 value, const GstAlphaMaskYuvMatrix * matrix,
+    guint width)
+{
+  fuse_yuv_ayuv (dst, comp, alpha, value, width, 1, 1, 1);
+}
+
+/* Y444 */
+static void
+fuse_planar444_ayuv (guint8 * dst, const guint8 * comp[3],
+    const guint8 * alpha, guint8 value, const GstAlphaMaskYuvMatrix * matrix,
+    guint width)
+{
+  fuse_yuv_ayuv (dst, comp, alpha, value, width, 1, 1, 0);
+}
+
+/* NV12, NV21 */
+static void
+fuse_semiplanar_ayuv (guint8 * dst, const guint8 * comp[3],
+    const guint8 * alpha, guint8 value, const GstAlphaMaskYuvMatrix * matrix,
+    guint width)
+{
+  fuse_yuv_ayuv (dst, comp, alpha, value, width, 1, 2, 1);
+}
+
+/* YUY2, UYVY, YVYU */
+static void
+fuse_packed422_ayuv (guint8 * dst, const guint8 * comp[3],
+    const guint8 * alpha, guint8 value, const GstAlphaMaskYuvMatrix * matrix,
+    guint width)
+{
+  fuse_yuv_ayuv (dst, comp, alpha, value, width, 2, 4, 1);
+}
+
+/* the same YUV layouts into each RGB output with alpha */
+#define DEFINE_FUSE_YUV(out, ao, ro, go, bo)                            \
+static void                                                             \
+fuse_planar_##out (guint8 * dst, const guint8 * comp[3],                \
+    const guint8 * alpha, guint8 value,                                 \
+    const GstAlphaMaskYuvMatrix * matrix, guint width)                  \
+{                                                                       \
+  fuse_yuv_argb (dst, comp, alpha, value, matrix, width, 1, 1, 1,       \
+      ao, ro, go, bo);                                                  \
+}                                                                       \
+                                                                        \
+static void                                                             \
+fuse_planar444_##out (guint8 * dst, const guint8 * comp[3],             \
+    const guint8 * alpha, guint8 value,                                 \
+    const GstAlphaMaskYuvMatrix * matrix, guint width)                  \
+{                                                                       \
+  fuse_yuv_argb (dst, comp, alpha, value, matrix, width, 1, 1, 0,       \
+      ao, ro, go, bo);                                                  \
+}                                                                       \
+                                                                        \
+static void                                                             \
+fuse_semiplanar_##out (guint8 * dst, const guint8 * comp[3],            \
+    const guint8 * alpha, guint8 value,                                 \
+    const GstAlphaMaskYuvMatrix * matrix, guint width)                  \
+{                                                                       \
+  fuse_yuv_argb (dst, comp, alpha, value, matrix, width, 1, 2, 1,       \
+      ao, ro, go, bo);                                                  \
+}                                                                       \
+                                                                        \
+static void                                                             \
+fuse_packed422_##out (guint8 * dst, const guint8 * comp[3],             \
+    const guint8 * alpha, guint8 value,                                 \
+    const GstAlphaMaskYuvMatrix * matrix, guint width)                  \
+{                                                                       \
+  fuse_yuv_argb (dst, comp, alpha, value, matrix, width, 2, 4, 1,       \
+      ao, ro, go, bo);                                                  \
+}
+
+DEFINE_FUSE_YUV (yuv_argb, 0, 1, 2, 3);
+DEFINE_FUSE_YUV (yuv_bgra, 3, 2, 1, 0);
+DEFINE_FUSE_YUV (yuv_rgba, 3, 0, 1, 2);
+DEFINE_FUSE_YUV (yuv_abgr, 0, 3, 2, 1);
+
+/* xRGB, xBGR, RGBx, BGRx and RGB, BGR into each RGB output with alpha */
+#define DEFINE_FUSE_RGB(out, ao, ro, go, bo)                            \
+static void                                                             \
+fuse_rgb32_##out (guint8 * dst, const guint8 * comp[3],                 \
+    const guint8 * alpha, guint8 value,                                 \
+    const GstAlphaMaskYuvMatrix * matrix, guint width)                  \
+{                                                                       \
+  fuse_rgb_argb (dst, comp, alpha, value, width, 4, ao, ro, go, bo);    \
+}                                                                       \
+                                                                        \
+static void                                                             \
+fuse_rgb24_##out (guint8 * dst, const guint8 * comp[3],                 \
+    const guint8 * alpha, guint8 value,                                 \
+    const GstAlphaMaskYuvMatrix * matrix, guint width)                  \
+{                                                                       \
+  fuse_rgb_argb (dst, comp, alpha, value, width, 3, ao, ro, go, bo);    \
+}
+
+DEFINE_FUSE_RGB (argb, 0, 1, 2, 3);
+DEFINE_FUSE_RGB (bgra, 3, 2, 1, 0);
+DEFINE_FUSE_RGB (rgba, 3, 0, 1, 2);
+DEFINE_FUSE_RGB (abgr, 0, 3, 2, 1);
+
+#define FUSE_YUV_CASES(out)                                             \
+    case GST_VIDEO_FORMAT_I420:                                         \
+    case GST_VIDEO_FORMAT_YV12:                                         \
+    case GST_VIDEO_FORMAT_Y42B:                                         \
+      return fuse_planar_##out;                                         \
+    case GST_VIDEO_FORMAT_Y444:                                         \
+      return fuse_planar444_##out;                                      \
+    case GST_VIDEO_FORMAT_NV12:                                         \
+    case GST_VIDEO_FORMAT_NV21:                                         \
+      return fuse_semiplanar_##out;                                     \
+    case GST_VIDEO_FORMAT_YUY2:                                         \
+    case GST_VIDEO_FORMAT_UYVY:                                         \
+    case GST_VIDEO_FORMAT_YVYU:                                         \
+      return fuse_packed422_##out;
+
+#define FUSE_RGB_CASES(out)                                             \
+  switch (in) {                                                         \
+    case GST_VIDEO_FORMAT_xRGB:                                         \
+    case GST_VIDEO_FORMAT_xBGR:                                         \
+    case GST_VIDEO_FORMAT_RGBx:                                         \
+    case GST_VIDEO_FORMAT_BGRx:                                         \
+      return fuse_rgb32_##out;                                          \
+    case GST_VIDEO_FORMAT_RGB:                                          \
+    case GST_VIDEO_FORMAT_BGR:                                          \
+      return fuse_rgb24_##out;                                          \
+    FUSE_YUV_CASES (yuv_##out)                                          \
+    default:                                                            \
+      break;                                                            \
+  }
+
+GstAlphaMaskFuseLineFunc
+gst_alpha_mask_get_fuse_line (GstVideoFormat in, GstVideoFormat out)
+{
+  switch (out) {
+    case GST_VIDEO_FORMAT_AYUV:
+      switch (in) {
+        FUSE_YUV_CASES (ayuv)
+        default:
+          break;
+      }
+      break;
+    case GST_VIDEO_FORMAT_ARGB:
+      FUSE_RGB_CASES (argb);
+      break;
+    case GST_VIDEO_FORMAT_BGRA:
+      FUSE_RGB_CASES (bgra);
+      break;
+    case GST_VIDEO_FORMAT_RGBA:
+      FUSE_RGB_CASES (rgba);
+      break;
+    case GST_VIDEO_FORMAT_ABGR:
+      FUSE_RGB_CASES (abgr);
+      break;
+    default:
+      break;
+  }
+
+  return NULL;
+}
+
+gboolean
+gst_alpha_mask_yuv_matrix_init (GstAlphaMaskYuvMatrix * matrix,
+    const GstVideoInfo * info)
+{
+  gint offset[4], scale[4];
+  gdouble kr, kb, kg, cs;
+
+  if (!GST_VIDEO_INFO_IS_YUV (info) ||
+      !gst_video_color_matrix_get_Kr_Kb (info->colorimetry.matrix, &kr, &kb))
+    return FALSE;
+
+  gst_video_color_range_offsets (info->colorimetry.range, info->finfo,
+      offset, scale);
+  kg = 1.0 - kr - kb;
+  cs = 255.0 / scale[1];
+
+  matrix->y_offset = offset[0];
+  matrix->c_offset = offset[1];
+  matrix->y = FIX (255.0 / scale[0]);
+  matrix->rv = FIX (2.0 * (1.0 - kr) * cs);
+  matrix->gu = FIX (2.0 * (1.0 - kb) * kb / kg * cs);
+  matrix->gv = FIX (2.0 * (1.0 - kr) * kr / kg * cs);
+  matrix->bu = FIX (2.0 * (1.0 - kb) * cs);
+
+  return TRUE;
+}
+
+/* Sample positions are in 16.16 fixed point and centered on the pixels, so
+ * the scaled mask lines up with the video edges */
+static void
+scale_alpha_nearest (guint8 * dst, guint dstride, guint dstep, guint dwidth,
+    guint dheight, guint line, guint lines, const guint8 * src, guint sstride,
+    guint swidth, guint sheight)
+{
+  guint32 xinc = (swidth << 16) / dwidth;
+  guint32 yinc = (sheight << 16) / dheight;
+  guint32 x, y = yinc / 2 + line * yinc;
+  guint i, j;
+
+  dst += line * dstride;
+  for (j = 0; j < lines; j++, y += yinc) {
+    const guint8 *sp = src + (y >> 16) * sstride;
+    guint8 *dp = dst;
+
+    x = xinc / 2;
+    for (i = 0; i < dwidth; i++, x += xinc) {
+      *dp = sp[x >> 16];
+      dp += dstep;
+    }
+    dst += dstride;
+  }
+}
+
+static void
+scale_alpha_bilinear (guint8 * dst, guint dstride, guint dstep, guint dwidth,
+    guint dheight, guint line, guint lines, const guint8 * src, guint sstride,
+    guint swidth, guint sheight)
+{
+  gint xinc = (swidth << 16) / dwidth;
+  gint yinc = (sheight << 16) / dheight;
+  gint xmax = (gint) (swidth - 1) << 16;
+  gint ymax = (gint) (sheight - 1) << 16;
+  gint x, y = yinc / 2 - 32768 + (gint) line * yinc;
+  guint i, j;
+
+  dst += line * dstride;
+  for (j = 0; j < lines; j++, y += yinc) {
+    gint yc = CLAMP (y, 0, ymax);
+    guint yi = yc >> 16, fy = (yc >> 8) & 0xff;
+    const guint8 *s0 = src + yi * sstride;
+    const guint8 *s1 = yi + 1 < sheight ? s0 + sstride : s0;
+    guint8 *dp = dst;
+
+    x = xinc / 2 - 32768;
+    for (i = 0; i < dwidth; i++, x += xinc) {
+      gint xc = CLAMP (x, 0, xmax);
+      guint xi = xc >> 16, fx = (xc >> 8) & 0xff;
+      guint xn = xi + 1 < swidth ? xi + 1 : xi;
+      guint top = s0[xi] * (256 - fx) + s0[xn] * fx;
+      guint bottom = s1[xi] * (256 - fx) + s1[xn] * fx;
+
+      *dp = (top * (256 - fy) + bottom * fy + 32768) >> 16;
+      dp += dstep;
+    }
+    dst += dstride;
+  }
+}
+
+void
+gst_alpha_mask_scale_alpha (guint8 * dst, guint dstride, guint dstep,
+    guint dwidth, guint dheight, guint line, guint lines, const guint8 * src,
+    guint sstride, guint swidth, guint sheight, gboolean bilinear)
+{
+  if (bilinear)
+    scale_alpha_bilinear (dst, dstride, dstep, dwidth, dheight, line, lines,
+        src, sstride, swidth, sheight);
+  else
+    scale_alpha_nearest (dst, dstride, dstep, dwidth, dheight, line, lines,
+        src, sstride, swidth, sheight);
+}
+
+/* a sample of @bits as a 16 bit one, the top bits are repeated at the bottom
+ * so that full scale stays full scale */
+static inline guint
+expand_alpha (const guint8 * p, guint bits)
+{
+  guint v;
+
+  if (bits == 8)
+    return p[0] * 257;
+
+  v = p[0] | (p[1] << 8);
+  if (bits == 16)
+    return v;
+  v &= (1 << bits) - 1;
+
+  return (v << (16 - bits)) | (v >> (2 * bits - 16));
+}
+
+static inline void
+store_alpha (guint8 * p, guint v, guint bits)
+{
+  v >>= 16 - bits;
+  p[0] = v;
+  if (bits > 8)
+    p[1] = v >> 8;
+}
+
+void
+gst_alpha_mask_convert_alpha (guint8 * dst, guint dstride, guint dstep,
+    guint dbits, guint dwidth, guint dheight, guint line, guint lines,
+    const guint8 * src, guint sstride, guint sstep, guint sbits,
+    guint swidth, guint sheight)
+{
+  guint32 xinc = (swidth << 16) / dwidth;
+  guint32 yinc = (sheight << 16) / dheight;
+  guint32 x, y = yinc / 2 + line * yinc;
+  guint i, j;
+
+  /* same positions as scale_alpha_nearest, which are the identity when
+   * the sizes match */
+  dst += line * dstride;
+  for (j = 0; j < lines; j++, y += yinc) {
+    const guint8 *sp = src + (y >> 16) * sstride;
+    guint8 *dp = dst;
+
+    x = xinc / 2;
+    if (sbits == 8 && dbits == 8) {
+      /* a byte out of every pixel of an interleaved mask */
+      for (i = 0; i < dwidth; i++, x += xinc) {
+        *dp = sp[(x >> 16) * sstep];
+        dp += dstep;
+      }
+    } else {
+      for (i = 0; i < dwidth; i++, x += xinc) {
+        store_alpha (dp, expand_alpha (sp + (x >> 16) * sstep, sbits),
+            dbits);
+        dp += dstep;
+      }
+    }
+    dst += dstride;
+  }
+}
+
+gboolean
+gst_alpha_mask_decode_bitmap (guint8 * dst, guint dstride, guint dstep,
+    guint dbits, guint dwidth, guint dheight, guint line, guint lines,
+    const guint8 * src, gsize size, guint swidth, guint sheight)
+{
+  guint sstride = (swidth + 7) / 8;
+  guint32 xinc = (swidth << 16) / dwidth;
+  guint32 yinc = (sheight << 16) / dheight;
+  guint32 x, y = yinc / 2 + line * yinc;
+  guint i, j;
+
+  if (size < (gsize) sstride * sheight)
+    return FALSE;
+
+  dst += line * dstride;
+  for (j = 0; j < lines; j++, y += yinc) {
+    const guint8 *sp = src + (y >> 16) * sstride;
+    guint8 *dp = dst;
+
+    x = xinc / 2;
+    for (i = 0; i < dwidth; i++, x += xinc) {
+      guint sx = x >> 16;
+      guint bit = (sp[sx >> 3] >> (7 - (sx & 7))) & 1;
+
+      if (dbits == 8)
+        *dp = -bit;
+      else
+        store_alpha (dp, bit * 0xffff, dbits);
+      dp += dstep;
+    }
+    dst += dstride;
+  }
+
+  return TRUE;
+}
+
+/* Reads one run off an RLE line, returns FALSE at the end of the data or
+ * on lengths that can't be right */
+static inline gboolean
+read_rle_run (const guint8 ** src, const guint8 * end, guint * len,
+    guint8 * value)
+{
+  const guint8 *sp = *src;
+  guint shift = 0;
+
+  *len = 0;
+  do {
+    if (sp >= end || shift > 28)
+      return FALSE;
+    *len |= (guint) (*sp & 0x7f) << shift;
+    shift += 7;
+  } while (*sp++ & 0x80);
+
+  if (sp >= end || *len == 0)
+    return FALSE;
+  *value = *sp++;
+  *src = sp;
+
+  return TRUE;
+}
+
+/* Moves @src past one RLE line of @width pixels */
+static gboolean
+skip_rle_line (const guint8 ** src, const guint8 * end, guint width)
+{
+  guint sx, len;
+  guint8 value;
+
+  for (sx = 0; sx < width; sx += len)
+    if (!read_rle_run (src, end, &len, &value) || len > width - sx)
+      return FALSE;
+
+  return TRUE;
+}
+
+gboolean
+gst_alpha_mask_decode_rle (guint8 * dst, guint dstride, guint dstep,
+    guint dbits, guint dwidth, guint dheight, const guint8 * src, gsize size,
+    guint swidth, guint sheight, GstAlphaMaskPremultiplyFunc premultiply,
+    guint offset)
+{
+  const guint8 *end = src + size, *line = src, *next = NULL;
+  guint32 xinc = (swidth << 16) / dwidth;
+  guint32 yinc = (sheight << 16) / dheight;
+  guint32 x, y = yinc / 2;
+  guint sy = 0, j;
+
+  for (j = 0; j < dheight; j++, y += yinc) {
+    const guint8 *sp;
+    guint8 *dp = dst;
+    guint sx = 0, i = 0, len;
+    guint8 value;
+
+    /* move on to the source line, which repeats when upscaling */
+    while (sy < (y >> 16)) {
+      if (!next) {
+        next = line;
+        if (!skip_rle_line (&next, end, swidth))
+          return FALSE;
+      }
+      line = next;
+      next = NULL;
+      sy++;
+    }
+
+    sp = line;
+    x = xinc / 2;
+    while (sx < swidth) {
+      if (!read_rle_run (&sp, end, &len, &value) || len > swidth - sx)
+        return FALSE;
+      sx += len;
+
+      if (dstep == 1 && dbits == 8 && swidth == dwidth) {
+        memset (dp, value, len);
+        dp += len;
+      } else {
+        for (; i < dwidth && (x >> 16) < sx; i++, x += xinc) {
+          store_alpha (dp, value * 257, dbits);
+          dp += dstep;
+        }
+      }
+    }
+    next = sp;
+    if (premultiply)
+      premultiply (dst - offset, dstride, offset, dwidth, 1);
+    dst += dstride;
+  }
+
+  return TRUE;
+}
+
+GstAlphaMaskBlockClass
+gst_alpha_mask_classify_block (const guint8 * src, guint stride, guint width,
+    guint height)
+{
+  guint64 v, ref;
+  guint i, j;
+
+  if (src[0] != 0x00 && src[0] != 0xff)
+    return GST_ALPHA_MASK_BLOCK_MIXED;
+
+  ref = src[0] ? G_GUINT64_CONSTANT (0xffffffffffffffff) : 0;
+
+  for (i = 0; i < height; i++) {
+    for (j = 0; j + 8 <= width; j += 8) {
+      memcpy (&v, src + j, 8);
+      if (v != ref)
+        return GST_ALPHA_MASK_BLOCK_MIXED;
+    }
+    for (; j < width; j++)
+      if (src[j] != (guint8) ref)
+        return GST_ALPHA_MASK_BLOCK_MIXED;
+    src += stride;
+  }
+
+  return ref ? GST_ALPHA_MASK_BLOCK_OPAQUE : GST_ALPHA_MASK_BLOCK_TRANSPARENT;
+}
+
+/* FNV-1a style hash over the visible part of a plane, eight bytes at a time.
+ * Lines are hashed independently of the stride so padding bytes don't
+ * matter. */
+guint64
+gst_alpha_mask_hash_plane (const guint8 * src, guint stride, guint width,
+    guint height)
+{
+  guint64 hash = G_GUINT64_CONSTANT (0xcbf29ce484222325);
+  const guint64 prime = G_GUINT64_CONSTANT (0x100000001b3);
+  guint i, j;
+
+  for (i = 0; i < height; i++) {
+    const guint8 *sp = src;
+    guint64 v;
+
+    for (j = 0; j + 8 <= width; j += 8) {
+      memcpy (&v, sp + j, 8);
+      hash = (hash ^ v) * prime;
+      hash ^= hash >> 29;
+    }
+    for (; j < width; j++)
+      hash = (hash ^ sp[j]) * prime;
+
+    src += stride;
+  }
+
+  return hash;
+}
+
+void
+gst_alpha_mask_copy_plane (guint8 * dst, guint dstride, const guint8 * src,
+    guint sstride, guint width, guint height)
+{
+  guint j;
+
+  if (!height)
+    return;
+
+  if (sstride == dstride) {
+    /* stop at the last visible byte, @src may point into a cropped plane */
+    memcpy (dst, src, (height - 1) * sstride + width);
+    return;
+  }
+
+  for (j = 0; j < height; j++) {
+    memcpy (dst, src, width);
+    dst += dstride;
+    src += sstride;
+  }
+}
+
+void
+gst_alpha_mask_fill_alpha (guint8 * dst, guint dstride, guint dstep,
+    guint offset, guint width, guint lines, guint8 value)
+{
+  guint8 keep_bytes[4] = { 0xff, 0xff, 0xff, 0xff };
+  guint8 set_bytes[4] = { 0, 0, 0, 0 };
+  guint32 keep, set, v;
+  guint i, j;
+
+  if (dstep == 1) {
+    for (j = 0; j < lines; j++) {
+      memset (dst, value, width);
+      dst += dstride;
+    }
+    return;
+  }
+
+  /* whole pixels at a time, this vectorizes where a byte store would not */
+  keep_bytes[offset] = 0;
+  set_bytes[offset] = value;
+  memcpy (&keep, keep_bytes, 4);
+  memcpy (&set, set_bytes, 4);
+
+  for (j = 0; j < lines; j++) {
+    for (i = 0; i < width; i++) {
+      memcpy (&v, dst + i * 4, 4);
+      v = (v & keep) | set;
+      memcpy (dst + i * 4, &v, 4);
+    }
+    dst += dstride;
+  }
+}
+
+void
+gst_alpha_mask_fill_alpha16 (guint8 * dst, guint dstride, guint dstep,
+    guint offset, guint width, guint lines, guint16 value)
+{
+  guint i, j;
+
+  dst += offset;
+  for (j = 0; j < lines; j++) {
+    guint8 *dp = dst;
+
+    for (i = 0; i < width; i++) {
+      dp[0] = value & 0xff;
+      dp[1] = value >> 8;
+      dp += dstep;
+    }
+    dst += dstride;
+  }
+}
@@ -0,0 +1,295 @@
+/* GStreamer AlphaMask plugin
+ * Copyright (C) 2016 Oblong Industries
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __ALPHA_KERNELS_H__
+#define __ALPHA_KERNELS_H__
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+G_BEGIN_DECLS
+
+/* SIMD extensions the kernels can make use of */
+typedef enum
+{
+  GST_ALPHA_MASK_CPU_SSE2 = (1 << 0),
+  GST_ALPHA_MASK_CPU_AVX2 = (1 << 1),
+  GST_ALPHA_MASK_CPU_NEON = (1 << 2),
+} GstAlphaMaskCpuFlags;
+
+/**
+ * GstAlphaMaskCopyAlphaFunc:
+ * @dst: first pixel of the packed destination
+ * @dstride: destination stride in bytes
+ * @offset: byte offset of the alpha channel within a pixel, 0 to 3
+ * @src: alpha plane
+ * @sstride: alpha plane stride in bytes
+ * @width: number of pixels per line
+ * @height: number of lines
+ *
+ * Writes the alpha plane into every fourth byte of a packed 32 bits per
+ * pixel frame.
+ */
+typedef void (*GstAlphaMaskCopyAlphaFunc) (guint8 * dst, guint dstride,
+    guint offset, const guint8 * src, guint sstride, guint width,
+    guint height);
+
+/**
+ * GstAlphaMaskYuvMatrix:
+ * @y_offset: black level of the luma
+ * @c_offset: zero level of the chroma
+ * @y: luma scale
+ * @rv: V contribution to red
+ * @gu: U contribution to green, subtracted
+ * @gv: V contribution to green, subtracted
+ * @bu: U contribution to blue
+ *
+ * Y'CbCr to R'G'B' conversion in 14 bit fixed point, see
+ * gst_alpha_mask_yuv_matrix_init().
+ */
+typedef struct
+{
+  gint y_offset;
+  gint c_offset;
+  gint y;
+  gint rv;
+  gint gu;
+  gint gv;
+  gint bu;
+} GstAlphaMaskYuvMatrix;
+
+/**
+ * GstAlphaMaskFuseLineFunc:
+ * @dst: destination line in the packed output format
+ * @comp: pointers to the first color component of the line, in
+ *   Y, U, V or R, G, B order
+ * @alpha: alpha line, or %NULL to give the whole line @value
+ * @value: alpha of the line without @alpha
+ * @matrix: the conversion of YUV input into RGB output, ignored otherwise
+ * @width: number of pixels
+ *
+ * Converts one line of video into a packed format with alpha and writes
+ * the alpha byte in the same pass. The output is AYUV for YUV input, or one
+ * of ARGB, BGRA, RGBA or ABGR for RGB and YUV input.
+ */
+typedef void (*GstAlphaMaskFuseLineFunc) (guint8 * dst,
+    const guint8 * comp[3], const guint8 * alpha, guint8 value,
+    const GstAlphaMaskYuvMatrix * matrix, guint width);
+
+/**
+ * GstAlphaMaskPremultiplyFunc:
+ * @dst: first pixel of the packed frame
+ * @dstride: stride in bytes
+ * @offset: byte offset of the alpha channel within a pixel, 0 to 3
+ * @width: number of pixels per line
+ * @height: number of lines
+ *
+ * Multiplies the color channels of every pixel of a packed 32 bits per
+ * pixel frame by its alpha, rounding to the nearest value.
+ */
+typedef void (*GstAlphaMaskPremultiplyFunc) (guint8 * dst, guint dstride,
+    guint offset, guint width, guint height);
+
+void gst_alpha_mask_kernels_init (void);
+
+GstAlphaMaskCpuFlags gst_alpha_mask_get_cpu_flags (void);
+
+GstAlphaMaskCopyAlphaFunc gst_alpha_mask_get_copy_alpha_packed (
+    GstAlphaMaskCpuFlags flags);
+
+GstAlphaMaskPremultiplyFunc gst_alpha_mask_get_premultiply (
+    GstAlphaMaskCpuFlags flags);
+
+/* writes the alpha like the copy_alpha_packed kernels and premultiplies the
+ * colors by it in the same pass */
+GstAlphaMaskCopyAlphaFunc gst_alpha_mask_get_copy_alpha_premultiply (
+    GstAlphaMaskCpuFlags flags);
+
+GstAlphaMaskFuseLineFunc gst_alpha_mask_get_fuse_line (GstVideoFormat in,
+    GstVideoFormat out);
+
+/**
+ * gst_alpha_mask_yuv_matrix_init:
+ * @matrix: the matrix to set up
+ * @info: the YUV input
+ *
+ * Sets up @matrix for the color matrix and range of @info, into full range
+ * RGB like the video converter does with the full matrix mode.
+ *
+ * Returns: %FALSE when @info has no YUV matrix.
+ */
+gboolean gst_alpha_mask_yuv_matrix_init (GstAlphaMaskYuvMatrix * matrix,
+    const GstVideoInfo * info);
+
+/**
+ * gst_alpha_mask_scale_alpha:
+ * @dst: first alpha byte of the destination
+ * @dstride: destination stride in bytes
+ * @dstep: distance in bytes between two alpha bytes, 1 for planar alpha or
+ *   4 for packed formats
+ * @line: first destination line to write
+ * @lines: number of destination lines to write
+ * @src: first pixel of the mask region
+ * @bilinear: %TRUE to interpolate, %FALSE for nearest neighbour
+ *
+ * Scales a @swidth x @sheight mask region to @dwidth x @dheight while
+ * writing it into the destination. Only lines @line to @line + @lines of
+ * the destination are written, so a frame can be split into slices.
+ */
+void gst_alpha_mask_scale_alpha (guint8 * dst, guint dstride, guint dstep,
+    guint dwidth, guint dheight, guint line, guint lines, const guint8 * src,
+    guint sstride, guint swidth, guint sheight, gboolean bilinear);
+
+/**
+ * gst_alpha_mask_convert_alpha:
+ * @dst: first alpha sample of the destination
+ * @dstride: destination stride in bytes
+ * @dstep: distance in bytes between two alpha samples
+ * @dbits: bits per destination sample
+ * @src: first sample of the mask region
+ * @sstride: mask stride in bytes
+ * @sstep: distance in bytes between two mask samples
+ * @sbits: bits per mask sample
+ *
+ * Like gst_alpha_mask_scale_alpha() with nearest neighbour sampling, but
+ * reads one component of an interleaved mask and changes the depth of the
+ * samples on the way. Samples of more than 8 bits are little endian 16 bit
+ * words. Opaque stays opaque whatever the depths.
+ */
+void gst_alpha_mask_convert_alpha (guint8 * dst, guint dstride, guint dstep,
+    guint dbits, guint dwidth, guint dheight, guint line, guint lines,
+    const guint8 * src, guint sstride, guint sstep, guint sbits,
+    guint swidth, guint sheight);
+
+/**
+ * gst_alpha_mask_decode_bitmap:
+ * @dst: first alpha sample of the destination
+ * @dstride: destination stride in bytes
+ * @dstep: distance in bytes between two alpha samples
+ * @dbits: bits per destination sample
+ * @line: first destination line to write
+ * @lines: number of destination lines to write
+ * @src: the 1 bit mask
+ * @size: size of @src in bytes
+ *
+ * Expands a @swidth x @sheight 1 bit mask into transparent and opaque alpha
+ * samples, scaled to @dwidth x @dheight with nearest neighbour sampling.
+ * Lines are (@swidth + 7) / 8 bytes, the most significant bit is the
+ * leftmost pixel. Samples of more than 8 bits are little endian 16 bit
+ * words.
+ *
+ * Returns: %FALSE, without writing anything, when @src is too small.
+ */
+gboolean gst_alpha_mask_decode_bitmap (guint8 * dst, guint dstride,
+    guint dstep, guint dbits, guint dwidth, guint dheight, guint line,
+    guint lines, const guint8 * src, gsize size, guint swidth,
+    guint sheight);
+
+/**
+ * gst_alpha_mask_decode_rle:
+ * @dst: first alpha sample of the destination
+ * @dstride: destination stride in bytes
+ * @dstep: distance in bytes between two alpha samples
+ * @dbits: bits per destination sample
+ * @src: the run-length encoded mask
+ * @size: size of @src in bytes
+ * @premultiply: run on every line of packed pixels once its alpha is
+ *   written, or %NULL
+ * @offset: offset of the alpha byte in a packed pixel, for @premultiply
+ *
+ * Decodes a @swidth x @sheight run-length encoded mask, scaled to
+ * @dwidth x @dheight with nearest neighbour sampling. Every line is a
+ * sequence of runs adding up to @swidth pixels, a run is its length as an
+ * unsigned LEB128 number followed by its alpha byte, which is brought to
+ * @dbits like gst_alpha_mask_convert_alpha() does. Runs don't continue on
+ * the next line.
+ *
+ * Returns: %FALSE when @src is truncated or malformed, the destination is
+ * then only partially written.
+ */
+gboolean gst_alpha_mask_decode_rle (guint8 * dst, guint dstride, guint dstep,
+    guint dbits, guint dwidth, guint dheight, const guint8 * src, gsize size,
+    guint swidth, guint sheight, GstAlphaMaskPremultiplyFunc premultiply,
+    guint offset);
+
+/**
+ * gst_alpha_mask_copy_plane:
+ * @dst: first byte of the destination
+ * @dstride: destination stride in bytes
+ * @src: first byte of the source
+ * @sstride: source stride in bytes
+ *
+ * Copies @width x @height bytes of an 8 bit alpha plane, in one go when the
+ * strides match. Nothing past the last byte of the last line is read.
+ */
+void gst_alpha_mask_copy_plane (guint8 * dst, guint dstride,
+    const guint8 * src, guint sstride, guint width, guint height);
+
+/**
+ * gst_alpha_mask_fill_alpha:
+ * @dst: first byte of the destination
+ * @dstride: destination stride in bytes
+ * @dstep: 1 for an alpha plane, 4 for packed 32 bit pixels
+ * @offset: offset of the alpha byte in a packed pixel
+ * @value: the alpha to write
+ *
+ * Sets the alpha of @width x @lines pixels to @value, leaving the color
+ * bytes of packed pixels alone.
+ */
+void gst_alpha_mask_fill_alpha (guint8 * dst, guint dstride, guint dstep,
+    guint offset, guint width, guint lines, guint8 value);
+
+/**
+ * gst_alpha_mask_fill_alpha16:
+ * @dst: first byte of the destination
+ * @dstride: destination stride in bytes
+ * @dstep: distance in bytes between two alpha samples
+ * @offset: offset of the alpha sample in a pixel
+ * @value: the alpha to write
+ *
+ * Like gst_alpha_mask_fill_alpha() for little endian 16 bit alpha samples.
+ */
+void gst_alpha_mask_fill_alpha16 (guint8 * dst, guint dstride, guint dstep,
+    guint offset, guint width, guint lines, guint16 value);
+
+/* what a block of the mask does to the video */
+typedef enum
+{
+  GST_ALPHA_MASK_BLOCK_MIXED,
+  GST_ALPHA_MASK_BLOCK_TRANSPARENT,
+  GST_ALPHA_MASK_BLOCK_OPAQUE,
+} GstAlphaMaskBlockClass;
+
+/**
+ * gst_alpha_mask_classify_block:
+ * @src: first pixel of the block
+ * @stride: stride of the mask in bytes
+ *
+ * Tells whether a @width x @height block of the mask is all 0x00, all 0xff
+ * or anything else. Stops at the first byte that makes it mixed.
+ */
+GstAlphaMaskBlockClass gst_alpha_mask_classify_block (const guint8 * src,
+    guint stride, guint width, guint height);
+
+guint64 gst_alpha_mask_hash_plane (const guint8 * src, guint stride,
+    guint width, guint height);
+
+G_END_DECLS
+
+#endif /* __ALPHA_KERNELS_H__ */
@@ -21,8 +21,10 @@
  * SECTION:element-alphamask
  *
  * The alphamask element combines a video and an alpha stream to produce
- * transparent videos in A420, ARGB or AYUV formats. The alpha channel is
- * made by reinterpreting a GRAY8 auxiliary video stream as an alpha mask.
+ * transparent videos in A420, AV12, ARGB, BGRA, RGBA, ABGR or AYUV formats.
+ * The alpha channel is made by reinterpreting a GRAY8 auxiliary video
+ * stream as an alpha mask. Other mask formats are read from the component
+ * picked by the mask-channel property.
  *
  * Sample pipeline:
  * |[
@@ -39,6 +41,10 @@
 #endif
 
 #include "gstalphamask.h"
+#include "gstmultialphamask.h"
+#ifdef HAVE_GST_GL
+#include "gstglalphamask.h"
+#endif
 #include <string.h>             /* for memcpy */
 
 #if !GST_CHECK_VERSION (1,8,0)
@@ -54,366 +60,2934 @@ gst_element_class_add_static_pad_template (GstElementClass * klass,
 GST_DEBUG_CATEGORY (alphamask_debug);
 #define GST_CAT_DEFAULT alphamask_debug
 
+#define DEFAULT_PROP_DITHER            GST_VIDEO_DITHER_BAYER
+#define DEFAULT_PROP_CHROMA_RESAMPLER  GST_VIDEO_RESAMPLER_METHOD_LINEAR
+#define DEFAULT_PROP_MATRIX_MODE       GST_VIDEO_MATRIX_MODE_FULL
+#define DEFAULT_PROP_N_THREADS         1
+#define DEFAULT_PROP_CACHE_ALPHA       FALSE
+#define DEFAULT_PROP_ALPHA_QUEUE_SIZE  1
+#define DEFAULT_PROP_QOS               FALSE
+#define DEFAULT_PROP_STATS_INTERVAL    0
+#define DEFAULT_PROP_PREFERRED_FORMAT  GST_VIDEO_FORMAT_UNKNOWN
+#define DEFAULT_PROP_ALPHA_SCALING     GST_ALPHA_MASK_SCALING_BILINEAR
+#define DEFAULT_PROP_ANALYZE_ALPHA     FALSE
+#define DEFAULT_PROP_SKIP_TRANSPARENT  FALSE
+#define DEFAULT_PROP_PACKED_LAYOUT     GST_ALPHA_MASK_PACKED_NONE
+#define DEFAULT_PROP_LATENCY           0
+#define DEFAULT_PROP_ALPHA_MODE        GST_ALPHA_MASK_MODE_STRICT
+#define DEFAULT_PROP_ALPHA_VALUE       255
+#define DEFAULT_PROP_PREMULTIPLY       FALSE
+#define DEFAULT_PROP_STAGE_META        FALSE
+#define DEFAULT_PROP_MASK_CHANNEL      GST_ALPHA_MASK_CHANNEL_AUTO
+
 enum
 {
   PROP_0,
+  PROP_DITHER,
+  PROP_CHROMA_RESAMPLER,
+  PROP_MATRIX_MODE,
+  PROP_N_THREADS,
+  PROP_CACHE_ALPHA,
+  PROP_ALPHA_QUEUE_SIZE,
+  PROP_QOS,
+  PROP_STATS,
+  PROP_STATS_INTERVAL,
+  PROP_PREFERRED_FORMAT,
+  PROP_ALPHA_SCALING,
+  PROP_ANALYZE_ALPHA,
+  PROP_SKIP_TRANSPARENT,
+  PROP_PACKED_LAYOUT,
+  PROP_LATENCY,
+  PROP_ALPHA_MODE,
+  PROP_ALPHA_VALUE,
+  PROP_PREMULTIPLY,
+  PROP_STAGE_META,
+  PROP_MASK_CHANNEL,
   PROP_LAST
 };
 
 #define FORMATS " { AYUV, A420, I420, YV12, NV12, NV21, BGRA, ARGB, RGBA, "\
                 "   ABGR, Y444, Y42B, YUY2, UYVY, YVYU, Y41B, RGB, BGR, "\
-                "   xRGB, xBGR, RGBx, BGRx } "
+                "   xRGB, xBGR, RGBx, BGRx, AYUV64, A420_10LE, A444_10LE, "\
+                "   I420_10LE, I422_10LE, Y444_10LE, P010_10LE } "
+
+#ifndef GST_CAPS_FEATURE_MEMORY_DMABUF
+#define GST_CAPS_FEATURE_MEMORY_DMABUF "memory:DMABuf"
+#endif
+
+/* DMABuf input is mapped like system memory unless its planes can be passed
+ * on untouched, which only the A420 and AV12 outputs allow */
+#define DMABUF_FORMATS "{ I420, YV12, NV12 }"
 
 static GstStaticPadTemplate vsink_factory =
 GST_STATIC_PAD_TEMPLATE ("video_sink",
     GST_PAD_SINK,
     GST_PAD_ALWAYS,
-    GST_STATIC_CAPS (GST_VIDEO_CAPS_MAKE (FORMATS))
+    GST_STATIC_CAPS (GST_VIDEO_CAPS_MAKE (FORMATS) ";"
+        GST_VIDEO_CAPS_MAKE_WITH_FEATURES (GST_CAPS_FEATURE_MEMORY_DMABUF,
+            DMABUF_FORMATS))
     );
 
+/* masks that are cheap to send around, see alphakernels.h for the layout */
+#define COMPACT_MASK_CAPS "video/x-alpha-mask, " \
+    "encoding = (string) { rle, bitmap }, " \
+    "width = " GST_VIDEO_SIZE_RANGE ", " \
+    "height = " GST_VIDEO_SIZE_RANGE ", " \
+    "framerate = " GST_VIDEO_FPS_RANGE
+
 static GstStaticPadTemplate asink_factory =
 GST_STATIC_PAD_TEMPLATE ("alpha_sink",
     GST_PAD_SINK,
     GST_PAD_ALWAYS,
-    GST_STATIC_CAPS (GST_VIDEO_CAPS_MAKE ("{ GRAY8, I420, NV12, NV21 }"))
+    GST_STATIC_CAPS (GST_VIDEO_CAPS_MAKE ("{ GRAY8, GRAY16_LE, I420, "
+            "I420_10LE, NV12, NV21, YUY2, UYVY, AYUV, ARGB, BGRA, RGBA, "
+            "ABGR }") ";"
+        GST_VIDEO_CAPS_MAKE_WITH_FEATURES (GST_CAPS_FEATURE_MEMORY_DMABUF,
+            "{ GRAY8, I420, NV12 }") ";" COMPACT_MASK_CAPS)
     );
 
+#if GST_CHECK_VERSION (1,20,0)
+#define SRC_FORMATS "{ A420, AV12, ARGB, AYUV, BGRA, RGBA, ABGR, " \
+    "A420_10LE, A444_10LE, AYUV64 }"
+#define SRC_DMABUF_FORMATS "{ A420, AV12 }"
+#else
+#define SRC_FORMATS "{ A420, ARGB, AYUV, BGRA, RGBA, ABGR, " \
+    "A420_10LE, A444_10LE, AYUV64 }"
+#define SRC_DMABUF_FORMATS "A420"
+#endif
+
 static GstStaticPadTemplate src_factory =
 GST_STATIC_PAD_TEMPLATE ("src",
     GST_PAD_SRC,
     GST_PAD_ALWAYS,
-    GST_STATIC_CAPS (GST_VIDEO_CAPS_MAKE ("{ A420, ARGB, AYUV }"))
+    GST_STATIC_CAPS (GST_VIDEO_CAPS_MAKE (SRC_FORMATS) ";"
+        GST_VIDEO_CAPS_MAKE_WITH_FEATURES (GST_CAPS_FEATURE_MEMORY_DMABUF,
+            SRC_DMABUF_FORMATS))
     );
 
 #define DEFAULT_FORMAT GST_VIDEO_FORMAT_A420
 
-#define gst_alpha_mask_parent_class parent_class
-G_DEFINE_TYPE (GstAlphaMask, gst_alpha_mask, GST_TYPE_ELEMENT);
+#define GST_TYPE_ALPHA_MASK_SCALING (gst_alpha_mask_scaling_get_type ())
+static GType
+gst_alpha_mask_scaling_get_type (void)
+{
+  static gsize scaling_type = 0;
+  static const GEnumValue scaling[] = {
+    {GST_ALPHA_MASK_SCALING_NEAREST, "Nearest neighbour", "nearest"},
+    {GST_ALPHA_MASK_SCALING_BILINEAR, "Bilinear", "bilinear"},
+    {0, NULL, NULL},
+  };
+
+  if (g_once_init_enter (&scaling_type)) {
+    GType tmp = g_enum_register_static ("GstAlphaMaskScaling", scaling);
+    g_once_init_leave (&scaling_type, tmp);
+  }
+
+  return (GType) scaling_type;
+}
+
+#define GST_TYPE_ALPHA_MASK_MODE (gst_alpha_mask_mode_get_type ())
+static GType
+gst_alpha_mask_mode_get_type (void)
+{
+  static gsize mode_type = 0;
+  static const GEnumValue mode[] = {
+    {GST_ALPHA_MASK_MODE_STRICT, "Wait for the mask of every frame", "strict"},
+    {GST_ALPHA_MASK_MODE_HOLD_LAST, "Hold the previous mask", "hold-last"},
+    {GST_ALPHA_MASK_MODE_CONSTANT, "Constant alpha without masks",
+        "constant"},
+    {0, NULL, NULL},
+  };
+
+  if (g_once_init_enter (&mode_type)) {
+    GType tmp = g_enum_register_static ("GstAlphaMaskMode", mode);
+    g_once_init_leave (&mode_type, tmp);
+  }
+
+  return (GType) mode_type;
+}
+
+#define GST_TYPE_ALPHA_MASK_CHANNEL (gst_alpha_mask_channel_get_type ())
+static GType
+gst_alpha_mask_channel_get_type (void)
+{
+  static gsize channel_type = 0;
+  static const GEnumValue channel[] = {
+    {GST_ALPHA_MASK_CHANNEL_AUTO, "Alpha if the mask has one, else the first "
+          "component", "auto"},
+    {GST_ALPHA_MASK_CHANNEL_LUMA, "Luma", "luma"},
+    {GST_ALPHA_MASK_CHANNEL_ALPHA, "Alpha", "alpha"},
+    {GST_ALPHA_MASK_CHANNEL_RED, "Red", "red"},
+    {GST_ALPHA_MASK_CHANNEL_GREEN, "Green", "green"},
+    {GST_ALPHA_MASK_CHANNEL_BLUE, "Blue", "blue"},
+    {0, NULL, NULL},
+  };
+
+  if (g_once_init_enter (&channel_type)) {
+    GType tmp = g_enum_register_static ("GstAlphaMaskChannel", channel);
+    g_once_init_leave (&channel_type, tmp);
+  }
+
+  return (GType) channel_type;
+}
+
+#define GST_TYPE_ALPHA_MASK_PACKED_LAYOUT (gst_alpha_mask_packed_layout_get_type ())
+static GType
+gst_alpha_mask_packed_layout_get_type (void)
+{
+  static gsize layout_type = 0;
+  static const GEnumValue layout[] = {
+    {GST_ALPHA_MASK_PACKED_NONE, "Mask from the alpha pad", "none"},
+    {GST_ALPHA_MASK_PACKED_SIDE_BY_SIDE, "Mask right of the color",
+        "side-by-side"},
+    {GST_ALPHA_MASK_PACKED_TOP_BOTTOM, "Mask below the color", "top-bottom"},
+    {0, NULL, NULL},
+  };
+
+  if (g_once_init_enter (&layout_type)) {
+    GType tmp = g_enum_register_static ("GstAlphaMaskPackedLayout", layout);
+    g_once_init_leave (&layout_type, tmp);
+  }
+
+  return (GType) layout_type;
+}
+
+/* A420, AV12 and the 10 bit A420 and A444 carry the alpha in a plane of its
+ * own */
+#define HAS_ALPHA_PLANE(info) (GST_VIDEO_INFO_N_PLANES (info) > 1)
+#define ALPHA_PLANE(info) \
+    GST_VIDEO_FORMAT_INFO_PLANE ((info)->finfo, GST_VIDEO_COMP_A)
+/* bits per alpha sample and distance in bytes between two of them */
+#define ALPHA_DEPTH(info) \
+    GST_VIDEO_FORMAT_INFO_DEPTH ((info)->finfo, GST_VIDEO_COMP_A)
+#define ALPHA_STEP(info) \
+    GST_VIDEO_FORMAT_INFO_PSTRIDE ((info)->finfo, GST_VIDEO_COMP_A)
+
+static GstElementClass *parent_class = NULL;
+
+/* what the stage timestamps of a frame refer to */
+enum
+{
+  STAGE_VIDEO_IN,
+  STAGE_ALPHA_IN,
+  STAGE_DONE,
+  STAGE_LAST
+};
+
+#if GST_CHECK_VERSION (1,14,0)
+static GstCaps *stage_caps[STAGE_LAST];
+#endif
+#if GST_CHECK_VERSION (1,8,0)
+static GstTracerRecord *stage_record;
+#endif
+
+static void gst_alpha_mask_class_init (GstAlphaMaskClass * klass);
+static void gst_alpha_mask_init (GstAlphaMask * thiz,
+    GstAlphaMaskClass * klass);
+
+/* registered by hand, the instance init needs the class of the subclass
+ * being instantiated to create the pads from its templates */
+GType
+gst_alpha_mask_get_type (void)
+{
+  static gsize alpha_mask_type = 0;
+
+  if (g_once_init_enter (&alpha_mask_type)) {
+    GType _type;
+    static const GTypeInfo alpha_mask_info = {
+      sizeof (GstAlphaMaskClass),
+      NULL,
+      NULL,
+      (GClassInitFunc) gst_alpha_mask_class_init,
+      NULL,
+      NULL,
+      sizeof (GstAlphaMask),
+      0,
+      (GInstanceInitFunc) gst_alpha_mask_init,
+    };
+
+    _type = g_type_register_static (GST_TYPE_ELEMENT, "GstAlphaMask",
+        &alpha_mask_info, 0);
+    g_once_init_leave (&alpha_mask_type, _type);
+  }
+  return alpha_mask_type;
+}
 
 #define GST_ALPHA_MASK_GET_LOCK(o) (&GST_ALPHA_MASK (o)->lock)
 #define GST_ALPHA_MASK_GET_COND(o) (&GST_ALPHA_MASK (o)->cond)
 #define GST_ALPHA_MASK_LOCK(o)     (g_mutex_lock (GST_ALPHA_MASK_GET_LOCK (o)))
 #define GST_ALPHA_MASK_UNLOCK(o)   (g_mutex_unlock (GST_ALPHA_MASK_GET_LOCK (o)))
 #define GST_ALPHA_MASK_WAIT(o)     (g_cond_wait (GST_ALPHA_MASK_GET_COND (o), GST_ALPHA_MASK_GET_LOCK (o)))
+#define GST_ALPHA_MASK_WAIT_UNTIL(o, t) (g_cond_wait_until (GST_ALPHA_MASK_GET_COND (o), GST_ALPHA_MASK_GET_LOCK (o), (t)))
 #define GST_ALPHA_MASK_SIGNAL(o)   (g_cond_signal (GST_ALPHA_MASK_GET_COND (o)))
 #define GST_ALPHA_MASK_BROADCAST(o)(g_cond_broadcast (GST_ALPHA_MASK_GET_COND (o)))
 
+/* Pool for the color planes of A420 or AV12 frames that get the cached alpha
+ * plane appended by reference. The appended memory is dropped again when a buffer
+ * comes back so its color memory can be recycled. */
+typedef GstVideoBufferPool GstAlphaMaskColorPool;
+typedef GstVideoBufferPoolClass GstAlphaMaskColorPoolClass;
+
+static GType gst_alpha_mask_color_pool_get_type (void);
+G_DEFINE_TYPE (GstAlphaMaskColorPool, gst_alpha_mask_color_pool,
+    GST_TYPE_VIDEO_BUFFER_POOL);
+
+static void
+gst_alpha_mask_color_pool_reset_buffer (GstBufferPool * pool,
+    GstBuffer * buffer)
+{
+  if (gst_buffer_n_memory (buffer) > 1)
+    gst_buffer_remove_memory_range (buffer, 1, -1);
+
+  GST_BUFFER_POOL_CLASS (gst_alpha_mask_color_pool_parent_class)->reset_buffer
+      (pool, buffer);
+
+  /* what is left is the memory the pool allocated */
+  GST_BUFFER_FLAG_UNSET (buffer, GST_BUFFER_FLAG_TAG_MEMORY);
+}
+
+static void
+gst_alpha_mask_color_pool_class_init (GstAlphaMaskColorPoolClass * klass)
+{
+  GstBufferPoolClass *pool_class = (GstBufferPoolClass *) klass;
+
+  pool_class->reset_buffer = gst_alpha_mask_color_pool_reset_buffer;
+}
+
 static void
-copy_alpha_packed_u1 (guint8 * dst, guint dstride, guint8 * src, guint sstride,
-    guint width, guint height)
+gst_alpha_mask_color_pool_init (GstAlphaMaskColorPool * pool)
 {
-  guint i, j;
+}
 
-  for (i = 0; i < height; i++) {
-    for (j = 0; j < width; j++)
-      dst[j * 4] = src[j];
+/* picked at plugin init from the SIMD extensions the CPU supports */
+static GstAlphaMaskCopyAlphaFunc copy_alpha_packed_func;
+static GstAlphaMaskCopyAlphaFunc copy_alpha_premultiply_func;
+static GstAlphaMaskPremultiplyFunc premultiply_func;
 
-    dst += dstride;
-    src += sstride;
+/* frames are only split when every slice gets at least this many lines */
+#define MIN_SLICE_LINES 64
+
+typedef void (*GstAlphaMaskSliceFunc) (gpointer data, guint line,
+    guint lines);
+
+/* One frame split into slices. The calling thread and the workers of the
+ * shared pool keep taking the next slice until none is left, so slices
+ * stuck behind the work of other instances get done by the caller. */
+typedef struct
+{
+  gint refcount;
+  GstAlphaMaskSliceFunc func;
+  gpointer data;
+  guint height;
+  gint n_slices;
+  gint next;                    /* next slice to take */
+  gint done;                    /* slices finished */
+  GMutex lock;
+  GCond cond;
+} GstAlphaMaskSliceJob;
+
+/* shared by all instances and sized to the machine, made on first use */
+static GThreadPool *slice_pool;
+
+static void
+gst_alpha_mask_slice_job_unref (GstAlphaMaskSliceJob * job)
+{
+  if (g_atomic_int_dec_and_test (&job->refcount)) {
+    g_mutex_clear (&job->lock);
+    g_cond_clear (&job->cond);
+    g_free (job);
   }
 }
 
 static void
-copy_alpha_packed_u4 (guint8 * dst, guint dstride, guint8 * src, guint sstride,
-    guint width, guint height)
-{
-  guint i, j;
-  guint w = width >> 2;
-
-  for (i = 0; i < height; i++) {
-    guint32 *sd = (guint32 *) src;
-    guint8 *dd = dst;
-    for (j = 0; j < w; j++) {
-      guint32 c = sd[j];
-      dd[0] = c & 0xff;
-      c >>= 8;
-      dd[4] = c & 0xff;
-      c >>= 8;
-      dd[8] = c & 0xff;
-      c >>= 8;
-      dd[12] = c & 0xff;
-      dd += 16;
-    }
+gst_alpha_mask_slice_job_run (GstAlphaMaskSliceJob * job)
+{
+  gint i;
 
-    dst += dstride;
-    src += sstride;
+  while ((i = g_atomic_int_add (&job->next, 1)) < job->n_slices) {
+    guint line = job->height * i / job->n_slices;
+    guint end = job->height * (i + 1) / job->n_slices;
+
+    job->func (job->data, line, end - line);
+
+    if (g_atomic_int_add (&job->done, 1) == job->n_slices - 1) {
+      g_mutex_lock (&job->lock);
+      g_cond_signal (&job->cond);
+      g_mutex_unlock (&job->lock);
+    }
   }
 }
 
 static void
-copy_alpha_packed_u8 (guint8 * dst, guint dstride, guint8 * src, guint sstride,
-    guint width, guint height)
-{
-  guint i, j;
-  guint w = width >> 3;
-
-  for (i = 0; i < height; i++) {
-    guint64 *sd = (guint64 *) src;
-    guint8 *dd = dst;
-    for (j = 0; j < w; j++) {
-      guint64 c = sd[j];
-      dd[0] = c & 0xff;
-      c >>= 8;
-      dd[4] = c & 0xff;
-      c >>= 8;
-      dd[8] = c & 0xff;
-      c >>= 8;
-      dd[12] = c & 0xff;
-      c >>= 8;
-      dd[16] = c & 0xff;
-      c >>= 8;
-      dd[20] = c & 0xff;
-      c >>= 8;
-      dd[24] = c & 0xff;
-      c >>= 8;
-      dd[28] = c & 0xff;
-      dd += 32;
+gst_alpha_mask_slice_worker (gpointer data, gpointer user_data)
+{
+  GstAlphaMaskSliceJob *job = data;
+
+  gst_alpha_mask_slice_job_run (job);
+  gst_alpha_mask_slice_job_unref (job);
+}
+
+static GThreadPool *
+gst_alpha_mask_get_slice_pool (void)
+{
+  static gsize init = 0;
+
+  if (g_once_init_enter (&init)) {
+    GError *err = NULL;
+
+    /* exclusive threads are started once and stay around */
+    slice_pool = g_thread_pool_new (gst_alpha_mask_slice_worker, NULL,
+        g_get_num_processors (), TRUE, &err);
+    if (!slice_pool) {
+      GST_WARNING ("could not start the slice workers: %s",
+          err ? err->message : "unknown error");
+      g_clear_error (&err);
     }
+    g_once_init_leave (&init, 1);
+  }
+
+  return slice_pool;
+}
+
+#if GST_CHECK_VERSION (1,20,0)
+/* Converter threads of all instances, sized to the machine as well */
+static GstTaskPool *
+gst_alpha_mask_get_convert_pool (void)
+{
+  static GstTaskPool *pool = NULL;
+
+  if (g_once_init_enter (&pool)) {
+    GstTaskPool *shared = gst_shared_task_pool_new ();
 
-    dst += dstride;
-    src += sstride;
+    gst_shared_task_pool_set_max_threads (GST_SHARED_TASK_POOL (shared),
+        g_get_num_processors ());
+    gst_task_pool_prepare (shared, NULL);
+    GST_OBJECT_FLAG_SET (shared, GST_OBJECT_FLAG_MAY_BE_LEAKED);
+    g_once_init_leave (&pool, shared);
   }
+
+  return pool;
 }
+#endif
 
+/* Runs @func over @height lines, split into horizontal slices shared by the
+ * pool and the calling thread. Returns once all slices are done. */
 static void
-copy_alpha_packed (GstVideoFrame * aframe, GstVideoFrame * oframe)
+gst_alpha_mask_run_slices (GstAlphaMask * thiz, GstAlphaMaskSliceFunc func,
+    gpointer data, guint height)
 {
-  const GstVideoInfo *ainfo;
-  const GstVideoInfo *oinfo;
-  guint8 *sp, *dp;
-  guint w, h;
-  guint ss, ds;
+  GstAlphaMaskSliceJob *job;
+  GThreadPool *pool = NULL;
+  guint n, i;
+
+  n = MIN (thiz->n_slices, height / MIN_SLICE_LINES);
+  if (n > 1)
+    pool = gst_alpha_mask_get_slice_pool ();
+  if (!pool) {
+    func (data, 0, height);
+    return;
+  }
+
+  job = g_new (GstAlphaMaskSliceJob, 1);
+  job->refcount = n;
+  job->func = func;
+  job->data = data;
+  job->height = height;
+  job->n_slices = n;
+  job->next = 0;
+  job->done = 0;
+  g_mutex_init (&job->lock);
+  g_cond_init (&job->cond);
+
+  /* workers that come too late find nothing left and only drop their ref */
+  for (i = 1; i < n; i++)
+    g_thread_pool_push (pool, job, NULL);
+
+  gst_alpha_mask_slice_job_run (job);
+
+  g_mutex_lock (&job->lock);
+  while (g_atomic_int_get (&job->done) < job->n_slices)
+    g_cond_wait (&job->cond, &job->lock);
+  g_mutex_unlock (&job->lock);
+
+  gst_alpha_mask_slice_job_unref (job);
+}
 
-  ainfo = &aframe->info;
-  oinfo = &oframe->info;
+/* Maps the current alpha buffer for reading the mask, compact masks only
+ * get their bytes mapped into the first plane */
+static gboolean
+gst_alpha_mask_map_alpha (GstAlphaMask * thiz, GstVideoFrame * aframe)
+{
+  if (thiz->alpha_encoding == GST_ALPHA_MASK_ENCODING_RAW)
+    return gst_video_frame_map (aframe, &thiz->ainfo, thiz->alpha_buffer,
+        GST_MAP_READ);
 
-  sp = aframe->data[0];
-  dp = oframe->data[0];
+  memset (aframe, 0, sizeof (GstVideoFrame));
+  if (!gst_buffer_map (thiz->alpha_buffer, &aframe->map[0], GST_MAP_READ))
+    return FALSE;
 
-  w = GST_VIDEO_FRAME_COMP_WIDTH (aframe, 0);
-  h = GST_VIDEO_FRAME_COMP_HEIGHT (aframe, 0);
+  aframe->info = thiz->ainfo;
+  aframe->buffer = thiz->alpha_buffer;
+  aframe->data[0] = aframe->map[0].data;
 
-  ss = GST_VIDEO_INFO_PLANE_STRIDE (ainfo, 0);
-  ds = GST_VIDEO_INFO_PLANE_STRIDE (oinfo, 0);
+  return TRUE;
+}
 
-  if (w & 3)
-    copy_alpha_packed_u1 (dp, ds, sp, ss, w, h);
-  else if (w & 7)
-    copy_alpha_packed_u4 (dp, ds, sp, ss, w, h);
+static void
+gst_alpha_mask_unmap_alpha (GstAlphaMask * thiz, GstVideoFrame * aframe)
+{
+  if (thiz->alpha_encoding == GST_ALPHA_MASK_ENCODING_RAW)
+    gst_video_frame_unmap (aframe);
   else
-    copy_alpha_packed_u8 (dp, ds, sp, ss, w, h);
+    gst_buffer_unmap (aframe->buffer, &aframe->map[0]);
 }
 
+/* Region of the mask to use for @abuf, from its crop meta if any. Compact
+ * masks are always used whole. */
 static void
-copy_alpha_planar (GstVideoFrame * aframe, GstVideoFrame * oframe, guint plane)
+gst_alpha_mask_get_alpha_rect (GstAlphaMask * thiz, GstBuffer * abuf,
+    GstVideoRectangle * rect)
+{
+  GstVideoCropMeta *crop = gst_buffer_get_video_crop_meta (abuf);
+  gint width = GST_VIDEO_INFO_WIDTH (&thiz->ainfo);
+  gint height = GST_VIDEO_INFO_HEIGHT (&thiz->ainfo);
+
+  rect->x = 0;
+  rect->y = 0;
+  rect->w = width;
+  rect->h = height;
+
+  if (thiz->alpha_encoding != GST_ALPHA_MASK_ENCODING_RAW)
+    return;
+
+  if (crop && crop->width > 0 && crop->height > 0) {
+    rect->x = MIN ((gint) crop->x, width - 1);
+    rect->y = MIN ((gint) crop->y, height - 1);
+    rect->w = MIN ((gint) crop->width, width - rect->x);
+    rect->h = MIN ((gint) crop->height, height - rect->y);
+  }
+}
+
+/* Whether the alpha caps are known, the mask helpers below can run from
+ * the video thread before they arrive */
+static gboolean
+gst_alpha_mask_has_alpha_info (GstAlphaMask * thiz)
+{
+  return thiz->ainfo.finfo != NULL &&
+      GST_VIDEO_INFO_FORMAT (&thiz->ainfo) != GST_VIDEO_FORMAT_UNKNOWN;
+}
+
+/* Component of the raw mask the alpha is read from, see
+ * GstAlphaMaskChannel */
+guint
+gst_alpha_mask_mask_comp (GstAlphaMask * thiz)
+{
+  const GstVideoFormatInfo *finfo = thiz->ainfo.finfo;
+  gboolean rgb, alpha;
+
+  /* packed masks are the luma of their half */
+  if (thiz->alpha_encoding != GST_ALPHA_MASK_ENCODING_RAW || thiz->packed ||
+      !gst_alpha_mask_has_alpha_info (thiz))
+    return 0;
+
+  rgb = GST_VIDEO_FORMAT_INFO_IS_RGB (finfo);
+  alpha = GST_VIDEO_FORMAT_INFO_HAS_ALPHA (finfo);
+
+  switch (g_atomic_int_get (&thiz->mask_channel)) {
+    case GST_ALPHA_MASK_CHANNEL_AUTO:
+      return alpha ? GST_VIDEO_COMP_A : 0;
+    case GST_ALPHA_MASK_CHANNEL_LUMA:
+      return rgb ? 0 : GST_VIDEO_COMP_Y;
+    case GST_ALPHA_MASK_CHANNEL_ALPHA:
+      return alpha ? GST_VIDEO_COMP_A : 0;
+    case GST_ALPHA_MASK_CHANNEL_RED:
+      return rgb ? GST_VIDEO_COMP_R : 0;
+    case GST_ALPHA_MASK_CHANNEL_GREEN:
+      return rgb ? GST_VIDEO_COMP_G : 0;
+    case GST_ALPHA_MASK_CHANNEL_BLUE:
+      return rgb ? GST_VIDEO_COMP_B : 0;
+    default:
+      return 0;
+  }
+}
+
+/* Bits per sample of the mask, compact masks decode into bytes */
+static guint
+gst_alpha_mask_mask_depth (GstAlphaMask * thiz)
 {
-  const GstVideoInfo *ainfo;
-  const GstVideoInfo *oinfo;
-  guint8 *sp, *dp;
-  guint w, h;
-  guint ss, ds;
+  if (thiz->alpha_encoding != GST_ALPHA_MASK_ENCODING_RAW)
+    return 8;
+  return GST_VIDEO_INFO_COMP_DEPTH (&thiz->ainfo,
+      gst_alpha_mask_mask_comp (thiz));
+}
 
-  ainfo = &aframe->info;
-  oinfo = &oframe->info;
+/* Whether the raw mask is a plane of bytes of its own, which the analysis
+ * and the fused kernels need */
+static gboolean
+gst_alpha_mask_mask_is_plane (GstAlphaMask * thiz)
+{
+  guint comp = gst_alpha_mask_mask_comp (thiz);
 
-  sp = aframe->data[0];
-  dp = oframe->data[plane];
+  return thiz->alpha_encoding == GST_ALPHA_MASK_ENCODING_RAW &&
+      gst_alpha_mask_has_alpha_info (thiz) &&
+      GST_VIDEO_INFO_COMP_DEPTH (&thiz->ainfo, comp) == 8 &&
+      GST_VIDEO_INFO_COMP_PSTRIDE (&thiz->ainfo, comp) == 1;
+}
 
-  w = GST_VIDEO_FRAME_COMP_WIDTH (aframe, 0);
-  h = GST_VIDEO_FRAME_COMP_HEIGHT (aframe, 0);
+/* Whether the raw mask can be handed on as the alpha plane of @format: a
+ * plane of its own with the depth and sample size of the output alpha */
+static gboolean
+gst_alpha_mask_mask_is_alpha_plane (GstAlphaMask * thiz,
+    GstVideoFormat format)
+{
+  const GstVideoFormatInfo *ofinfo = gst_video_format_get_info (format);
+  guint comp = gst_alpha_mask_mask_comp (thiz);
+
+  return thiz->alpha_encoding == GST_ALPHA_MASK_ENCODING_RAW &&
+      gst_alpha_mask_has_alpha_info (thiz) &&
+      GST_VIDEO_INFO_COMP_POFFSET (&thiz->ainfo, comp) == 0 &&
+      GST_VIDEO_INFO_COMP_PSTRIDE (&thiz->ainfo, comp) ==
+      GST_VIDEO_FORMAT_INFO_PSTRIDE (ofinfo, GST_VIDEO_COMP_A) &&
+      GST_VIDEO_INFO_COMP_DEPTH (&thiz->ainfo, comp) ==
+      GST_VIDEO_FORMAT_INFO_DEPTH (ofinfo, GST_VIDEO_COMP_A);
+}
 
-  ss = GST_VIDEO_INFO_PLANE_STRIDE (ainfo, 0);
-  ds = GST_VIDEO_INFO_PLANE_STRIDE (oinfo, plane);
+typedef struct
+{
+  const guint8 *src;
+  gsize size;                   /* compact masks */
+  guint sstride;
+  guint swidth;
+  guint sheight;
+  guint sstep;
+  guint sbits;
+  guint8 *dst;
+  guint dstride;
+  guint offset;
+  guint step;
+  guint dbits;
+  guint width;
+  guint height;
+  gboolean bilinear;
+  gboolean premultiply;         /* packed output, colors times the alpha */
+  gint value;                   /* alpha set before premultiplying, or -1 */
+} GstAlphaMaskWriteJob;
 
-  if (ss == ds) {
-    memcpy (dp, sp, h * ss);
+static void
+write_alpha_lines (GstAlphaMaskWriteJob * job, guint line, guint lines)
+{
+  /* deep or interleaved samples take the generic path, nearest neighbour
+   * only */
+  if (job->sbits != 8 || job->dbits != 8 || job->sstep != 1) {
+    gst_alpha_mask_convert_alpha (job->dst + job->offset, job->dstride,
+        job->step, job->dbits, job->width, job->height, line, lines,
+        job->src, job->sstride, job->sstep, job->sbits, job->swidth,
+        job->sheight);
+  } else if (job->swidth == job->width && job->sheight == job->height) {
+    guint8 *dp = job->dst + line * job->dstride;
+    const guint8 *sp = job->src + line * job->sstride;
+
+    if (job->step == 1)
+      gst_alpha_mask_copy_plane (dp + job->offset, job->dstride, sp,
+          job->sstride, job->width, lines);
+    else
+      copy_alpha_packed_func (dp, job->dstride, job->offset, sp,
+          job->sstride, job->width, lines);
   } else {
-    guint j;
-    for (j = 0; j < h; j++) {
-      memcpy (dp, sp, w);
-      dp += ds;
-      sp += ss;
-    }
+    gst_alpha_mask_scale_alpha (job->dst + job->offset, job->dstride,
+        job->step, job->width, job->height, line, lines, job->src,
+        job->sstride, job->swidth, job->sheight, job->bilinear);
   }
 }
 
-static GstBuffer *
-gst_alpha_mask_convert (GstAlphaMask * thiz, GstBuffer * ibuf)
+static void
+write_alpha_slice (gpointer data, guint line, guint lines)
 {
-  GstVideoFrame aframe, iframe, oframe;
-  GstBuffer *obuf;
-  static GstAllocationParams params = { 0, 15, 0, 0, };
-  gint size = GST_VIDEO_INFO_SIZE (&thiz->oinfo);
+  GstAlphaMaskWriteJob *job = data;
+  guint8 *dp;
+  guint i;
 
-  obuf = gst_buffer_new_allocate (NULL, size, &params);
-  gst_buffer_copy_into (obuf, ibuf, GST_BUFFER_COPY_FLAGS |
-      GST_BUFFER_COPY_TIMESTAMPS, 0, -1);
+  if (!job->premultiply) {
+    write_alpha_lines (job, line, lines);
+    return;
+  }
 
-  /* Convert the frame into output format */
-  if (!gst_video_frame_map (&iframe, &thiz->iinfo, ibuf, GST_MAP_READ))
-    goto invalid_in_frame;
+  /* a plain copy multiplies every pixel as it writes its alpha */
+  if (job->sbits == 8 && job->dbits == 8 && job->sstep == 1 &&
+      job->swidth == job->width && job->sheight == job->height) {
+    copy_alpha_premultiply_func (job->dst + line * job->dstride,
+        job->dstride, job->offset, job->src + line * job->sstride,
+        job->sstride, job->width, lines);
+    return;
+  }
 
-  if (!gst_video_frame_map (&oframe, &thiz->oinfo, obuf, GST_MAP_READWRITE))
-    goto invalid_out_frame;
+  /* the others one line at a time, a line of pixels stays in the L1 cache
+   * between writing its alpha and multiplying */
+  dp = job->dst + line * job->dstride;
+  for (i = line; i < line + lines; i++) {
+    write_alpha_lines (job, i, 1);
+    premultiply_func (dp, job->dstride, job->offset, job->width, 1);
+    dp += job->dstride;
+  }
+}
 
-  gst_video_converter_frame (thiz->convert, &iframe, &oframe);
-  gst_video_frame_unmap (&iframe);
-  gst_buffer_unref (ibuf);
+static void
+premultiply_slice (gpointer data, guint line, guint lines)
+{
+  GstAlphaMaskWriteJob *job = data;
+  guint8 *dp = job->dst + line * job->dstride;
+  guint i;
 
-  if (!thiz->alpha_buffer)
-    goto beach;
+  if (job->value < 0) {
+    premultiply_func (dp, job->dstride, job->offset, job->width, lines);
+    return;
+  }
 
-  if (!gst_video_frame_map (&aframe, &thiz->ainfo, thiz->alpha_buffer,
-          GST_MAP_READ)) {
-    GST_DEBUG_OBJECT (thiz, "received invalid buffer");
-  } else {
-    if (thiz->oformat == GST_VIDEO_FORMAT_A420)
-      copy_alpha_planar (&aframe, &oframe, 3);
-    else
-      copy_alpha_packed (&aframe, &oframe);
-    gst_video_frame_unmap (&aframe);
+  for (i = 0; i < lines; i++) {
+    gst_alpha_mask_fill_alpha (dp, job->dstride, 4, job->offset, job->width,
+        1, job->value);
+    premultiply_func (dp, job->dstride, job->offset, job->width, 1);
+    dp += job->dstride;
   }
+}
 
-beach:
-  gst_video_frame_unmap (&oframe);
+static void
+decode_bitmap_slice (gpointer data, guint line, guint lines)
+{
+  GstAlphaMaskWriteJob *job = data;
+  guint8 *dp;
+  guint i;
+
+  if (!job->premultiply) {
+    gst_alpha_mask_decode_bitmap (job->dst + job->offset, job->dstride,
+        job->step, job->dbits, job->width, job->height, line, lines,
+        job->src, job->size, job->swidth, job->sheight);
+    return;
+  }
 
-  return obuf;
+  dp = job->dst + line * job->dstride;
+  for (i = line; i < line + lines; i++) {
+    gst_alpha_mask_decode_bitmap (job->dst + job->offset, job->dstride,
+        job->step, job->dbits, job->width, job->height, i, 1, job->src,
+        job->size, job->swidth, job->sheight);
+    premultiply_func (dp, job->dstride, job->offset, job->width, 1);
+    dp += job->dstride;
+  }
+}
 
-  /* ERRORS */
-invalid_in_frame:
-  {
-    gst_buffer_unref (ibuf);
-    GST_DEBUG_OBJECT (thiz, "received invalid buffer");
-    return NULL;
+/* Decodes the compact mask of @job straight into the output alpha, masks
+ * that don't decode leave the output opaque */
+static void
+gst_alpha_mask_decode_alpha (GstAlphaMask * thiz, GstAlphaMaskWriteJob * job)
+{
+  gboolean ok;
+
+  if (thiz->alpha_encoding == GST_ALPHA_MASK_ENCODING_BITMAP) {
+    ok = job->size >= (gsize) ((job->swidth + 7) / 8) * job->sheight;
+    if (ok)
+      gst_alpha_mask_run_slices (thiz, decode_bitmap_slice, job, job->height);
+  } else {
+    /* the runs don't split in slices, the decoder multiplies every line
+     * once it is written */
+    ok = gst_alpha_mask_decode_rle (job->dst + job->offset, job->dstride,
+        job->step, job->dbits, job->width, job->height, job->src, job->size,
+        job->swidth, job->sheight, job->premultiply ? premultiply_func : NULL,
+        job->offset);
   }
 
-invalid_out_frame:
-  {
-    gst_video_frame_unmap (&iframe);
-    gst_buffer_unref (ibuf);
-    gst_buffer_unref (obuf);
-    GST_DEBUG_OBJECT (thiz, "invalid output buffer");
-    return NULL;
+  if (!ok) {
+    GST_WARNING_OBJECT (thiz, "invalid compact mask of %" G_GSIZE_FORMAT
+        " bytes, frame left opaque", job->size);
+    if (job->dbits > 8)
+      gst_alpha_mask_fill_alpha16 (job->dst, job->dstride, job->step,
+          job->offset, job->width, job->height, (1 << job->dbits) - 1);
+    else
+      gst_alpha_mask_fill_alpha (job->dst, job->dstride, job->step,
+          job->offset, job->width, job->height, 0xff);
   }
 }
 
-static gboolean
-gst_alpha_mask_negotiate (GstAlphaMask * thiz, GstCaps * caps)
+/* Writes the @rect region of the mask in @aframe as the alpha of the output,
+ * every @step bytes from @offset on. The mask is scaled on the way when the
+ * region doesn't match the output size and its samples are brought to the
+ * depth of the output alpha. */
+static void
+gst_alpha_mask_write_alpha (GstAlphaMask * thiz, GstVideoFrame * aframe,
+    const GstVideoRectangle * rect, guint8 * dst, guint dstride, guint offset,
+    guint step)
 {
-  GstCaps *output_caps = NULL;
-  GstCaps *template_caps;
-  GstCaps *allowed_caps = NULL;
-  GstVideoFormat format = DEFAULT_FORMAT;
-  GstVideoInfo info;
-  gboolean ret;
+  GstAlphaMaskWriteJob job;
+  guint comp = gst_alpha_mask_mask_comp (thiz);
+
+  job.sbits = gst_alpha_mask_mask_depth (thiz);
+  if (thiz->alpha_encoding == GST_ALPHA_MASK_ENCODING_RAW) {
+    job.sstep = GST_VIDEO_FRAME_COMP_PSTRIDE (aframe, comp);
+    job.sstride = GST_VIDEO_FRAME_COMP_STRIDE (aframe, comp);
+    job.src = (const guint8 *) GST_VIDEO_FRAME_COMP_DATA (aframe, comp) +
+        rect->y * job.sstride + rect->x * job.sstep;
+  } else {
+    job.sstep = 1;
+    job.sstride = GST_VIDEO_FRAME_PLANE_STRIDE (aframe, 0);
+    job.src = aframe->data[0];
+  }
+  job.size = aframe->map[0].size;
+  job.swidth = rect->w;
+  job.sheight = rect->h;
+  job.dst = dst;
+  job.dstride = dstride;
+  job.offset = offset;
+  job.step = step;
+  job.dbits = ALPHA_DEPTH (&thiz->oinfo);
+  job.width = thiz->width;
+  job.height = thiz->height;
+  job.bilinear = thiz->alpha_scaling == GST_ALPHA_MASK_SCALING_BILINEAR;
+  job.premultiply = step == 4 && thiz->premultiplied;
+  job.value = -1;
+
+  if (thiz->alpha_encoding == GST_ALPHA_MASK_ENCODING_RAW)
+    gst_alpha_mask_run_slices (thiz, write_alpha_slice, &job, thiz->height);
+  else
+    gst_alpha_mask_decode_alpha (thiz, &job);
+}
 
-  GST_DEBUG_OBJECT (thiz, "performing negotiation");
+static void
+copy_alpha_packed (GstAlphaMask * thiz, GstVideoFrame * aframe,
+    const GstVideoRectangle * rect, GstVideoFrame * oframe)
+{
+  gst_alpha_mask_write_alpha (thiz, aframe, rect, oframe->data[0],
+      GST_VIDEO_FRAME_PLANE_STRIDE (oframe, 0),
+      GST_VIDEO_FORMAT_INFO_POFFSET (oframe->info.finfo, GST_VIDEO_COMP_A),
+      ALPHA_STEP (&oframe->info));
+}
 
-  /* Clear any pending reconfigure to avoid negotiating twice */
-  gst_pad_check_reconfigure (thiz->srcpad);
+static void
+copy_alpha_planar (GstAlphaMask * thiz, GstVideoFrame * aframe,
+    const GstVideoRectangle * rect, GstVideoFrame * oframe, guint plane)
+{
+  gst_alpha_mask_write_alpha (thiz, aframe, rect, oframe->data[plane],
+      GST_VIDEO_FRAME_PLANE_STRIDE (oframe, plane), 0,
+      ALPHA_STEP (&oframe->info));
+}
 
-  if (!caps || gst_caps_is_empty (caps))
+/* Premultiplies the packed @oframe, for frames that got no mask but may not
+ * be opaque. The alpha is set to @value first unless it is -1, line by line
+ * in the same pass. */
+static void
+gst_alpha_mask_premultiply_frame (GstAlphaMask * thiz, GstVideoFrame * oframe,
+    gint value)
+{
+  GstAlphaMaskWriteJob job;
+
+  job.value = value;
+  job.dst = oframe->data[0];
+  job.dstride = GST_VIDEO_FRAME_PLANE_STRIDE (oframe, 0);
+  job.offset =
+      GST_VIDEO_FORMAT_INFO_POFFSET (oframe->info.finfo, GST_VIDEO_COMP_A);
+  job.width = GST_VIDEO_FRAME_WIDTH (oframe);
+
+  gst_alpha_mask_run_slices (thiz, premultiply_slice, &job,
+      GST_VIDEO_FRAME_HEIGHT (oframe));
+}
+
+/* Whether a frame without mask still needs premultiplying: the constant
+ * alpha or the alpha of the input may be less than opaque */
+static gboolean
+gst_alpha_mask_needs_premultiply (GstAlphaMask * thiz)
+{
+  if (!thiz->premultiplied)
     return FALSE;
+  if (thiz->fill_alpha >= 0)
+    return thiz->fill_alpha != 0xff;
+  return GST_VIDEO_INFO_HAS_ALPHA (&thiz->iinfo);
+}
 
-  template_caps = gst_static_pad_template_get_caps (&src_factory);
-  allowed_caps = gst_pad_get_allowed_caps (thiz->srcpad);
+/* Sets the whole alpha of @oframe to @value, the same level of the deeper
+ * range for more than 8 bits of alpha */
+static void
+fill_alpha (GstVideoFrame * oframe, guint8 value)
+{
+  guint bits = ALPHA_DEPTH (&oframe->info);
+
+  if (bits > 8) {
+    guint plane = ALPHA_PLANE (&oframe->info);
+
+    gst_alpha_mask_fill_alpha16 (oframe->data[plane],
+        GST_VIDEO_FRAME_PLANE_STRIDE (oframe, plane),
+        ALPHA_STEP (&oframe->info),
+        GST_VIDEO_FORMAT_INFO_POFFSET (oframe->info.finfo, GST_VIDEO_COMP_A),
+        GST_VIDEO_FRAME_COMP_WIDTH (oframe, GST_VIDEO_COMP_A),
+        GST_VIDEO_FRAME_COMP_HEIGHT (oframe, GST_VIDEO_COMP_A),
+        (value * 257) >> (16 - bits));
+  } else if (HAS_ALPHA_PLANE (&oframe->info)) {
+    guint plane = ALPHA_PLANE (&oframe->info);
+
+    gst_alpha_mask_fill_alpha (oframe->data[plane],
+        GST_VIDEO_FRAME_PLANE_STRIDE (oframe, plane), 1, 0,
+        GST_VIDEO_FRAME_COMP_WIDTH (oframe, GST_VIDEO_COMP_A),
+        GST_VIDEO_FRAME_COMP_HEIGHT (oframe, GST_VIDEO_COMP_A), value);
+  } else {
+    gst_alpha_mask_fill_alpha (oframe->data[0],
+        GST_VIDEO_FRAME_PLANE_STRIDE (oframe, 0), 4,
+        GST_VIDEO_FORMAT_INFO_POFFSET (oframe->info.finfo, GST_VIDEO_COMP_A),
+        GST_VIDEO_FRAME_WIDTH (oframe), GST_VIDEO_FRAME_HEIGHT (oframe), value);
+  }
+}
 
-  /* If downstream has ANY caps just go for our preferred format */
-  if (allowed_caps == template_caps) {
-    GST_INFO_OBJECT (thiz, "downstream has ANY caps");
-  } else if (allowed_caps) {
-    if (gst_caps_is_empty (allowed_caps)) {
-      gst_caps_unref (allowed_caps);
-      gst_caps_unref (template_caps);
-      return FALSE;
+typedef struct
+{
+  GstAlphaMaskFuseLineFunc fuse;
+  const guint8 *sp[3];
+  guint ss[3];
+  guint sub[3];
+  const guint8 *ap;
+  guint as;
+  guint8 *dp;
+  guint ds;
+  guint width;
+  guint8 value;                 /* alpha without mask */
+  const GstAlphaMaskYuvMatrix *matrix;
+  const guint8 *clear;          /* lines to leave transparent, or NULL */
+  gboolean premultiply;
+  guint aoffset;                /* of the alpha byte, for premultiplying */
+} GstAlphaMaskFuseJob;
+
+static void
+fuse_alpha_slice (gpointer data, guint line, guint lines)
+{
+  GstAlphaMaskFuseJob *job = data;
+  const guint8 *comp[3], *ap = NULL;
+  guint8 *dp;
+  guint i, c;
+
+  dp = job->dp + line * job->ds;
+  if (job->ap)
+    ap = job->ap + line * job->as;
+
+  for (i = line; i < line + lines; i++) {
+    if (job->clear && job->clear[i]) {
+      memset (dp, 0, job->width * 4);
+    } else {
+      for (c = 0; c < 3; c++)
+        comp[c] = job->sp[c] + (i >> job->sub[c]) * job->ss[c];
+
+      job->fuse (dp, comp, ap, job->value, job->matrix, job->width);
+      if (job->premultiply)
+        premultiply_func (dp, job->ds, job->aoffset, job->width, 1);
     }
 
-    allowed_caps = gst_caps_make_writable (allowed_caps);
-    allowed_caps = gst_caps_fixate (allowed_caps);
-    gst_video_info_from_caps (&info, allowed_caps);
-    format = GST_VIDEO_INFO_FORMAT (&info);
+    dp += job->ds;
+    if (ap)
+      ap += job->as;
   }
-  gst_caps_unref (allowed_caps);
-  gst_caps_unref (template_caps);
+}
 
-  gst_video_info_set_format (&info, format, thiz->width, thiz->height);
-  info.par_n = thiz->iinfo.par_n;
-  info.par_d = thiz->iinfo.par_d;
-  info.fps_n = thiz->iinfo.fps_n;
-  info.fps_d = thiz->iinfo.fps_d;
+/* Converts @iframe into the packed @oframe and inserts the alpha from the
+ * @rect region of @aframe, or the constant alpha without mask, in a single
+ * pass over the output. The region has to be the size of the output. */
+static void
+fuse_alpha_packed (GstAlphaMask * thiz, GstVideoFrame * iframe,
+    GstVideoFrame * aframe, const GstVideoRectangle * rect,
+    GstVideoFrame * oframe)
+{
+  const GstVideoFormatInfo *finfo = iframe->info.finfo;
+  GstAlphaMaskFuseJob job;
+  guint c;
+
+  job.fuse = thiz->fuse;
+  for (c = 0; c < 3; c++) {
+    job.sp[c] = GST_VIDEO_FRAME_COMP_DATA (iframe, c);
+    job.ss[c] = GST_VIDEO_FRAME_COMP_STRIDE (iframe, c);
+    job.sub[c] = GST_VIDEO_FORMAT_INFO_H_SUB (finfo, c);
+  }
 
-  GST_DEBUG_OBJECT (thiz, "Converting video from %d to %d",
-      GST_VIDEO_INFO_FORMAT (&thiz->iinfo), GST_VIDEO_INFO_FORMAT (&info));
+  job.ap = NULL;
+  job.as = 0;
+  if (aframe) {
+    guint comp = gst_alpha_mask_mask_comp (thiz);
 
-  if (thiz->convert)
-    gst_video_converter_free (thiz->convert);
+    job.as = GST_VIDEO_FRAME_COMP_STRIDE (aframe, comp);
+    job.ap = (const guint8 *) GST_VIDEO_FRAME_COMP_DATA (aframe, comp) +
+        rect->y * job.as + rect->x;
+  }
 
-  thiz->convert = gst_video_converter_new (&thiz->iinfo, &info, NULL);
-  if (!thiz->convert) {
-    GST_ERROR_OBJECT (thiz, "Video cannot be converted");
-    return FALSE;
+  job.dp = oframe->data[0];
+  job.ds = GST_VIDEO_FRAME_PLANE_STRIDE (oframe, 0);
+  job.width = GST_VIDEO_FRAME_WIDTH (oframe);
+  job.value = thiz->fill_alpha < 0 ? 0xff : thiz->fill_alpha;
+  job.matrix = &thiz->fuse_matrix;
+  job.clear = aframe && thiz->skip_clear ? thiz->clear_lines : NULL;
+  /* multiplying by an opaque line is a no-op */
+  job.premultiply = thiz->premultiplied && (aframe || job.value != 0xff);
+  job.aoffset =
+      GST_VIDEO_FORMAT_INFO_POFFSET (oframe->info.finfo, GST_VIDEO_COMP_A);
+
+  gst_alpha_mask_run_slices (thiz, fuse_alpha_slice, &job,
+      GST_VIDEO_FRAME_HEIGHT (oframe));
+}
+
+/* mask tiles classified at a time, in mask pixels */
+#define ANALYSIS_TILE_SIZE 32
+
+/* region of interest metas attached to a frame at most */
+#define MAX_ROI_REGIONS 64
+
+typedef struct
+{
+  GstVideoRectangle rect;
+  GstAlphaMaskBlockClass klass;
+} GstAlphaMaskRegion;
+
+/* equally classified tiles, in tile units */
+typedef struct
+{
+  guint x0, x1;
+  guint y0, y1;
+  GstAlphaMaskBlockClass klass;
+} GstAlphaMaskTileRun;
+
+/* Output range [*d0, *d1) along one axis that is only made out of mask
+ * pixels [s0, s1) when a @sn pixel region gets scaled to @dn. Bilinear
+ * sampling is assumed, it reaches further than nearest neighbour. */
+static void
+map_alpha_range (guint s0, guint s1, guint sn, guint dn, gint * d0, gint * d1)
+{
+  gint64 lo = 0, hi = dn;
+
+  if (sn == dn) {
+    *d0 = s0;
+    *d1 = s1;
+    return;
   }
 
-  thiz->oinfo = info;
-  thiz->oformat = format;
-  output_caps = gst_video_info_to_caps (&info);
+  /* pixel d samples (d + 0.5) * sn / dn - 0.5 and its right neighbour,
+   * inner edges lose one more pixel to the fixed point error of the
+   * scaler */
+  if (s0 > 0) {
+    lo = (gint64) (2 * s0 + 1) * dn - sn;
+    lo = (lo > 0 ? (lo + 2 * sn - 1) / (2 * sn) : 0) + 1;
+  }
+  if (s1 < sn) {
+    hi = (gint64) (2 * s1 - 1) * dn - sn;
+    hi = (hi > 0 ? (hi + 2 * sn - 1) / (2 * sn) : 0) - 1;
+  }
+
+  *d0 = MIN (lo, dn);
+  *d1 = CLAMP (hi, *d0, dn);
+}
+
+/* Classifies the current mask in tiles, merges equal neighbours and keeps
+ * the fully transparent and fully opaque regions in output coordinates.
+ * Only done once per mask buffer. */
+static void
+gst_alpha_mask_analyze_alpha (GstAlphaMask * thiz)
+{
+  GstVideoFrame aframe;
+  GstVideoRectangle rect;
+  GstAlphaMaskBlockClass *row;
+  GArray *runs;
+  const guint8 *ap;
+  guint comp, as, tiles_x, tiles_y, tx, ty, i, n;
+
+  if (thiz->analysis_valid)
+    return;
+  thiz->analysis_valid = TRUE;
+
+  g_array_set_size (thiz->alpha_regions, 0);
+  if (thiz->clear_lines_len != thiz->height) {
+    g_free (thiz->clear_lines);
+    thiz->clear_lines = g_malloc (thiz->height);
+    thiz->clear_lines_len = thiz->height;
+  }
+  memset (thiz->clear_lines, 0, thiz->height);
+  thiz->frame_clear = FALSE;
+
+  /* compact masks are only ever decoded into the output, the tiles are
+   * classified by bytes */
+  if (!thiz->alpha_buffer || !gst_alpha_mask_mask_is_plane (thiz))
+    return;
+
+  gst_alpha_mask_get_alpha_rect (thiz, thiz->alpha_buffer, &rect);
+  if (!gst_video_frame_map (&aframe, &thiz->ainfo, thiz->alpha_buffer,
+          GST_MAP_READ)) {
+    GST_DEBUG_OBJECT (thiz, "received invalid buffer");
+    return;
+  }
+
+  comp = gst_alpha_mask_mask_comp (thiz);
+  as = GST_VIDEO_FRAME_COMP_STRIDE (&aframe, comp);
+  ap = (const guint8 *) GST_VIDEO_FRAME_COMP_DATA (&aframe, comp) +
+      rect.y * as + rect.x;
+
+  tiles_x = (rect.w + ANALYSIS_TILE_SIZE - 1) / ANALYSIS_TILE_SIZE;
+  tiles_y = (rect.h + ANALYSIS_TILE_SIZE - 1) / ANALYSIS_TILE_SIZE;
+  row = g_newa (GstAlphaMaskBlockClass, tiles_x);
+  runs = g_array_new (FALSE, FALSE, sizeof (GstAlphaMaskTileRun));
+
+  for (ty = 0; ty < tiles_y; ty++) {
+    guint y = ty * ANALYSIS_TILE_SIZE;
+    guint h = MIN (ANALYSIS_TILE_SIZE, rect.h - y);
+
+    for (tx = 0; tx < tiles_x; tx++) {
+      guint x = tx * ANALYSIS_TILE_SIZE;
+
+      row[tx] = gst_alpha_mask_classify_block (ap + y * as + x, as,
+          MIN (ANALYSIS_TILE_SIZE, rect.w - x), h);
+    }
+
+    n = runs->len;
+    for (tx = 0; tx < tiles_x;) {
+      GstAlphaMaskTileRun run;
+
+      run.x0 = tx;
+      run.klass = row[tx];
+      while (++tx < tiles_x && row[tx] == run.klass);
+      run.x1 = tx;
+      run.y0 = ty;
+      run.y1 = ty + 1;
+
+      if (run.klass == GST_ALPHA_MASK_BLOCK_MIXED)
+        continue;
+
+      /* grow a run ending on the tile row above if it lines up */
+      for (i = 0; i < n; i++) {
+        GstAlphaMaskTileRun *r = &g_array_index (runs, GstAlphaMaskTileRun, i);
+
+        if (r->y1 == ty && r->x0 == run.x0 && r->x1 == run.x1 &&
+            r->klass == run.klass) {
+          r->y1++;
+          break;
+        }
+      }
+      if (i == n)
+        g_array_append_val (runs, run);
+    }
+  }
+
+  gst_video_frame_unmap (&aframe);
+
+  for (i = 0; i < runs->len; i++) {
+    GstAlphaMaskTileRun *r = &g_array_index (runs, GstAlphaMaskTileRun, i);
+    GstAlphaMaskRegion region;
+    gint x0, x1, y0, y1;
+
+    map_alpha_range (r->x0 * ANALYSIS_TILE_SIZE,
+        MIN (r->x1 * ANALYSIS_TILE_SIZE, rect.w), rect.w, thiz->width,
+        &x0, &x1);
+    map_alpha_range (r->y0 * ANALYSIS_TILE_SIZE,
+        MIN (r->y1 * ANALYSIS_TILE_SIZE, rect.h), rect.h, thiz->height,
+        &y0, &y1);
+    if (x1 <= x0 || y1 <= y0)
+      continue;
+
+    region.rect.x = x0;
+    region.rect.y = y0;
+    region.rect.w = x1 - x0;
+    region.rect.h = y1 - y0;
+    region.klass = r->klass;
+    g_array_append_val (thiz->alpha_regions, region);
+
+    if (r->klass == GST_ALPHA_MASK_BLOCK_TRANSPARENT && x0 == 0 &&
+        x1 == thiz->width)
+      memset (thiz->clear_lines + y0, 1, y1 - y0);
+  }
+  g_array_free (runs, TRUE);
+
+  thiz->frame_clear = thiz->height > 0 &&
+      !memchr (thiz->clear_lines, 0, thiz->height);
+
+  GST_LOG_OBJECT (thiz, "mask has %u uniform regions%s",
+      thiz->alpha_regions->len, thiz->frame_clear ? ", fully transparent" :
+      "");
+}
+
+/* Attaches the uniform regions of the mask to @buf for downstream to skip
+ * blending where it can */
+static void
+gst_alpha_mask_attach_regions (GstAlphaMask * thiz, GstBuffer * buf)
+{
+  guint i, n = MIN (thiz->alpha_regions->len, MAX_ROI_REGIONS);
+
+  if (n < thiz->alpha_regions->len)
+    GST_LOG_OBJECT (thiz, "only attaching %u of %u regions", n,
+        thiz->alpha_regions->len);
+
+  for (i = 0; i < n; i++) {
+    GstAlphaMaskRegion *region =
+        &g_array_index (thiz->alpha_regions, GstAlphaMaskRegion, i);
+
+    gst_buffer_add_video_region_of_interest_meta (buf,
+        region->klass == GST_ALPHA_MASK_BLOCK_TRANSPARENT ?
+        "alpha-transparent" : "alpha-opaque", region->rect.x, region->rect.y,
+        region->rect.w, region->rect.h);
+  }
+}
+
+/* Writes the alpha straight into the writable @buf, which already is in the
+ * output format. Returns NULL, leaving @buf untouched, when that's not
+ * possible. */
+static GstBuffer *
+gst_alpha_mask_fill_in_place (GstAlphaMask * thiz, GstBuffer * buf)
+{
+  GstVideoFrame aframe, frame;
+  GstVideoRectangle rect;
+  gboolean have_alpha = FALSE;
+
+  if (thiz->alpha_buffer) {
+    gst_alpha_mask_get_alpha_rect (thiz, thiz->alpha_buffer, &rect);
+    have_alpha = gst_alpha_mask_map_alpha (thiz, &aframe);
+    if (!have_alpha)
+      GST_DEBUG_OBJECT (thiz, "received invalid buffer");
+  }
+
+  if (!gst_video_frame_map (&frame, &thiz->oinfo, buf, GST_MAP_READWRITE)) {
+    if (have_alpha)
+      gst_alpha_mask_unmap_alpha (thiz, &aframe);
+    return NULL;
+  }
+
+  /* like the converter would, packed formats keep their own alpha when
+   * there is no mask */
+  if (HAS_ALPHA_PLANE (&thiz->oinfo)) {
+    if (have_alpha)
+      copy_alpha_planar (thiz, &aframe, &rect, &frame,
+          ALPHA_PLANE (&thiz->oinfo));
+    else
+      fill_alpha (&frame, thiz->fill_alpha < 0 ? 0xff : thiz->fill_alpha);
+  } else if (have_alpha) {
+    copy_alpha_packed (thiz, &aframe, &rect, &frame);
+  } else if (gst_alpha_mask_needs_premultiply (thiz)) {
+    gst_alpha_mask_premultiply_frame (thiz, &frame, thiz->fill_alpha);
+  } else if (thiz->fill_alpha >= 0) {
+    fill_alpha (&frame, thiz->fill_alpha);
+  }
+
+  if (have_alpha)
+    gst_alpha_mask_unmap_alpha (thiz, &aframe);
+  gst_video_frame_unmap (&frame);
+
+  return buf;
+}
+
+static GstBuffer *
+gst_alpha_mask_convert (GstAlphaMask * thiz, GstBuffer * ibuf)
+{
+  GstVideoFrame aframe, iframe, oframe;
+  GstVideoRectangle rect;
+  GstBuffer *obuf = NULL;
+  gboolean have_alpha = FALSE, skip_color;
+
+  if (!thiz->pool ||
+      gst_buffer_pool_acquire_buffer (thiz->pool, &obuf, NULL) != GST_FLOW_OK)
+    goto no_buffer;
+
+  gst_buffer_copy_into (obuf, ibuf, GST_BUFFER_COPY_FLAGS |
+      GST_BUFFER_COPY_TIMESTAMPS, 0, -1);
+
+  /* Convert the frame into output format */
+  if (!gst_video_frame_map (&iframe, &thiz->iinfo, ibuf, GST_MAP_READ))
+    goto invalid_in_frame;
+
+  if (!gst_video_frame_map (&oframe, &thiz->oinfo, obuf, GST_MAP_READWRITE))
+    goto invalid_out_frame;
+
+  if (thiz->alpha_buffer) {
+    gst_alpha_mask_get_alpha_rect (thiz, thiz->alpha_buffer, &rect);
+    have_alpha = gst_alpha_mask_map_alpha (thiz, &aframe);
+    if (!have_alpha)
+      GST_DEBUG_OBJECT (thiz, "received invalid buffer");
+  }
+
+  /* there is nothing to see of a fully transparent frame */
+  skip_color = have_alpha && thiz->skip_clear && thiz->frame_clear;
+
+  /* a scaled or compact mask goes through the two pass path */
+  if (thiz->fuse && (!have_alpha || (rect.w == thiz->width &&
+              rect.h == thiz->height && gst_alpha_mask_mask_is_plane (thiz)))) {
+    fuse_alpha_packed (thiz, &iframe, have_alpha ? &aframe : NULL,
+        &rect, &oframe);
+  } else if (HAS_ALPHA_PLANE (&thiz->oinfo)) {
+    GstVideoFrame cframe;
+
+    /* the converter only writes the color planes */
+    cframe = oframe;
+    cframe.info.finfo = thiz->cinfo.finfo;
+    if (!skip_color)
+      gst_video_converter_frame (thiz->convert, &iframe, &cframe);
+    if (have_alpha)
+      copy_alpha_planar (thiz, &aframe, &rect, &oframe,
+          ALPHA_PLANE (&thiz->oinfo));
+    else
+      fill_alpha (&oframe, thiz->fill_alpha < 0 ? 0xff : thiz->fill_alpha);
+  } else if (skip_color) {
+    guint8 *dp = oframe.data[0];
+    gint j;
+
+    for (j = 0; j < thiz->height; j++) {
+      memset (dp, 0, thiz->width * GST_VIDEO_FRAME_COMP_PSTRIDE (&oframe, 0));
+      dp += GST_VIDEO_FRAME_PLANE_STRIDE (&oframe, 0);
+    }
+  } else {
+    gst_video_converter_frame (thiz->convert, &iframe, &oframe);
+    if (have_alpha)
+      copy_alpha_packed (thiz, &aframe, &rect, &oframe);
+    else if (gst_alpha_mask_needs_premultiply (thiz))
+      gst_alpha_mask_premultiply_frame (thiz, &oframe, thiz->fill_alpha);
+    else if (thiz->fill_alpha >= 0)
+      fill_alpha (&oframe, thiz->fill_alpha);
+  }
+
+  gst_video_frame_unmap (&iframe);
+  gst_buffer_unref (ibuf);
+
+  if (have_alpha)
+    gst_alpha_mask_unmap_alpha (thiz, &aframe);
+  gst_video_frame_unmap (&oframe);
+
+  return obuf;
+
+  /* ERRORS */
+no_buffer:
+  {
+    gst_buffer_unref (ibuf);
+    GST_DEBUG_OBJECT (thiz, "could not acquire output buffer");
+    return NULL;
+  }
+
+invalid_in_frame:
+  {
+    gst_buffer_unref (ibuf);
+    gst_buffer_unref (obuf);
+    GST_DEBUG_OBJECT (thiz, "received invalid buffer");
+    return NULL;
+  }
+
+invalid_out_frame:
+  {
+    gst_video_frame_unmap (&iframe);
+    gst_buffer_unref (ibuf);
+    gst_buffer_unref (obuf);
+    GST_DEBUG_OBJECT (thiz, "invalid output buffer");
+    return NULL;
+  }
+}
+
+static void
+gst_alpha_mask_clear_cache (GstAlphaMask * thiz)
+{
+  if (thiz->cache_mem) {
+    gst_memory_unref (thiz->cache_mem);
+    thiz->cache_mem = NULL;
+  }
+  g_free (thiz->cache_key);
+  thiz->cache_key = NULL;
+  thiz->cache_key_size = 0;
+}
+
+/* Whether the @width x @height bytes at @src are the mask the cached alpha
+ * plane was made from */
+static gboolean
+gst_alpha_mask_cache_key_equal (GstAlphaMask * thiz, const guint8 * src,
+    guint stride, guint width, guint height)
+{
+  const guint8 *key = thiz->cache_key;
+  guint j;
+
+  if (!key || thiz->cache_key_size != (gsize) width * height)
+    return FALSE;
+
+  for (j = 0; j < height; j++) {
+    if (memcmp (src, key, width) != 0)
+      return FALSE;
+    src += stride;
+    key += width;
+  }
+
+  return TRUE;
+}
+
+/* Keeps a copy of the mask, upstream memory would have to stay untouched
+ * for as long as it's the key and could not go back to its pool */
+static void
+gst_alpha_mask_cache_key_store (GstAlphaMask * thiz, const guint8 * src,
+    guint stride, guint width, guint height)
+{
+  guint8 *key;
+  guint j;
+
+  thiz->cache_key_size = (gsize) width * height;
+  thiz->cache_key = key = g_malloc (thiz->cache_key_size);
+  for (j = 0; j < height; j++) {
+    memcpy (key, src, width);
+    src += stride;
+    key += width;
+  }
+}
+
+/* Returns the prepared alpha plane for the queued alpha buffer. The previous
+ * one is reused when upstream sends a mask with the same content. */
+static GstMemory *
+gst_alpha_mask_lookup_alpha (GstAlphaMask * thiz)
+{
+  GstBuffer *abuf = thiz->alpha_buffer;
+  GstVideoFrame aframe;
+  GstVideoRectangle rect;
+  gboolean same_region;
+  const guint8 *sp;
+  guint64 hash;
+  guint ss, sw, sh, comp;
+
+  /* the prepared plane also depends on the mask region and scaling */
+  gst_alpha_mask_get_alpha_rect (thiz, abuf, &rect);
+  comp = gst_alpha_mask_mask_comp (thiz);
+  same_region = rect.x == thiz->cache_rect.x && rect.y == thiz->cache_rect.y
+      && rect.w == thiz->cache_rect.w && rect.h == thiz->cache_rect.h &&
+      thiz->alpha_scaling == thiz->cache_scaling && comp == thiz->cache_comp;
+
+  if (!gst_alpha_mask_map_alpha (thiz, &aframe)) {
+    GST_DEBUG_OBJECT (thiz, "received invalid buffer");
+    return NULL;
+  }
+
+  if (thiz->alpha_encoding == GST_ALPHA_MASK_ENCODING_RAW) {
+    guint plane = GST_VIDEO_FRAME_COMP_PLANE (&aframe, comp);
+    guint ps = GST_VIDEO_FRAME_COMP_PSTRIDE (&aframe, comp);
+
+    /* whole pixels of the plane holding the component */
+    ss = GST_VIDEO_FRAME_PLANE_STRIDE (&aframe, plane);
+    sp = (const guint8 *) aframe.data[plane] + rect.y * ss + rect.x * ps;
+    sw = rect.w * ps;
+    sh = rect.h;
+  } else {
+    sp = aframe.map[0].data;
+    ss = sw = aframe.map[0].size;
+    sh = 1;
+  }
+  hash = gst_alpha_mask_hash_plane (sp, ss, sw, sh);
+
+  /* the hash only tells different masks apart quickly */
+  if (thiz->cache_mem && same_region && hash == thiz->cache_hash &&
+      gst_alpha_mask_cache_key_equal (thiz, sp, ss, sw, sh)) {
+    GST_LOG_OBJECT (thiz, "same alpha content, reusing alpha plane");
+  } else {
+    GstMemory *mem;
+    GstMapInfo map;
+    gint stride = GST_VIDEO_INFO_PLANE_STRIDE (&thiz->oinfo,
+        ALPHA_PLANE (&thiz->oinfo));
+
+    mem = gst_allocator_alloc (NULL, stride * thiz->height, NULL);
+    if (!mem || !gst_memory_map (mem, &map, GST_MAP_WRITE)) {
+      if (mem)
+        gst_memory_unref (mem);
+      gst_alpha_mask_unmap_alpha (thiz, &aframe);
+      GST_DEBUG_OBJECT (thiz, "could not allocate alpha plane");
+      return NULL;
+    }
+
+    gst_alpha_mask_write_alpha (thiz, &aframe, &rect, map.data, stride, 0,
+        ALPHA_STEP (&thiz->oinfo));
+    gst_memory_unmap (mem, &map);
+
+    GST_LOG_OBJECT (thiz, "alpha content changed, new alpha plane");
+    gst_alpha_mask_clear_cache (thiz);
+    thiz->cache_mem = mem;
+    thiz->cache_hash = hash;
+    thiz->cache_rect = rect;
+    thiz->cache_scaling = thiz->alpha_scaling;
+    thiz->cache_comp = comp;
+    gst_alpha_mask_cache_key_store (thiz, sp, ss, sw, sh);
+  }
+  gst_alpha_mask_unmap_alpha (thiz, &aframe);
+
+  return gst_memory_ref (thiz->cache_mem);
+}
+
+/* Converts @ibuf into the color planes of an A420 or AV12 buffer and appends
+ * the cached alpha plane by reference. Returns NULL, leaving @ibuf alone, when
+ * the frame has to go through the regular path. */
+static GstBuffer *
+gst_alpha_mask_convert_cached (GstAlphaMask * thiz, GstBuffer * ibuf)
+{
+  GstVideoFrame iframe, cframe;
+  GstBuffer *obuf = NULL;
+  GstMemory *amem;
+  gsize offset[GST_VIDEO_MAX_PLANES];
+  gint stride[GST_VIDEO_MAX_PLANES];
+  guint p, aplane;
+
+  amem = gst_alpha_mask_lookup_alpha (thiz);
+  if (!amem)
+    return NULL;
+
+  if (gst_buffer_pool_acquire_buffer (thiz->color_pool, &obuf,
+          NULL) != GST_FLOW_OK)
+    goto no_buffer;
+
+  if (!gst_video_frame_map (&iframe, &thiz->iinfo, ibuf, GST_MAP_READ))
+    goto invalid_in_frame;
+
+  if (!gst_video_frame_map (&cframe, &thiz->cinfo, obuf, GST_MAP_WRITE))
+    goto invalid_out_frame;
+
+  gst_video_converter_frame (thiz->convert, &iframe, &cframe);
+
+  gst_video_frame_unmap (&cframe);
+  gst_video_frame_unmap (&iframe);
+
+  /* the alpha plane comes right after the color planes */
+  aplane = ALPHA_PLANE (&thiz->oinfo);
+  for (p = 0; p < aplane; p++) {
+    offset[p] = GST_VIDEO_INFO_PLANE_OFFSET (&thiz->cinfo, p);
+    stride[p] = GST_VIDEO_INFO_PLANE_STRIDE (&thiz->cinfo, p);
+  }
+  offset[aplane] = gst_buffer_get_size (obuf);
+  stride[aplane] = GST_VIDEO_INFO_PLANE_STRIDE (&thiz->oinfo, aplane);
+
+  gst_buffer_copy_into (obuf, ibuf, GST_BUFFER_COPY_FLAGS |
+      GST_BUFFER_COPY_TIMESTAMPS, 0, -1);
+  gst_buffer_append_memory (obuf, amem);
+  gst_buffer_add_video_meta_full (obuf, GST_VIDEO_FRAME_FLAG_NONE,
+      thiz->oformat, thiz->width, thiz->height, aplane + 1, offset, stride);
+
+  gst_buffer_unref (ibuf);
+
+  return obuf;
+
+  /* ERRORS */
+no_buffer:
+  {
+    gst_memory_unref (amem);
+    GST_DEBUG_OBJECT (thiz, "could not acquire color buffer");
+    return NULL;
+  }
+
+invalid_in_frame:
+  {
+    gst_memory_unref (amem);
+    gst_buffer_unref (obuf);
+    return NULL;
+  }
+
+invalid_out_frame:
+  {
+    gst_video_frame_unmap (&iframe);
+    gst_memory_unref (amem);
+    gst_buffer_unref (obuf);
+    GST_DEBUG_OBJECT (thiz, "invalid color buffer");
+    return NULL;
+  }
+}
+
+static void
+gst_alpha_mask_set_pool (GstAlphaMask * thiz, GstBufferPool * pool)
+{
+  if (thiz->pool) {
+    gst_buffer_pool_set_active (thiz->pool, FALSE);
+    gst_object_unref (thiz->pool);
+  }
+  thiz->pool = pool;
+}
+
+static void
+gst_alpha_mask_set_color_pool (GstAlphaMask * thiz, GstBufferPool * pool)
+{
+  if (thiz->color_pool) {
+    gst_buffer_pool_set_active (thiz->color_pool, FALSE);
+    gst_object_unref (thiz->color_pool);
+  }
+  thiz->color_pool = pool;
+}
+
+/* Sets up the pool for the color planes of cached A420 or AV12 output. Only
+ * used when downstream can handle the alpha plane living in its own memory. */
+static void
+gst_alpha_mask_setup_color_pool (GstAlphaMask * thiz)
+{
+  GstBufferPool *pool;
+  GstStructure *config;
+  GstCaps *caps;
+  gboolean cache_alpha;
+
+  GST_OBJECT_LOCK (thiz);
+  cache_alpha = thiz->cache_alpha;
+  GST_OBJECT_UNLOCK (thiz);
+
+  gst_alpha_mask_clear_cache (thiz);
+  gst_alpha_mask_set_color_pool (thiz, NULL);
+
+  if (!cache_alpha || !HAS_ALPHA_PLANE (&thiz->oinfo) || thiz->out_dmabuf)
+    return;
+
+  if (!thiz->use_video_meta) {
+    GST_DEBUG_OBJECT (thiz, "downstream lacks video meta, not caching alpha");
+    return;
+  }
+
+  pool = g_object_new (gst_alpha_mask_color_pool_get_type (), NULL);
+  caps = gst_video_info_to_caps (&thiz->cinfo);
+
+  config = gst_buffer_pool_get_config (pool);
+  gst_buffer_pool_config_set_params (config, caps,
+      GST_VIDEO_INFO_SIZE (&thiz->cinfo), 0, 0);
+  gst_caps_unref (caps);
+
+  if (!gst_buffer_pool_set_config (pool, config) ||
+      !gst_buffer_pool_set_active (pool, TRUE)) {
+    GST_WARNING_OBJECT (thiz, "failed to set up color pool, not caching alpha");
+    gst_object_unref (pool);
+    return;
+  }
+
+  thiz->color_pool = pool;
+}
+
+/* Whether the color planes of @in can be used as they are for @out */
+static gboolean
+gst_alpha_mask_can_append_alpha (GstVideoFormat in, GstVideoFormat out)
+{
+  switch (out) {
+    case GST_VIDEO_FORMAT_A420:
+      return in == GST_VIDEO_FORMAT_I420 || in == GST_VIDEO_FORMAT_YV12;
+#if GST_CHECK_VERSION (1,20,0)
+    case GST_VIDEO_FORMAT_AV12:
+      return in == GST_VIDEO_FORMAT_NV12;
+#endif
+    case GST_VIDEO_FORMAT_A420_10LE:
+      return in == GST_VIDEO_FORMAT_I420_10LE;
+    case GST_VIDEO_FORMAT_A444_10LE:
+      return in == GST_VIDEO_FORMAT_Y444_10LE;
+    default:
+      return FALSE;
+  }
+}
+
+/* Builds an A420 or AV12 buffer out of the planes of a I420, YV12 or NV12
+ * @ibuf and the first plane of the alpha buffer without copying any pixels,
+ * likewise for the 10 bit formats and a mask of the same depth. Returns NULL
+ * when the memory layout can't be described to downstream. */
+static GstBuffer *
+gst_alpha_mask_append_alpha (GstAlphaMask * thiz, GstBuffer * ibuf)
+{
+  const GstVideoFormatInfo *ifinfo = thiz->iinfo.finfo;
+  const GstVideoFormatInfo *ofinfo = thiz->oinfo.finfo;
+  GstBuffer *abuf = thiz->alpha_buffer;
+  GstBuffer *obuf;
+  GstVideoMeta *meta;
+  GstMemory *mem;
+  gsize offset[GST_VIDEO_MAX_PLANES];
+  gint stride[GST_VIDEO_MAX_PLANES];
+  gsize aoffset, asize, skip;
+  GstVideoRectangle rect;
+  guint idx, len, c, p, aplane, n_planes, astep, mplane;
+
+  /* compact masks need decoding, interleaved masks or masks of another
+   * depth converting */
+  if (!abuf || !gst_alpha_mask_mask_is_alpha_plane (thiz, thiz->oformat))
+    return NULL;
+
+  /* a cropped region can be referenced as long as it needs no scaling */
+  gst_alpha_mask_get_alpha_rect (thiz, abuf, &rect);
+  if (rect.w != thiz->width || rect.h != thiz->height)
+    return NULL;
+
+  aplane = ALPHA_PLANE (&thiz->oinfo);
+  n_planes = GST_VIDEO_INFO_N_PLANES (&thiz->oinfo);
+
+  /* color planes, reordered to the output plane order */
+  meta = gst_buffer_get_video_meta (ibuf);
+  for (c = 0; c < 3; c++) {
+    guint iplane = GST_VIDEO_FORMAT_INFO_PLANE (ifinfo, c);
+    guint oplane = GST_VIDEO_FORMAT_INFO_PLANE (ofinfo, c);
+
+    if (meta) {
+      offset[oplane] = meta->offset[iplane];
+      stride[oplane] = meta->stride[iplane];
+    } else {
+      offset[oplane] = GST_VIDEO_INFO_PLANE_OFFSET (&thiz->iinfo, iplane);
+      stride[oplane] = GST_VIDEO_INFO_PLANE_STRIDE (&thiz->iinfo, iplane);
+    }
+  }
+
+  /* alpha plane, which has to live in a single memory */
+  mplane = GST_VIDEO_INFO_COMP_PLANE (&thiz->ainfo,
+      gst_alpha_mask_mask_comp (thiz));
+  meta = gst_buffer_get_video_meta (abuf);
+  if (meta) {
+    aoffset = meta->offset[mplane];
+    stride[aplane] = meta->stride[mplane];
+  } else {
+    aoffset = GST_VIDEO_INFO_PLANE_OFFSET (&thiz->ainfo, mplane);
+    stride[aplane] = GST_VIDEO_INFO_PLANE_STRIDE (&thiz->ainfo, mplane);
+  }
+  astep = ALPHA_STEP (&thiz->oinfo);
+  aoffset += rect.y * stride[aplane] + rect.x * astep;
+  asize = stride[aplane] * (thiz->height - 1) + thiz->width * astep;
+
+  if (!gst_buffer_find_memory (abuf, aoffset, asize, &idx, &len, &skip) ||
+      len != 1) {
+    GST_LOG_OBJECT (thiz, "alpha plane spans multiple memories");
+    return NULL;
+  }
+  offset[aplane] = gst_buffer_get_size (ibuf) + skip;
+
+  /* without GstVideoMeta downstream expects the default layout */
+  if (!thiz->use_video_meta) {
+    for (p = 0; p < n_planes; p++) {
+      if (offset[p] != GST_VIDEO_INFO_PLANE_OFFSET (&thiz->oinfo, p) ||
+          stride[p] != GST_VIDEO_INFO_PLANE_STRIDE (&thiz->oinfo, p)) {
+        GST_LOG_OBJECT (thiz, "plane %u layout doesn't match %s", p,
+            GST_VIDEO_FORMAT_INFO_NAME (ofinfo));
+        return NULL;
+      }
+    }
+  }
+
+  mem = gst_buffer_peek_memory (abuf, idx);
+
+  obuf = gst_buffer_new ();
+  gst_buffer_copy_into (obuf, ibuf, GST_BUFFER_COPY_FLAGS |
+      GST_BUFFER_COPY_TIMESTAMPS | GST_BUFFER_COPY_MEMORY, 0, -1);
+  gst_buffer_append_memory (obuf, gst_memory_ref (mem));
+  gst_buffer_add_video_meta_full (obuf, GST_VIDEO_FRAME_FLAG_NONE,
+      thiz->oformat, thiz->width, thiz->height, n_planes, offset, stride);
+
+  gst_buffer_unref (ibuf);
+
+  return obuf;
+}
+
+/* Send an ALLOCATION query downstream and configure the pool used for the
+ * output frames, reusing the downstream pool and allocator if offered */
+static gboolean
+gst_alpha_mask_decide_allocation (GstAlphaMask * thiz, GstCaps * caps)
+{
+  GstQuery *query;
+  GstBufferPool *pool = NULL;
+  GstAllocator *allocator = NULL;
+  GstAllocationParams params;
+  GstStructure *config;
+  guint size, min = 0, max = 0;
+
+  size = GST_VIDEO_INFO_SIZE (&thiz->oinfo);
+
+  query = gst_query_new_allocation (caps, TRUE);
+  if (!gst_pad_peer_query (thiz->srcpad, query))
+    GST_DEBUG_OBJECT (thiz, "peer ALLOCATION query failed");
+
+  thiz->use_video_meta = gst_query_find_allocation_meta (query,
+      GST_VIDEO_META_API_TYPE, NULL);
+
+  if (gst_query_get_n_allocation_params (query) > 0) {
+    gst_query_parse_nth_allocation_param (query, 0, &allocator, &params);
+  } else {
+    gst_allocation_params_init (&params);
+    params.align = 15;
+  }
+
+  if (gst_query_get_n_allocation_pools (query) > 0) {
+    gst_query_parse_nth_allocation_pool (query, 0, &pool, &size, &min, &max);
+    size = MAX (size, GST_VIDEO_INFO_SIZE (&thiz->oinfo));
+  }
+  gst_query_unref (query);
+
+  /* DMABuf output only carries the imported memories, nothing to allocate */
+  if (thiz->out_dmabuf) {
+    if (pool)
+      gst_object_unref (pool);
+    if (allocator)
+      gst_object_unref (allocator);
+    gst_alpha_mask_set_pool (thiz, NULL);
+    return TRUE;
+  }
+
+  if (!pool) {
+    GST_DEBUG_OBJECT (thiz, "no downstream pool, making our own");
+    pool = gst_video_buffer_pool_new ();
+  }
+
+  config = gst_buffer_pool_get_config (pool);
+  gst_buffer_pool_config_set_params (config, caps, size, min, max);
+  gst_buffer_pool_config_set_allocator (config, allocator, &params);
+  if (gst_buffer_pool_has_option (pool, GST_BUFFER_POOL_OPTION_VIDEO_META))
+    gst_buffer_pool_config_add_option (config,
+        GST_BUFFER_POOL_OPTION_VIDEO_META);
+
+  if (allocator)
+    gst_object_unref (allocator);
+
+  if (!gst_buffer_pool_set_config (pool, config)) {
+    /* the pool might have adjusted the config, check if we can live with it */
+    config = gst_buffer_pool_get_config (pool);
+    if (!gst_buffer_pool_config_validate_params (config, caps, size, min, max)) {
+      gst_structure_free (config);
+      goto config_failed;
+    }
+    if (!gst_buffer_pool_set_config (pool, config))
+      goto config_failed;
+  }
+
+  if (!gst_buffer_pool_set_active (pool, TRUE))
+    goto activate_failed;
+
+  GST_DEBUG_OBJECT (thiz, "using pool %" GST_PTR_FORMAT " size %u min %u "
+      "max %u", pool, size, min, max);
+  gst_alpha_mask_set_pool (thiz, pool);
+
+  return TRUE;
+
+  /* ERRORS */
+config_failed:
+  {
+    GST_ERROR_OBJECT (thiz, "failed to configure buffer pool");
+    gst_object_unref (pool);
+    return FALSE;
+  }
+activate_failed:
+  {
+    GST_ERROR_OBJECT (thiz, "failed to activate buffer pool");
+    gst_object_unref (pool);
+    return FALSE;
+  }
+}
+
+/* The format of the color planes in front of the alpha plane of @format */
+static GstVideoFormat
+gst_alpha_mask_color_format (GstVideoFormat format)
+{
+  switch (format) {
+    case GST_VIDEO_FORMAT_A420:
+      return GST_VIDEO_FORMAT_I420;
+    case GST_VIDEO_FORMAT_A420_10LE:
+      return GST_VIDEO_FORMAT_I420_10LE;
+    case GST_VIDEO_FORMAT_A444_10LE:
+      return GST_VIDEO_FORMAT_Y444_10LE;
+    default:
+      return GST_VIDEO_FORMAT_NV12;
+  }
+}
+
+/* converters kept around for switching back to a recent configuration */
+#define MAX_CACHED_CONVERTERS 4
+
+typedef struct
+{
+  GstVideoInfo iinfo;
+  GstVideoInfo cinfo;
+  GstStructure *config;
+  GstVideoConverter *convert;
+} GstAlphaMaskConverter;
+
+static void
+gst_alpha_mask_converter_free (GstAlphaMaskConverter * entry)
+{
+  gst_video_converter_free (entry->convert);
+  gst_structure_free (entry->config);
+  g_free (entry);
+}
+
+static void
+gst_alpha_mask_clear_converters (GstAlphaMask * thiz)
+{
+  g_list_free_full (thiz->converters,
+      (GDestroyNotify) gst_alpha_mask_converter_free);
+  thiz->converters = NULL;
+  thiz->convert = NULL;
+}
+
+/* Moves the cached converter for the current infos and @config to the front
+ * and returns it, or NULL when there is none */
+static GstVideoConverter *
+gst_alpha_mask_lookup_converter (GstAlphaMask * thiz,
+    const GstStructure * config)
+{
+  GList *l;
+
+  for (l = thiz->converters; l; l = l->next) {
+    GstAlphaMaskConverter *entry = l->data;
+
+    if (gst_video_info_is_equal (&entry->iinfo, &thiz->iinfo) &&
+        gst_video_info_is_equal (&entry->cinfo, &thiz->cinfo) &&
+        gst_structure_is_equal (entry->config, config)) {
+      thiz->converters = g_list_delete_link (thiz->converters, l);
+      thiz->converters = g_list_prepend (thiz->converters, entry);
+      return entry->convert;
+    }
+  }
+
+  return NULL;
+}
+
+/* Makes a converter for the current infos and @config the newest of the
+ * cache, dropping the least recently used one when full. Takes ownership
+ * of @config. */
+static GstVideoConverter *
+gst_alpha_mask_add_converter (GstAlphaMask * thiz, GstStructure * config)
+{
+  GstAlphaMaskConverter *entry;
+  GstVideoConverter *convert;
+  GList *last;
+
+  /* the converter takes ownership of its own copy */
+#if GST_CHECK_VERSION (1,20,0)
+  convert = gst_video_converter_new_with_pool (&thiz->iinfo, &thiz->cinfo,
+      gst_structure_copy (config),
+      gst_object_ref (gst_alpha_mask_get_convert_pool ()));
+#else
+  convert = gst_video_converter_new (&thiz->iinfo, &thiz->cinfo,
+      gst_structure_copy (config));
+#endif
+  if (!convert) {
+    gst_structure_free (config);
+    return NULL;
+  }
+
+  entry = g_new0 (GstAlphaMaskConverter, 1);
+  entry->iinfo = thiz->iinfo;
+  entry->cinfo = thiz->cinfo;
+  entry->config = config;
+  entry->convert = convert;
+  thiz->converters = g_list_prepend (thiz->converters, entry);
+
+  if (g_list_length (thiz->converters) > MAX_CACHED_CONVERTERS) {
+    last = g_list_last (thiz->converters);
+    gst_alpha_mask_converter_free (last->data);
+    thiz->converters = g_list_delete_link (thiz->converters, last);
+  }
+
+  return convert;
+}
+
+/* Picks the video converter for the current input and output video info
+ * using the converter options set through the properties, a recently used
+ * one is taken from the cache instead of being made again */
+static gboolean
+gst_alpha_mask_setup_converter (GstAlphaMask * thiz)
+{
+  GstStructure *config;
+  guint n_threads;
+
+  GST_OBJECT_LOCK (thiz);
+  n_threads = thiz->n_threads;
+  if (n_threads == 0)
+    n_threads = g_get_num_processors ();
+
+  config = gst_structure_new ("GstVideoConverterConfig",
+      GST_VIDEO_CONVERTER_OPT_DITHER_METHOD, GST_TYPE_VIDEO_DITHER_METHOD,
+      thiz->dither,
+      GST_VIDEO_CONVERTER_OPT_CHROMA_RESAMPLER_METHOD,
+      GST_TYPE_VIDEO_RESAMPLER_METHOD, thiz->chroma_resampler,
+      GST_VIDEO_CONVERTER_OPT_MATRIX_MODE, GST_TYPE_VIDEO_MATRIX_MODE,
+      thiz->matrix_mode,
+#if GST_CHECK_VERSION (1,12,0)
+      GST_VIDEO_CONVERTER_OPT_THREADS, G_TYPE_UINT, n_threads,
+#endif
+      NULL);
+  thiz->convert_dirty = FALSE;
+  GST_OBJECT_UNLOCK (thiz);
+
+  /* the alpha pass is split for as many threads as the conversion */
+  thiz->n_slices = n_threads;
+
+  GST_DEBUG_OBJECT (thiz, "converter config %" GST_PTR_FORMAT, config);
+
+  thiz->convert = gst_alpha_mask_lookup_converter (thiz, config);
+  if (thiz->convert) {
+    GST_DEBUG_OBJECT (thiz, "reusing cached converter");
+    gst_structure_free (config);
+  } else {
+    thiz->convert = gst_alpha_mask_add_converter (thiz, config);
+  }
+  if (!thiz->convert) {
+    GST_ERROR_OBJECT (thiz, "Video cannot be converted");
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Whether the converter options are those the fused kernels implement:
+ * replicated chroma, which the linear resampler fast paths do as well, no
+ * dithering needed between 8 bit formats and the full matrix */
+static gboolean
+gst_alpha_mask_fuse_options_default (GstAlphaMask * thiz)
+{
+  gboolean ret;
+
+  GST_OBJECT_LOCK (thiz);
+  ret = thiz->dither == DEFAULT_PROP_DITHER &&
+      thiz->chroma_resampler == DEFAULT_PROP_CHROMA_RESAMPLER &&
+      thiz->matrix_mode == DEFAULT_PROP_MATRIX_MODE;
+  GST_OBJECT_UNLOCK (thiz);
+
+  return ret;
+}
+
+/* Picks the single pass kernel for the current input and output, which can
+ * be used when the conversion is only a repack or, for YUV into RGB, the
+ * plain matrix the converter would apply */
+static void
+gst_alpha_mask_setup_fuse (GstAlphaMask * thiz)
+{
+  thiz->fuse = NULL;
+  if (GST_VIDEO_INFO_IS_INTERLACED (&thiz->iinfo)) {
+    /* lines of both fields would need their own chroma */
+  } else if (!gst_alpha_mask_fuse_options_default (thiz)) {
+    /* only the converter knows the other options */
+  } else if (gst_video_colorimetry_is_equal (&thiz->iinfo.colorimetry,
+          &thiz->oinfo.colorimetry)) {
+    thiz->fuse = gst_alpha_mask_get_fuse_line (thiz->iformat, thiz->oformat);
+  } else if (GST_VIDEO_INFO_IS_YUV (&thiz->iinfo) &&
+      GST_VIDEO_INFO_IS_RGB (&thiz->oinfo) &&
+      gst_alpha_mask_yuv_matrix_init (&thiz->fuse_matrix, &thiz->iinfo)) {
+    thiz->fuse = gst_alpha_mask_get_fuse_line (thiz->iformat, thiz->oformat);
+  }
+
+  GST_DEBUG_OBJECT (thiz, "fused convert and alpha path %s",
+      thiz->fuse ? "enabled" : "disabled");
+}
+
+/* Estimated per-frame cost of producing @format out of the current input,
+ * lower is cheaper */
+static guint
+gst_alpha_mask_format_cost (GstAlphaMask * thiz, GstVideoFormat format)
+{
+  const GstVideoFormatInfo *ifinfo = thiz->iinfo.finfo;
+  const GstVideoFormatInfo *ofinfo = gst_video_format_get_info (format);
+  gboolean same_size, mask_plane;
+  guint idepth, odepth, cost;
+
+  /* the alpha caps may not be known yet, assume the best */
+  same_size = !gst_alpha_mask_has_alpha_info (thiz) ||
+      (GST_VIDEO_INFO_WIDTH (&thiz->ainfo) == thiz->width &&
+      GST_VIDEO_INFO_HEIGHT (&thiz->ainfo) == thiz->height);
+  mask_plane = !gst_alpha_mask_has_alpha_info (thiz) ||
+      gst_alpha_mask_mask_is_alpha_plane (thiz, format);
+
+  /* color planes reused as they are, next to the raw mask plane */
+  if (same_size && mask_plane &&
+      thiz->alpha_encoding == GST_ALPHA_MASK_ENCODING_RAW &&
+      gst_alpha_mask_can_append_alpha (thiz->iformat, format))
+    return 0;
+
+  /* alpha written in place */
+  if (format == thiz->iformat)
+    return 0;
+
+  /* single pass repack, or matrix for YUV into RGB */
+  if (gst_alpha_mask_get_fuse_line (thiz->iformat, format) &&
+      gst_alpha_mask_fuse_options_default (thiz))
+    return 1;
+
+  /* converter pass, then one byte per pixel for planar alpha or a strided
+   * walk over the whole frame for packed alpha */
+  cost = GST_VIDEO_FORMAT_INFO_N_PLANES (ofinfo) > 1 ? 2 : 4;
+  if (GST_VIDEO_FORMAT_INFO_IS_YUV (ifinfo) !=
+      GST_VIDEO_FORMAT_INFO_IS_YUV (ofinfo))
+    cost += 2;
+  else if (GST_VIDEO_FORMAT_INFO_W_SUB (ifinfo, 1) !=
+      GST_VIDEO_FORMAT_INFO_W_SUB (ofinfo, 1) ||
+      GST_VIDEO_FORMAT_INFO_H_SUB (ifinfo, 1) !=
+      GST_VIDEO_FORMAT_INFO_H_SUB (ofinfo, 1))
+    cost += 1;
+
+  /* dropping bits of the input is worse than any extra pass, carrying more
+   * than it has only costs bandwidth */
+  idepth = GST_VIDEO_FORMAT_INFO_DEPTH (ifinfo, 0);
+  odepth = GST_VIDEO_FORMAT_INFO_DEPTH (ofinfo, 0);
+  if (odepth < idepth)
+    cost += 8;
+  else if (odepth > idepth)
+    cost += 1;
+
+  return cost;
+}
+
+static gboolean
+gst_alpha_mask_caps_is_dmabuf (const GstCaps * caps, guint idx)
+{
+  GstCapsFeatures *features = gst_caps_get_features (caps, idx);
+
+  return features && gst_caps_features_contains (features,
+      GST_CAPS_FEATURE_MEMORY_DMABUF);
+}
+
+/* Whether @format can be output as DMABuf, i.e. both inputs are DMABuf and
+ * their planes can be put together as they are */
+static gboolean
+gst_alpha_mask_can_output_dmabuf (GstAlphaMask * thiz, GstVideoFormat format)
+{
+  if (!thiz->video_dmabuf || !thiz->alpha_dmabuf || thiz->dmabuf_disabled ||
+      !gst_alpha_mask_has_alpha_info (thiz))
+    return FALSE;
+
+  /* frames without a mask have no alpha plane to import */
+  if (!g_atomic_int_get (&thiz->alpha_linked) ||
+      g_atomic_int_get (&thiz->alpha_mode) == GST_ALPHA_MASK_MODE_CONSTANT)
+    return FALSE;
+
+  if (GST_VIDEO_INFO_WIDTH (&thiz->ainfo) != thiz->width ||
+      GST_VIDEO_INFO_HEIGHT (&thiz->ainfo) != thiz->height ||
+      !gst_alpha_mask_mask_is_alpha_plane (thiz, format))
+    return FALSE;
+
+  return gst_alpha_mask_can_append_alpha (thiz->iformat, format);
+}
+
+/* Picks the cheapest format in @caps, @preferred wins whenever it's there.
+ * Ties go to DMABuf output and then to the format that comes first. */
+static GstVideoFormat
+gst_alpha_mask_pick_format (GstAlphaMask * thiz, GstCaps * caps,
+    GstVideoFormat preferred, gboolean * dmabuf)
+{
+  GstVideoFormat best = GST_VIDEO_FORMAT_UNKNOWN;
+  guint best_cost = G_MAXUINT;
+  gboolean best_dmabuf = FALSE;
+  guint i, j, n;
+
+  for (i = 0; i < gst_caps_get_size (caps); i++) {
+    const GValue *formats;
+    gboolean is_dmabuf;
+
+    formats = gst_structure_get_value (gst_caps_get_structure (caps, i),
+        "format");
+    if (!formats)
+      continue;
+
+    is_dmabuf = gst_alpha_mask_caps_is_dmabuf (caps, i);
+
+    n = GST_VALUE_HOLDS_LIST (formats) ? gst_value_list_get_size (formats) : 1;
+    for (j = 0; j < n; j++) {
+      const GValue *v;
+      GstVideoFormat format;
+      guint cost;
+
+      v = GST_VALUE_HOLDS_LIST (formats) ?
+          gst_value_list_get_value (formats, j) : formats;
+      if (!G_VALUE_HOLDS_STRING (v))
+        continue;
+
+      format = gst_video_format_from_string (g_value_get_string (v));
+      if (format == GST_VIDEO_FORMAT_UNKNOWN)
+        continue;
+
+      if (is_dmabuf && !gst_alpha_mask_can_output_dmabuf (thiz, format))
+        continue;
+
+      if (format == preferred) {
+        GST_DEBUG_OBJECT (thiz, "using preferred format %s",
+            gst_video_format_to_string (format));
+        *dmabuf = is_dmabuf;
+        return format;
+      }
+
+      cost = gst_alpha_mask_format_cost (thiz, format);
+      GST_LOG_OBJECT (thiz, "format %s%s costs %u",
+          gst_video_format_to_string (format), is_dmabuf ? " (DMABuf)" : "",
+          cost);
+      if (cost < best_cost || (cost == best_cost && is_dmabuf &&
+              !best_dmabuf)) {
+        best = format;
+        best_cost = cost;
+        best_dmabuf = is_dmabuf;
+      }
+    }
+  }
+
+  *dmabuf = best_dmabuf;
+
+  return best;
+}
+
+static gboolean
+gst_alpha_mask_negotiate (GstAlphaMask * thiz, GstCaps * caps)
+{
+  GstCaps *output_caps = NULL;
+  GstCaps *template_caps;
+  GstCaps *allowed_caps = NULL;
+  GstVideoFormat format = DEFAULT_FORMAT;
+  GstVideoFormat preferred;
+  GstVideoInfo info;
+  gboolean premultiply;
+  gboolean dmabuf = FALSE;
+  gboolean ret;
+
+  GST_DEBUG_OBJECT (thiz, "performing negotiation");
+
+  /* Clear any pending reconfigure to avoid negotiating twice */
+  gst_pad_check_reconfigure (thiz->srcpad);
+
+  if (!caps || gst_caps_is_empty (caps))
+    return FALSE;
+
+  GST_OBJECT_LOCK (thiz);
+  preferred = thiz->preferred_format;
+  premultiply = thiz->premultiply;
+  GST_OBJECT_UNLOCK (thiz);
+
+  template_caps = gst_static_pad_template_get_caps (&src_factory);
+  allowed_caps = gst_pad_get_allowed_caps (thiz->srcpad);
+
+  /* If downstream has ANY caps pick from everything we can output */
+  if (allowed_caps == template_caps) {
+    GST_INFO_OBJECT (thiz, "downstream has ANY caps");
+    format = gst_alpha_mask_pick_format (thiz, template_caps, preferred,
+        &dmabuf);
+  } else if (allowed_caps) {
+    if (gst_caps_is_empty (allowed_caps)) {
+      gst_caps_unref (allowed_caps);
+      gst_caps_unref (template_caps);
+      return FALSE;
+    }
+
+    format = gst_alpha_mask_pick_format (thiz, allowed_caps, preferred,
+        &dmabuf);
+    if (format == GST_VIDEO_FORMAT_UNKNOWN) {
+      allowed_caps = gst_caps_make_writable (allowed_caps);
+      allowed_caps = gst_caps_fixate (allowed_caps);
+      gst_video_info_from_caps (&info, allowed_caps);
+      format = GST_VIDEO_INFO_FORMAT (&info);
+    }
+  }
+  if (format == GST_VIDEO_FORMAT_UNKNOWN)
+    format = DEFAULT_FORMAT;
+  gst_caps_unref (allowed_caps);
+  gst_caps_unref (template_caps);
+
+  gst_video_info_set_format (&info, format, thiz->width, thiz->height);
+  info.par_n = thiz->iinfo.par_n;
+  info.par_d = thiz->iinfo.par_d;
+  info.fps_n = thiz->iinfo.fps_n;
+  info.fps_d = thiz->iinfo.fps_d;
+
+  /* only the packed RGB outputs get premultiplied, YUV alpha stays
+   * straight */
+  thiz->premultiplied = premultiply && GST_VIDEO_INFO_IS_RGB (&info);
+  if (thiz->premultiplied)
+    GST_VIDEO_INFO_FLAGS (&info) |= GST_VIDEO_FLAG_PREMULTIPLIED_ALPHA;
+  else if (premultiply)
+    GST_DEBUG_OBJECT (thiz, "%s output can't be premultiplied",
+        gst_video_format_to_string (format));
+
+  /* keep the input colorimetry when staying in the same color family, there
+   * is no point in doing a matrix conversion nobody asked for */
+  if (GST_VIDEO_INFO_IS_YUV (&thiz->iinfo) && GST_VIDEO_INFO_IS_YUV (&info)) {
+    info.colorimetry = thiz->iinfo.colorimetry;
+    if (GST_VIDEO_FORMAT_INFO_W_SUB (thiz->iinfo.finfo, 1) ==
+        GST_VIDEO_FORMAT_INFO_W_SUB (info.finfo, 1) &&
+        GST_VIDEO_FORMAT_INFO_H_SUB (thiz->iinfo.finfo, 1) ==
+        GST_VIDEO_FORMAT_INFO_H_SUB (info.finfo, 1))
+      info.chroma_site = thiz->iinfo.chroma_site;
+  } else if (GST_VIDEO_INFO_IS_RGB (&thiz->iinfo) &&
+      GST_VIDEO_INFO_IS_RGB (&info)) {
+    info.colorimetry = thiz->iinfo.colorimetry;
+  }
+
+  GST_DEBUG_OBJECT (thiz, "Converting video from %d to %d",
+      GST_VIDEO_INFO_FORMAT (&thiz->iinfo), GST_VIDEO_INFO_FORMAT (&info));
+
+  thiz->oinfo = info;
+  thiz->oformat = format;
+  thiz->out_dmabuf = dmabuf;
+  thiz->analysis_valid = FALSE;
+
+  thiz->cinfo = info;
+  if (HAS_ALPHA_PLANE (&info)) {
+    /* the alpha plane is ours, convert into the color planes only */
+    thiz->cinfo.finfo =
+        gst_video_format_get_info (gst_alpha_mask_color_format (format));
+    GST_VIDEO_INFO_SIZE (&thiz->cinfo) =
+        GST_VIDEO_INFO_PLANE_OFFSET (&info, ALPHA_PLANE (&info));
+  }
+
+  if (!gst_alpha_mask_setup_converter (thiz))
+    return FALSE;
+
+  gst_alpha_mask_setup_fuse (thiz);
+
+  /* same format and colorimetry, writable input only needs its alpha */
+  thiz->in_place = format == thiz->iformat && !dmabuf && !thiz->packed &&
+      gst_video_colorimetry_is_equal (&thiz->iinfo.colorimetry,
+      &info.colorimetry);
+
+  GST_DEBUG_OBJECT (thiz, "in place alpha path %s",
+      thiz->in_place ? "enabled" : "disabled");
+
+  output_caps = gst_video_info_to_caps (&info);
+  /* raw video caps have no standard field for it */
+  if (thiz->premultiplied)
+    gst_caps_set_simple (output_caps, "premultiplied-alpha", G_TYPE_BOOLEAN,
+        TRUE, NULL);
+  if (dmabuf)
+    gst_caps_set_features (output_caps, 0,
+        gst_caps_features_new (GST_CAPS_FEATURE_MEMORY_DMABUF, NULL));
+
+  GST_DEBUG_OBJECT (thiz, "output video caps %" GST_PTR_FORMAT, output_caps);
+  ret = gst_pad_set_caps (thiz->srcpad, output_caps);
+  if (ret)
+    ret = gst_alpha_mask_decide_allocation (thiz, output_caps);
+  if (ret)
+    gst_alpha_mask_setup_color_pool (thiz);
+
+  if (!ret) {
+    GST_DEBUG_OBJECT (thiz, "negotiation failed, schedule reconfigure");
+    gst_pad_mark_reconfigure (thiz->srcpad);
+  }
+
+  gst_caps_unref (output_caps);
+
+  return ret;
+}
+
+static inline void
+gst_alpha_mask_timing_add (GstAlphaMaskTiming * timing, GstClockTime time)
+{
+  timing->count++;
+  timing->total += time;
+  if (time > timing->max)
+    timing->max = time;
+}
+
+static void
+gst_alpha_mask_timing_merge (GstAlphaMaskTiming * timing,
+    const GstAlphaMaskTiming * other)
+{
+  timing->count += other->count;
+  timing->total += other->total;
+  if (other->max > timing->max)
+    timing->max = other->max;
+}
+
+#define TIMING_AVERAGE(t) ((t)->count ? (t)->total / (t)->count : 0)
+
+/* Called with the object lock held */
+static GstStructure *
+gst_alpha_mask_get_stats (GstAlphaMask * thiz)
+{
+  const GstAlphaMaskStats *stats = &thiz->stats;
+
+  return gst_structure_new ("application/x-alphamask-stats",
+      "frames-in", G_TYPE_UINT64, stats->frames_in,
+      "frames-out", G_TYPE_UINT64, stats->frames_out,
+      "frames-dropped", G_TYPE_UINT64, stats->frames_dropped,
+      "alpha-too-old", G_TYPE_UINT64, stats->alpha_too_old,
+      "alpha-in-future", G_TYPE_UINT64, stats->alpha_in_future,
+      "alpha-late", G_TYPE_UINT64, stats->alpha_late,
+      "video-wait-count", G_TYPE_UINT64, stats->video_wait.count,
+      "video-wait-average", G_TYPE_UINT64, TIMING_AVERAGE (&stats->video_wait),
+      "video-wait-max", G_TYPE_UINT64, stats->video_wait.max,
+      "alpha-wait-count", G_TYPE_UINT64, stats->alpha_wait.count,
+      "alpha-wait-average", G_TYPE_UINT64, TIMING_AVERAGE (&stats->alpha_wait),
+      "alpha-wait-max", G_TYPE_UINT64, stats->alpha_wait.max,
+      "convert-average", G_TYPE_UINT64, TIMING_AVERAGE (&stats->convert),
+      "convert-max", G_TYPE_UINT64, stats->convert.max, NULL);
+}
+
+/* Folds the stats of the frame the video chain just handled into the totals
+ * and posts them in an element message once the stats interval elapsed */
+static void
+gst_alpha_mask_commit_stats (GstAlphaMask * thiz)
+{
+  GstAlphaMaskStats *fstats = &thiz->frame_stats;
+  GstStructure *structure = NULL;
+
+  GST_OBJECT_LOCK (thiz);
+  thiz->stats.frames_in += fstats->frames_in;
+  thiz->stats.frames_out += fstats->frames_out;
+  thiz->stats.frames_dropped += fstats->frames_dropped;
+  thiz->stats.alpha_too_old += fstats->alpha_too_old;
+  thiz->stats.alpha_in_future += fstats->alpha_in_future;
+  thiz->stats.alpha_late += fstats->alpha_late;
+  gst_alpha_mask_timing_merge (&thiz->stats.video_wait, &fstats->video_wait);
+  gst_alpha_mask_timing_merge (&thiz->stats.convert, &fstats->convert);
+
+  if (thiz->stats_interval) {
+    GstClockTime now = gst_util_get_timestamp ();
+
+    if (!GST_CLOCK_TIME_IS_VALID (thiz->stats_posted)) {
+      thiz->stats_posted = now;
+    } else if (now - thiz->stats_posted >=
+        thiz->stats_interval * GST_MSECOND) {
+      structure = gst_alpha_mask_get_stats (thiz);
+      thiz->stats_posted = now;
+    }
+  }
+  GST_OBJECT_UNLOCK (thiz);
+
+  memset (fstats, 0, sizeof (GstAlphaMaskStats));
+
+  if (structure)
+    gst_element_post_message (GST_ELEMENT_CAST (thiz),
+        gst_message_new_element (GST_OBJECT_CAST (thiz), structure));
+}
+
+/* Called with the object lock held */
+static void
+gst_alpha_mask_reset_qos (GstAlphaMask * thiz)
+{
+  thiz->proportion = 1.0;
+  thiz->earliest_time = GST_CLOCK_TIME_NONE;
+}
+
+static void
+gst_alpha_mask_update_qos (GstAlphaMask * thiz, gdouble proportion,
+    GstClockTimeDiff diff, GstClockTime timestamp)
+{
+  GST_CAT_DEBUG_OBJECT (GST_CAT_QOS, thiz,
+      "qos: proportion: %lf, diff %" G_GINT64_FORMAT ", timestamp %"
+      GST_TIME_FORMAT, proportion, diff, GST_TIME_ARGS (timestamp));
+
+  GST_OBJECT_LOCK (thiz);
+  thiz->proportion = proportion;
+  if (G_LIKELY (GST_CLOCK_TIME_IS_VALID (timestamp))) {
+    /* when late, skip ahead by twice the lateness and a frame like the
+     * video decoders and aggregators do, so that dropping catches up with
+     * sustained lateness instead of trailing it */
+    if (G_UNLIKELY (diff > 0)) {
+      GstClockTime frame = 0;
+
+      if (thiz->iinfo.fps_n > 0)
+        frame = gst_util_uint64_scale_int_round (GST_SECOND,
+            thiz->iinfo.fps_d, thiz->iinfo.fps_n);
+      thiz->earliest_time = timestamp + 2 * diff + frame;
+    } else {
+      thiz->earliest_time = timestamp + diff;
+    }
+  } else {
+    thiz->earliest_time = GST_CLOCK_TIME_NONE;
+  }
+  GST_OBJECT_UNLOCK (thiz);
+}
+
+/* Checks @buffer against the latest QoS information from downstream, frames
+ * that would arrive late are not worth converting. Posts a QoS message for
+ * every dropped frame, like GstBaseTransform does. */
+static gboolean
+gst_alpha_mask_is_late (GstAlphaMask * thiz, GstBuffer * buffer)
+{
+  GstClockTime running_time, earliest_time;
+  guint64 processed, dropped;
+  gdouble proportion;
+  gboolean late;
+
+  if (!g_atomic_int_get (&thiz->qos))
+    return FALSE;
+
+  running_time = gst_segment_to_running_time (&thiz->segment, GST_FORMAT_TIME,
+      GST_BUFFER_TIMESTAMP (buffer));
+
+  GST_OBJECT_LOCK (thiz);
+  earliest_time = thiz->earliest_time;
+  proportion = thiz->proportion;
+  late = GST_CLOCK_TIME_IS_VALID (running_time) &&
+      GST_CLOCK_TIME_IS_VALID (earliest_time) && running_time <= earliest_time;
+  if (late)
+    thiz->dropped++;
+  else
+    thiz->processed++;
+  processed = thiz->processed;
+  dropped = thiz->dropped;
+  GST_OBJECT_UNLOCK (thiz);
+
+  if (late) {
+    GstMessage *qos_msg;
+    GstClockTime stream_time;
+
+    GST_CAT_DEBUG_OBJECT (GST_CAT_QOS, thiz, "skipping late frame %"
+        GST_TIME_FORMAT " <= %" GST_TIME_FORMAT, GST_TIME_ARGS (running_time),
+        GST_TIME_ARGS (earliest_time));
+
+    stream_time = gst_segment_to_stream_time (&thiz->segment, GST_FORMAT_TIME,
+        GST_BUFFER_TIMESTAMP (buffer));
+
+    qos_msg = gst_message_new_qos (GST_OBJECT_CAST (thiz), FALSE,
+        running_time, stream_time, GST_BUFFER_TIMESTAMP (buffer),
+        GST_BUFFER_DURATION (buffer));
+    gst_message_set_qos_values (qos_msg,
+        GST_CLOCK_DIFF (running_time, earliest_time), proportion, 1000000);
+    gst_message_set_qos_stats (qos_msg, GST_FORMAT_BUFFERS, processed,
+        dropped);
+    gst_element_post_message (GST_ELEMENT_CAST (thiz), qos_msg);
+  }
+
+  return late;
+}
+
+/* Switches DMABuf output over to system memory, for a frame whose planes
+ * can't be imported as they are. Returns FALSE if that can't be
+ * negotiated. */
+static gboolean
+gst_alpha_mask_leave_dmabuf (GstAlphaMask * thiz)
+{
+  GstCaps *caps;
+  gboolean ret = FALSE;
+
+  GST_WARNING_OBJECT (thiz, "%s, renegotiating to system memory",
+      thiz->alpha_buffer ? "planes can't be passed on" : "no mask to pass on");
+
+  thiz->dmabuf_disabled = TRUE;
+  caps = gst_pad_get_current_caps (thiz->video_sinkpad);
+  if (caps) {
+    ret = gst_alpha_mask_negotiate (thiz, caps);
+    gst_caps_unref (caps);
+  }
+
+  return ret && !thiz->out_dmabuf;
+}
+
+/* Default process vfunc, combines @ibuffer with the current alpha buffer in
+ * system memory */
+static GstFlowReturn
+gst_alpha_mask_process_default (GstAlphaMask * thiz, GstBuffer * ibuffer,
+    GstBuffer ** output)
+{
+  GstBuffer *obuffer = NULL;
+  gboolean analyze, skip;
+
+  *output = NULL;
+
+  /* pick up converter and thread options changed while streaming */
+  if (G_UNLIKELY (thiz->convert_dirty)) {
+    if (!gst_alpha_mask_setup_converter (thiz))
+      goto no_converter;
+    gst_alpha_mask_setup_fuse (thiz);
+  }
+
+  analyze = g_atomic_int_get (&thiz->analyze_alpha);
+  skip = g_atomic_int_get (&thiz->skip_transparent);
+  if ((analyze || skip) && thiz->alpha_buffer)
+    gst_alpha_mask_analyze_alpha (thiz);
+  thiz->skip_clear = skip && thiz->alpha_buffer;
+
+  /* no conversion needed, only the alpha gets written */
+  if (thiz->in_place && gst_buffer_is_writable (ibuffer))
+    obuffer = gst_alpha_mask_fill_in_place (thiz, ibuffer);
+
+  if (!obuffer && HAS_ALPHA_PLANE (&thiz->oinfo)) {
+    if (gst_alpha_mask_can_append_alpha (thiz->iformat, thiz->oformat))
+      obuffer = gst_alpha_mask_append_alpha (thiz, ibuffer);
+    /* nothing but the imported planes can go out as DMABuf */
+    if (!obuffer && thiz->out_dmabuf && !gst_alpha_mask_leave_dmabuf (thiz))
+      goto no_dmabuf;
+    /* packed masks change with every frame, and their memory is the
+     * video's */
+    if (!obuffer && thiz->color_pool && thiz->alpha_buffer && !thiz->packed)
+      obuffer = gst_alpha_mask_convert_cached (thiz, ibuffer);
+  }
+  if (!obuffer)
+    obuffer = gst_alpha_mask_convert (thiz, ibuffer);
+
+  if (obuffer && analyze && thiz->alpha_buffer) {
+    obuffer = gst_buffer_make_writable (obuffer);
+    gst_alpha_mask_attach_regions (thiz, obuffer);
+  }
+
+  *output = obuffer;
+  return GST_FLOW_OK;
+
+  /* ERRORS */
+no_converter:
+  {
+    GST_ERROR_OBJECT (thiz, "could not set up the converter");
+    gst_buffer_unref (ibuffer);
+    return GST_FLOW_NOT_NEGOTIATED;
+  }
+no_dmabuf:
+  {
+    GST_ERROR_OBJECT (thiz, "could not renegotiate to system memory");
+    gst_buffer_unref (ibuffer);
+    return GST_FLOW_NOT_NEGOTIATED;
+  }
+}
+
+/* Records when the frame in @obuffer reached the video chain, when its mask
+ * reached the alpha chain and when it was @done, for tracers and, with the
+ * stage-meta property, as reference timestamp metas on @obuffer. The times
+ * are those of gst_util_get_timestamp(). Frames sent with a held mask or
+ * none have no alpha stage. */
+static GstBuffer *
+gst_alpha_mask_stamp_stages (GstAlphaMask * thiz, GstBuffer * obuffer,
+    GstClockTime done)
+{
+#if GST_CHECK_VERSION (1,14,0)
+  if (g_atomic_int_get (&thiz->stage_meta)) {
+    obuffer = gst_buffer_make_writable (obuffer);
+    gst_buffer_add_reference_timestamp_meta (obuffer,
+        stage_caps[STAGE_VIDEO_IN], thiz->video_arrival, GST_CLOCK_TIME_NONE);
+    if (GST_CLOCK_TIME_IS_VALID (thiz->alpha_arrival))
+      gst_buffer_add_reference_timestamp_meta (obuffer,
+          stage_caps[STAGE_ALPHA_IN], thiz->alpha_arrival,
+          GST_CLOCK_TIME_NONE);
+    gst_buffer_add_reference_timestamp_meta (obuffer, stage_caps[STAGE_DONE],
+        done, GST_CLOCK_TIME_NONE);
+  }
+#endif
+
+#if GST_CHECK_VERSION (1,8,0)
+  /* only formats anything when GST_TRACER is at trace level */
+  gst_tracer_record_log (stage_record, GST_OBJECT_NAME (thiz),
+      (guint64) thiz->video_arrival, (guint64) thiz->alpha_arrival,
+      (guint64) done);
+#endif
+
+  return obuffer;
+}
+
+/* Pushes @obuffer downstream, it only counts as output if downstream took
+ * it */
+static GstFlowReturn
+gst_alpha_mask_push_output (GstAlphaMask * thiz, GstBuffer * obuffer)
+{
+  GstFlowReturn ret;
+
+  ret = gst_pad_push (thiz->srcpad, obuffer);
+  if (ret == GST_FLOW_OK)
+    thiz->frame_stats.frames_out++;
+  else
+    thiz->frame_stats.frames_dropped++;
+
+  return ret;
+}
+
+static GstFlowReturn
+gst_alpha_mask_push_frame (GstAlphaMask * thiz, GstBuffer * ibuffer)
+{
+  GstAlphaMaskClass *klass = GST_ALPHA_MASK_GET_CLASS (thiz);
+  GstBuffer *obuffer = NULL;
+  GstFlowReturn ret = GST_FLOW_OK;
+  GstClockTime start, done;
+
+  /* downstream asked us to renegotiate, e.g. to switch buffer pools */
+  if (gst_pad_check_reconfigure (thiz->srcpad)) {
+    GstCaps *caps = gst_pad_get_current_caps (thiz->video_sinkpad);
+    gboolean negotiated = FALSE;
+
+    if (caps) {
+      negotiated = klass->negotiate (thiz, caps);
+      gst_caps_unref (caps);
+    }
+
+    if (!negotiated) {
+      thiz->frame_stats.frames_dropped++;
+      gst_buffer_unref (ibuffer);
+      return GST_FLOW_NOT_NEGOTIATED;
+    }
+  }
+
+  /* drop it before doing any work, the alpha is released as usual */
+  if (gst_alpha_mask_is_late (thiz, ibuffer)) {
+    thiz->frame_stats.frames_dropped++;
+    gst_buffer_unref (ibuffer);
+    return GST_FLOW_OK;
+  }
+
+  /* subclasses apply it too */
+  thiz->fill_alpha = -1;
+  if (!thiz->alpha_buffer &&
+      g_atomic_int_get (&thiz->alpha_mode) == GST_ALPHA_MASK_MODE_CONSTANT)
+    thiz->fill_alpha = g_atomic_int_get (&thiz->alpha_value);
+
+  start = gst_util_get_timestamp ();
+
+  ret = klass->process (thiz, ibuffer, &obuffer);
+
+  done = gst_util_get_timestamp ();
+  gst_alpha_mask_timing_add (&thiz->frame_stats.convert, done - start);
+
+  if (ret != GST_FLOW_OK || !obuffer) {
+    GST_DEBUG_OBJECT (thiz, "frame dropped by process: %s",
+        gst_flow_get_name (ret));
+    thiz->frame_stats.frames_dropped++;
+    return ret;
+  }
+
+  obuffer = gst_alpha_mask_stamp_stages (thiz, obuffer, done);
+
+  return gst_alpha_mask_push_output (thiz, obuffer);
+}
+
+/* Pushes @ibuffer with @abuf, which may be NULL, as its mask instead of the
+ * alpha buffer in use */
+static GstFlowReturn
+gst_alpha_mask_push_frame_with (GstAlphaMask * thiz, GstBuffer * ibuffer,
+    GstBuffer * abuf)
+{
+  GstBuffer *current = thiz->alpha_buffer;
+  GstClockTime arrival = thiz->alpha_arrival;
+  GstFlowReturn ret;
+
+  thiz->alpha_buffer = abuf ? gst_buffer_ref (abuf) : NULL;
+  thiz->alpha_arrival = GST_CLOCK_TIME_NONE;
+  thiz->analysis_valid = FALSE;
+
+  ret = gst_alpha_mask_push_frame (thiz, ibuffer);
+
+  if (thiz->alpha_buffer)
+    gst_buffer_unref (thiz->alpha_buffer);
+  thiz->alpha_buffer = current;
+  thiz->alpha_arrival = arrival;
+  thiz->analysis_valid = FALSE;
+
+  return ret;
+}
+
+static inline gboolean
+gst_alpha_mask_queue_is_empty (GstAlphaMask * thiz)
+{
+  return g_atomic_int_get (&thiz->alpha_head) ==
+      g_atomic_int_get (&thiz->alpha_tail);
+}
+
+static inline gboolean
+gst_alpha_mask_queue_is_full (GstAlphaMask * thiz)
+{
+  return (guint) (g_atomic_int_get (&thiz->alpha_tail) -
+      g_atomic_int_get (&thiz->alpha_head)) == thiz->alpha_queue_len;
+}
+
+/* Producer side, only called from the alpha streaming thread. Returns FALSE
+ * when the queue is full. */
+static gboolean
+gst_alpha_mask_queue_push (GstAlphaMask * thiz, const GstAlphaMaskEntry * entry)
+{
+  guint tail;
+
+  if (gst_alpha_mask_queue_is_full (thiz))
+    return FALSE;
+
+  tail = g_atomic_int_get (&thiz->alpha_tail);
+  thiz->alpha_queue[tail % thiz->alpha_queue_len] = *entry;
+
+  /* publish the entry, this is a full barrier */
+  g_atomic_int_inc (&thiz->alpha_tail);
+
+  /* in case the video chain is waiting for a alpha buffer, wake it up */
+  if (g_atomic_int_get (&thiz->video_waiting)) {
+    GST_ALPHA_MASK_LOCK (thiz);
+    GST_ALPHA_MASK_BROADCAST (thiz);
+    GST_ALPHA_MASK_UNLOCK (thiz);
+  }
+
+  return TRUE;
+}
+
+/* Takes the oldest entry out of the queue. This is normally done by the
+ * video chain, but a flush on the alpha side drains the queue too, so
+ * whoever moves the head owns the entry. Must be called without the lock. */
+static gboolean
+gst_alpha_mask_queue_pop (GstAlphaMask * thiz, GstAlphaMaskEntry * entry)
+{
+  gint head;
+
+  do {
+    head = g_atomic_int_get (&thiz->alpha_head);
+    if (head == g_atomic_int_get (&thiz->alpha_tail))
+      return FALSE;
+    *entry = thiz->alpha_queue[(guint) head % thiz->alpha_queue_len];
+  } while (!g_atomic_int_compare_and_exchange (&thiz->alpha_head, head,
+          head + 1));
+
+  /* Let the alpha chain know there is room again */
+  if (g_atomic_int_get (&thiz->alpha_waiting)) {
+    GST_ALPHA_MASK_LOCK (thiz);
+    GST_ALPHA_MASK_BROADCAST (thiz);
+    GST_ALPHA_MASK_UNLOCK (thiz);
+  }
+
+  return TRUE;
+}
+
+/* Video thread only, releases the alpha buffer in use */
+static void
+gst_alpha_mask_pop_alpha (GstAlphaMask * thiz)
+{
+  g_return_if_fail (GST_IS_ALPHA_MASK (thiz));
+
+  if (thiz->alpha_buffer) {
+    GST_DEBUG_OBJECT (thiz, "releasing alpha buffer %p", thiz->alpha_buffer);
+    if ((g_atomic_int_get (&thiz->live) ||
+            g_atomic_int_get (&thiz->alpha_mode) ==
+            GST_ALPHA_MASK_MODE_HOLD_LAST) && !thiz->packed)
+      gst_buffer_replace (&thiz->alpha_last, thiz->alpha_buffer);
+    gst_buffer_unref (thiz->alpha_buffer);
+    thiz->alpha_buffer = NULL;
+  }
+  thiz->alpha_arrival = GST_CLOCK_TIME_NONE;
+  thiz->analysis_valid = FALSE;
+}
+
+/* Video thread only, makes the oldest queued alpha buffer the one in use
+ * unless there is one already. Returns FALSE if there is none. */
+static gboolean
+gst_alpha_mask_get_alpha (GstAlphaMask * thiz)
+{
+  GstAlphaMaskEntry entry;
+  gint seq;
+
+  /* the alpha side flushed, the buffer we hold belongs to the old data */
+  seq = g_atomic_int_get (&thiz->alpha_flush_seq);
+  if (G_UNLIKELY (seq != thiz->alpha_seen_seq)) {
+    thiz->alpha_seen_seq = seq;
+    thiz->alpha_last_running_time = GST_CLOCK_TIME_NONE;
+    gst_alpha_mask_pop_alpha (thiz);
+    gst_buffer_replace (&thiz->alpha_last, NULL);
+  }
+
+  if (thiz->alpha_buffer)
+    return TRUE;
+
+  if (!gst_alpha_mask_queue_pop (thiz, &entry))
+    return FALSE;
+
+  thiz->alpha_buffer = entry.buffer;
+  thiz->alpha_running_time = entry.running_time;
+  thiz->alpha_running_time_end = entry.running_time_end;
+  thiz->alpha_arrival = entry.arrival;
+  if (GST_CLOCK_TIME_IS_VALID (entry.running_time))
+    thiz->alpha_last_running_time = entry.running_time;
+
+  return TRUE;
+}
+
+/* Drops all queued alpha buffers. Must be called without the lock. */
+static void
+gst_alpha_mask_flush_alpha (GstAlphaMask * thiz)
+{
+  GstAlphaMaskEntry entry;
+
+  g_atomic_int_inc (&thiz->alpha_flush_seq);
+  while (gst_alpha_mask_queue_pop (thiz, &entry))
+    gst_buffer_unref (entry.buffer);
+}
 
-  GST_DEBUG_OBJECT (thiz, "output video caps %" GST_PTR_FORMAT, output_caps);
-  ret = gst_pad_set_caps (thiz->srcpad, output_caps);
-  if (!ret) {
-    GST_DEBUG_OBJECT (thiz, "negotiation failed, schedule reconfigure");
-    gst_pad_mark_reconfigure (thiz->srcpad);
+/* Monotonic time until which the mask of a frame starting at @running_time
+ * is waited for, or -1 to wait as long as it takes. Only live pipelines
+ * have a deadline: the time the frame is due downstream, which includes the
+ * upstream latency and the latency property. */
+static gint64
+gst_alpha_mask_get_wait_end (GstAlphaMask * thiz, GstClockTime running_time)
+{
+  GstClock *clock;
+  GstClockTime deadline, now;
+  gint64 end;
+
+  if (!GST_CLOCK_TIME_IS_VALID (running_time))
+    return -1;
+
+  GST_OBJECT_LOCK (thiz);
+  clock = GST_ELEMENT_CLOCK (thiz);
+  if (!thiz->live || !clock) {
+    GST_OBJECT_UNLOCK (thiz);
+    return -1;
   }
+  gst_object_ref (clock);
+  deadline = GST_ELEMENT_CAST (thiz)->base_time + running_time +
+      thiz->upstream_latency + thiz->latency;
+  GST_OBJECT_UNLOCK (thiz);
 
-  gst_caps_unref (output_caps);
+  now = gst_clock_get_time (clock);
+  gst_object_unref (clock);
 
-  return ret;
+  end = g_get_monotonic_time ();
+  if (deadline > now)
+    end += (deadline - now) / GST_USECOND;
+
+  return end;
 }
 
-static GstFlowReturn
-gst_alpha_mask_push_frame (GstAlphaMask * thiz, GstBuffer * ibuffer)
+/* Points the color and mask infos at the halves of a packed frame with the
+ * given plane layout */
+static void
+gst_alpha_mask_set_packed_planes (GstAlphaMask * thiz, const gsize * offset,
+    const gint * stride)
 {
-  GstBuffer *obuffer = NULL;
-  GstFlowReturn ret = GST_FLOW_OK;
+  guint p;
 
-  switch (thiz->oformat) {
-    case GST_VIDEO_FORMAT_A420:
-      if (thiz->iformat == GST_VIDEO_FORMAT_GRAY8) {
-        GstMemory *mem = gst_buffer_peek_memory (thiz->alpha_buffer, 0);
-        obuffer = gst_buffer_make_writable (ibuffer);
-        gst_buffer_append_memory (obuffer, gst_memory_ref (mem));
-      } else {
-        obuffer = gst_alpha_mask_convert (thiz, ibuffer);
-      }
-      break;
-    case GST_VIDEO_FORMAT_ARGB:
-    case GST_VIDEO_FORMAT_AYUV:
-      obuffer = gst_alpha_mask_convert (thiz, ibuffer);
-      break;
-    default:
-      break;
+  for (p = 0; p < GST_VIDEO_INFO_N_PLANES (&thiz->iinfo); p++) {
+    GST_VIDEO_INFO_PLANE_OFFSET (&thiz->iinfo, p) = offset[p];
+    GST_VIDEO_INFO_PLANE_STRIDE (&thiz->iinfo, p) = stride[p];
   }
 
-  if (obuffer)
-    ret = gst_pad_push (thiz->srcpad, obuffer);
+  /* the mask is the luma plane of the other half, same size as the color */
+  thiz->ainfo = thiz->iinfo;
+  if (thiz->packed == GST_ALPHA_MASK_PACKED_SIDE_BY_SIDE)
+    GST_VIDEO_INFO_PLANE_OFFSET (&thiz->ainfo, 0) += thiz->width;
+  else
+    GST_VIDEO_INFO_PLANE_OFFSET (&thiz->ainfo, 0) +=
+        (gsize) thiz->height * stride[0];
+}
+
+/* Takes the layout of a packed @buf from its video meta, if any. The meta is
+ * dropped from the returned buffer so that mapping it follows the infos. */
+static GstBuffer *
+gst_alpha_mask_unpack_frame (GstAlphaMask * thiz, GstBuffer * buf)
+{
+  GstVideoMeta *meta = gst_buffer_get_video_meta (buf);
+  GstBuffer *view;
 
-  return ret;
+  if (!meta)
+    return buf;
+
+  gst_alpha_mask_set_packed_planes (thiz, meta->offset, meta->stride);
+
+  view = gst_buffer_copy_region (buf, GST_BUFFER_COPY_FLAGS |
+      GST_BUFFER_COPY_TIMESTAMPS | GST_BUFFER_COPY_MEMORY, 0, -1);
+  gst_buffer_unref (buf);
+
+  return view;
 }
 
-/* Called with lock held */
-static void
-gst_alpha_mask_pop_alpha (GstAlphaMask * thiz)
+/* Sets up @info, the whole packed frame, as a color half and a mask half.
+ * The mask is read from the luma plane, which has to be 8 bits with one
+ * byte per pixel. */
+static gboolean
+gst_alpha_mask_setup_packed (GstAlphaMask * thiz, const GstVideoInfo * info,
+    GstAlphaMaskPackedLayout layout)
 {
-  g_return_if_fail (GST_IS_ALPHA_MASK (thiz));
+  const GstVideoFormatInfo *finfo = info->finfo;
+  gsize offset[GST_VIDEO_MAX_PLANES];
+  gint stride[GST_VIDEO_MAX_PLANES];
+  guint p;
+
+  if (!GST_VIDEO_FORMAT_INFO_IS_YUV (finfo) ||
+      GST_VIDEO_FORMAT_INFO_PLANE (finfo, GST_VIDEO_COMP_Y) != 0 ||
+      GST_VIDEO_FORMAT_INFO_PSTRIDE (finfo, GST_VIDEO_COMP_Y) != 1 ||
+      GST_VIDEO_FORMAT_INFO_DEPTH (finfo, GST_VIDEO_COMP_Y) != 8) {
+    GST_WARNING_OBJECT (thiz, "packed masks need a planar YUV input, not %s",
+        GST_VIDEO_FORMAT_INFO_NAME (finfo));
+    return FALSE;
+  }
 
-  if (thiz->alpha_buffer) {
-    GST_DEBUG_OBJECT (thiz, "releasing alpha buffer %p", thiz->alpha_buffer);
-    gst_buffer_unref (thiz->alpha_buffer);
-    thiz->alpha_buffer = NULL;
+  if ((layout == GST_ALPHA_MASK_PACKED_SIDE_BY_SIDE &&
+          GST_VIDEO_INFO_WIDTH (info) % 2) ||
+      (layout == GST_ALPHA_MASK_PACKED_TOP_BOTTOM &&
+          GST_VIDEO_INFO_HEIGHT (info) % 2)) {
+    GST_WARNING_OBJECT (thiz, "packed frame of %dx%d doesn't split in two",
+        GST_VIDEO_INFO_WIDTH (info), GST_VIDEO_INFO_HEIGHT (info));
+    return FALSE;
+  }
+
+  thiz->packed = layout;
+  thiz->iinfo = *info;
+  if (layout == GST_ALPHA_MASK_PACKED_SIDE_BY_SIDE)
+    GST_VIDEO_INFO_WIDTH (&thiz->iinfo) /= 2;
+  else
+    GST_VIDEO_INFO_HEIGHT (&thiz->iinfo) /= 2;
+  thiz->width = GST_VIDEO_INFO_WIDTH (&thiz->iinfo);
+  thiz->height = GST_VIDEO_INFO_HEIGHT (&thiz->iinfo);
+
+  for (p = 0; p < GST_VIDEO_INFO_N_PLANES (info); p++) {
+    offset[p] = GST_VIDEO_INFO_PLANE_OFFSET (info, p);
+    stride[p] = GST_VIDEO_INFO_PLANE_STRIDE (info, p);
   }
+  gst_alpha_mask_set_packed_planes (thiz, offset, stride);
+
+  thiz->alpha_encoding = GST_ALPHA_MASK_ENCODING_RAW;
+  thiz->alpha_dmabuf = thiz->video_dmabuf;
+
+  GST_DEBUG_OBJECT (thiz, "packed %s mask of %dx%d",
+      layout == GST_ALPHA_MASK_PACKED_SIDE_BY_SIDE ? "side by side" :
+      "top bottom", thiz->width, thiz->height);
 
-  /* Let the task know we used that buffer */
-  GST_ALPHA_MASK_BROADCAST (thiz);
+  return TRUE;
 }
 
 static GstFlowReturn
@@ -422,10 +2996,13 @@ gst_alpha_mask_video_chain (GstPad * pad, GstObject * parent,
 {
   GstAlphaMask *thiz;
   GstFlowReturn ret = GST_FLOW_OK;
+  GstAlphaMaskMode mode;
   gboolean in_seg = FALSE;
   guint64 start, stop, clip_start = 0, clip_stop = 0;
 
   thiz = GST_ALPHA_MASK (parent);
+  thiz->video_arrival = gst_util_get_timestamp ();
+  thiz->frame_stats.frames_in++;
 
   if (!GST_BUFFER_TIMESTAMP_IS_VALID (buffer))
     goto missing_timestamp;
@@ -479,36 +3056,42 @@ gst_alpha_mask_video_chain (GstPad * pad, GstObject * parent,
 
   gst_object_sync_values (GST_OBJECT (thiz), GST_BUFFER_TIMESTAMP (buffer));
 
-wait_for_alpha_buf:
+  mode = g_atomic_int_get (&thiz->alpha_mode);
+
+  /* the mask travels in the frame itself, there is nothing to wait for */
+  if (thiz->packed) {
+    if (g_atomic_int_get (&thiz->video_flushing))
+      goto flushing;
+
+    buffer = gst_alpha_mask_unpack_frame (thiz, buffer);
+    thiz->alpha_buffer = gst_buffer_ref (buffer);
+    ret = gst_alpha_mask_push_frame (thiz, buffer);
+    gst_alpha_mask_pop_alpha (thiz);
+    goto done;
+  }
 
-  GST_ALPHA_MASK_LOCK (thiz);
+wait_for_alpha_buf:
 
-  if (thiz->video_flushing)
+  if (g_atomic_int_get (&thiz->video_flushing))
     goto flushing;
 
-  if (thiz->video_eos)
+  if (g_atomic_int_get (&thiz->video_eos))
     goto have_eos;
 
   /* Check if we have a alpha buffer queued */
-  if (thiz->alpha_buffer) {
+  if (gst_alpha_mask_get_alpha (thiz)) {
     gboolean pop_alpha = FALSE, valid_alpha_time = TRUE;
-    GstClockTime alpha_start = GST_CLOCK_TIME_NONE;
-    GstClockTime alpha_end = GST_CLOCK_TIME_NONE;
-    GstClockTime alpha_running_time = GST_CLOCK_TIME_NONE;
-    GstClockTime alpha_running_time_end = GST_CLOCK_TIME_NONE;
+    GstClockTime alpha_running_time = thiz->alpha_running_time;
+    GstClockTime alpha_running_time_end = thiz->alpha_running_time_end;
     GstClockTime vid_running_time, vid_running_time_end;
 
     /* if the alpha buffer isn't stamped right, pop it off the
      * queue and display it for the current video frame only */
-    if (!GST_BUFFER_TIMESTAMP_IS_VALID (thiz->alpha_buffer) ||
-        !GST_BUFFER_DURATION_IS_VALID (thiz->alpha_buffer)) {
+    if (!GST_CLOCK_TIME_IS_VALID (alpha_running_time_end)) {
       GST_WARNING_OBJECT (thiz,
           "Got alpha buffer with invalid timestamp or duration");
       pop_alpha = TRUE;
       valid_alpha_time = FALSE;
-    } else {
-      alpha_start = GST_BUFFER_TIMESTAMP (thiz->alpha_buffer);
-      alpha_end = alpha_start + GST_BUFFER_DURATION (thiz->alpha_buffer);
     }
 
     vid_running_time =
@@ -516,16 +3099,6 @@ wait_for_alpha_buf:
     vid_running_time_end =
         gst_segment_to_running_time (&thiz->segment, GST_FORMAT_TIME, stop);
 
-    /* If timestamp and duration are valid */
-    if (valid_alpha_time) {
-      alpha_running_time =
-          gst_segment_to_running_time (&thiz->alpha_segment,
-          GST_FORMAT_TIME, alpha_start);
-      alpha_running_time_end =
-          gst_segment_to_running_time (&thiz->alpha_segment,
-          GST_FORMAT_TIME, alpha_end);
-    }
-
     GST_LOG_OBJECT (thiz, "A: %" GST_TIME_FORMAT " - %" GST_TIME_FORMAT,
         GST_TIME_ARGS (alpha_running_time),
         GST_TIME_ARGS (alpha_running_time_end));
@@ -537,18 +3110,22 @@ wait_for_alpha_buf:
     if (valid_alpha_time && alpha_running_time_end <= vid_running_time) {
       /* alpha buffer too old, get rid of it and do nothing  */
       GST_LOG_OBJECT (thiz, "alpha buffer too old, popping");
-      pop_alpha = FALSE;
+      thiz->frame_stats.alpha_too_old++;
       gst_alpha_mask_pop_alpha (thiz);
-      GST_ALPHA_MASK_UNLOCK (thiz);
       goto wait_for_alpha_buf;
     } else if (valid_alpha_time && vid_running_time_end <= alpha_running_time) {
-      GST_WARNING_OBJECT (thiz, "alpha in future, dropping video buffer");
-      GST_ALPHA_MASK_UNLOCK (thiz);
-      /* Drop the video frame */
-      gst_buffer_unref (buffer);
-      ret = GST_FLOW_OK;
+      thiz->frame_stats.alpha_in_future++;
+      if (mode == GST_ALPHA_MASK_MODE_HOLD_LAST && thiz->alpha_last) {
+        GST_LOG_OBJECT (thiz, "alpha in future, holding the previous one");
+        ret = gst_alpha_mask_push_frame_with (thiz, buffer, thiz->alpha_last);
+      } else {
+        GST_WARNING_OBJECT (thiz, "alpha in future, dropping video buffer");
+        /* Drop the video frame */
+        thiz->frame_stats.frames_dropped++;
+        gst_buffer_unref (buffer);
+        ret = GST_FLOW_OK;
+      }
     } else {
-      GST_ALPHA_MASK_UNLOCK (thiz);
       ret = gst_alpha_mask_push_frame (thiz, buffer);
 
       if (valid_alpha_time && alpha_running_time_end <= vid_running_time_end) {
@@ -556,15 +3133,29 @@ wait_for_alpha_buf:
         pop_alpha = TRUE;
       }
     }
-    if (pop_alpha) {
-      GST_ALPHA_MASK_LOCK (thiz);
+    if (pop_alpha)
       gst_alpha_mask_pop_alpha (thiz);
-      GST_ALPHA_MASK_UNLOCK (thiz);
-    }
   } else {
     gboolean wait_for_alpha_buf = TRUE;
 
-    if (thiz->alpha_eos || thiz->alpha_segment_done)
+    GST_ALPHA_MASK_LOCK (thiz);
+    /* tell the alpha chain to wake us up, then check again so we can't
+     * miss a buffer queued in the meantime */
+    g_atomic_int_inc (&thiz->video_waiting);
+
+    if (thiz->video_flushing) {
+      g_atomic_int_add (&thiz->video_waiting, -1);
+      GST_ALPHA_MASK_UNLOCK (thiz);
+      goto flushing;
+    }
+
+    if (!gst_alpha_mask_queue_is_empty (thiz)) {
+      g_atomic_int_add (&thiz->video_waiting, -1);
+      GST_ALPHA_MASK_UNLOCK (thiz);
+      goto wait_for_alpha_buf;
+    }
+
+    if (g_atomic_int_get (&thiz->alpha_eos) || thiz->alpha_segment_done)
       wait_for_alpha_buf = FALSE;
 
     /* Alpha pad linked, but no alpha buffer available - what now? */
@@ -582,6 +3173,13 @@ wait_for_alpha_buf:
           gst_segment_to_running_time (&thiz->alpha_segment,
           GST_FORMAT_TIME, thiz->alpha_segment.position);
 
+      /* the queue is empty, so the last alpha buffer we took is the last
+       * one the alpha chain received */
+      if (GST_CLOCK_TIME_IS_VALID (thiz->alpha_last_running_time) &&
+          (!GST_CLOCK_TIME_IS_VALID (alpha_position_running_time) ||
+              thiz->alpha_last_running_time > alpha_position_running_time))
+        alpha_position_running_time = thiz->alpha_last_running_time;
+
       if ((GST_CLOCK_TIME_IS_VALID (alpha_start_running_time) &&
               vid_running_time < alpha_start_running_time) ||
           (GST_CLOCK_TIME_IS_VALID (alpha_position_running_time) &&
@@ -590,56 +3188,103 @@ wait_for_alpha_buf:
       }
     }
 
+    /* the previous mask or a constant alpha do without waiting */
+    if ((mode == GST_ALPHA_MASK_MODE_HOLD_LAST && thiz->alpha_last) ||
+        (mode == GST_ALPHA_MASK_MODE_CONSTANT &&
+            !g_atomic_int_get (&thiz->alpha_linked)))
+      wait_for_alpha_buf = FALSE;
+
     if (wait_for_alpha_buf) {
+      GstClockTime wait_start = gst_util_get_timestamp ();
+      gboolean timed_out = FALSE;
+      gint64 end_time;
+
+      end_time = gst_alpha_mask_get_wait_end (thiz,
+          gst_segment_to_running_time (&thiz->segment, GST_FORMAT_TIME,
+              GST_BUFFER_TIMESTAMP (buffer)));
+
       GST_DEBUG_OBJECT (thiz, "no alpha buffer, need to wait for one");
-      GST_ALPHA_MASK_WAIT (thiz);
+      if (end_time < 0)
+        GST_ALPHA_MASK_WAIT (thiz);
+      else
+        timed_out = !GST_ALPHA_MASK_WAIT_UNTIL (thiz, end_time);
       GST_DEBUG_OBJECT (thiz, "resuming");
+      gst_alpha_mask_timing_add (&thiz->frame_stats.video_wait,
+          gst_util_get_timestamp () - wait_start);
+      g_atomic_int_add (&thiz->video_waiting, -1);
       GST_ALPHA_MASK_UNLOCK (thiz);
+
+      /* the frame is due, go on with the previous mask or an opaque one */
+      if (timed_out && gst_alpha_mask_queue_is_empty (thiz) &&
+          !g_atomic_int_get (&thiz->video_flushing)) {
+        GST_DEBUG_OBJECT (thiz, "alpha late, using the %s mask",
+            thiz->alpha_last ? "previous" : "opaque");
+        thiz->frame_stats.alpha_late++;
+        ret = gst_alpha_mask_push_frame_with (thiz, buffer, thiz->alpha_last);
+        goto done;
+      }
       goto wait_for_alpha_buf;
     } else {
+      g_atomic_int_add (&thiz->video_waiting, -1);
       GST_ALPHA_MASK_UNLOCK (thiz);
       GST_LOG_OBJECT (thiz, "no need to wait for a alpha buffer");
-      ret = gst_pad_push (thiz->srcpad, buffer);
+      if (mode == GST_ALPHA_MASK_MODE_HOLD_LAST && thiz->alpha_last) {
+        ret = gst_alpha_mask_push_frame_with (thiz, buffer, thiz->alpha_last);
+      } else if (mode == GST_ALPHA_MASK_MODE_CONSTANT) {
+        ret = gst_alpha_mask_push_frame_with (thiz, buffer, NULL);
+      } else {
+        ret = gst_alpha_mask_push_output (thiz, buffer);
+      }
     }
   }
 
+done:
   /* Update position */
   thiz->segment.position = clip_start;
 
+  gst_alpha_mask_commit_stats (thiz);
+
   return ret;
 
 missing_timestamp:
   {
     GST_WARNING_OBJECT (thiz, "buffer without timestamp, discarding");
-    gst_buffer_unref (buffer);
-    return GST_FLOW_OK;
+    ret = GST_FLOW_OK;
+    goto discard;
   }
 
 flushing:
   {
-    GST_ALPHA_MASK_UNLOCK (thiz);
     GST_DEBUG_OBJECT (thiz, "flushing, discarding buffer");
-    gst_buffer_unref (buffer);
-    return GST_FLOW_FLUSHING;
+    ret = GST_FLOW_FLUSHING;
+    goto discard;
   }
 have_eos:
   {
-    GST_ALPHA_MASK_UNLOCK (thiz);
     GST_DEBUG_OBJECT (thiz, "eos, discarding buffer");
-    gst_buffer_unref (buffer);
-    return GST_FLOW_EOS;
+    ret = GST_FLOW_EOS;
+    goto discard;
   }
 out_of_segment:
   {
     GST_DEBUG_OBJECT (thiz, "buffer out of segment, discarding");
+    ret = GST_FLOW_OK;
+    goto discard;
+  }
+discard:
+  {
     gst_buffer_unref (buffer);
-    return GST_FLOW_OK;
+    thiz->frame_stats.frames_dropped++;
+    gst_alpha_mask_commit_stats (thiz);
+    return ret;
   }
 }
 
 static gboolean
 gst_alpha_mask_video_setcaps (GstAlphaMask * thiz, GstCaps * caps)
 {
+  GstAlphaMaskClass *klass = GST_ALPHA_MASK_GET_CLASS (thiz);
+  GstAlphaMaskPackedLayout layout;
   GstVideoInfo info;
   gboolean ret = FALSE;
 
@@ -648,12 +3293,32 @@ gst_alpha_mask_video_setcaps (GstAlphaMask * thiz, GstCaps * caps)
 
   GST_DEBUG_OBJECT (thiz, "received video caps %" GST_PTR_FORMAT, caps);
 
-  thiz->iinfo = info;
-  thiz->width = GST_VIDEO_INFO_WIDTH (&info);
-  thiz->height = GST_VIDEO_INFO_HEIGHT (&info);
+  GST_OBJECT_LOCK (thiz);
+  layout = thiz->packed_layout;
+  GST_OBJECT_UNLOCK (thiz);
+
+  /* subclasses don't map the frames themselves */
+  if (layout != GST_ALPHA_MASK_PACKED_NONE &&
+      klass->process != gst_alpha_mask_process_default) {
+    GST_WARNING_OBJECT (thiz, "packed masks not supported, ignoring them");
+    layout = GST_ALPHA_MASK_PACKED_NONE;
+  }
+
   thiz->iformat = GST_VIDEO_INFO_FORMAT (&info);
+  thiz->video_dmabuf = gst_alpha_mask_caps_is_dmabuf (caps, 0);
+  thiz->dmabuf_disabled = FALSE;
+
+  if (layout != GST_ALPHA_MASK_PACKED_NONE) {
+    if (!gst_alpha_mask_setup_packed (thiz, &info, layout))
+      return FALSE;
+  } else {
+    thiz->packed = GST_ALPHA_MASK_PACKED_NONE;
+    thiz->iinfo = info;
+    thiz->width = GST_VIDEO_INFO_WIDTH (&info);
+    thiz->height = GST_VIDEO_INFO_HEIGHT (&info);
+  }
 
-  ret = gst_alpha_mask_negotiate (thiz, caps);
+  ret = klass->negotiate (thiz, caps);
 
   return ret;
 
@@ -692,7 +3357,7 @@ gst_alpha_mask_video_event (GstPad * pad, GstObject * parent, GstEvent * event)
       GST_DEBUG_OBJECT (thiz, "received new segment");
 
       GST_ALPHA_MASK_LOCK (thiz);
-      thiz->video_eos = FALSE;
+      g_atomic_int_set (&thiz->video_eos, FALSE);
       thiz->video_segment_done = FALSE;
       GST_ALPHA_MASK_UNLOCK (thiz);
 
@@ -700,6 +3365,9 @@ gst_alpha_mask_video_event (GstPad * pad, GstObject * parent, GstEvent * event)
 
       if (segment->format == GST_FORMAT_TIME) {
         gst_segment_copy_into (segment, &thiz->segment);
+        GST_OBJECT_LOCK (thiz);
+        gst_alpha_mask_reset_qos (thiz);
+        GST_OBJECT_UNLOCK (thiz);
         GST_INFO_OBJECT (thiz, "VIDEO SEGMENT now: %" GST_SEGMENT_FORMAT,
             &thiz->segment);
       } else {
@@ -707,10 +3375,10 @@ gst_alpha_mask_video_event (GstPad * pad, GstObject * parent, GstEvent * event)
             ("received non-TIME newsegment event on video input"));
       }
 
-      /* Drop any older alpha buffer to ensure we get both streams in sync */
-      GST_ALPHA_MASK_LOCK (thiz);
+      /* Drop the alpha buffer in use and all queued ones to ensure we get
+       * both streams in sync, the queue can't be flushed under the lock */
       gst_alpha_mask_pop_alpha (thiz);
-      GST_ALPHA_MASK_UNLOCK (thiz);
+      gst_alpha_mask_flush_alpha (thiz);
 
       ret = gst_pad_event_default (pad, parent, event);
       break;
@@ -718,7 +3386,7 @@ gst_alpha_mask_video_event (GstPad * pad, GstObject * parent, GstEvent * event)
     case GST_EVENT_EOS:
       GST_ALPHA_MASK_LOCK (thiz);
       GST_INFO_OBJECT (thiz, "video EOS");
-      thiz->video_eos = TRUE;
+      g_atomic_int_set (&thiz->video_eos, TRUE);
       GST_ALPHA_MASK_UNLOCK (thiz);
       ret = gst_pad_event_default (pad, parent, event);
       break;
@@ -741,10 +3409,13 @@ gst_alpha_mask_video_event (GstPad * pad, GstObject * parent, GstEvent * event)
       GST_ALPHA_MASK_LOCK (thiz);
       GST_INFO_OBJECT (thiz, "video flush stop");
       thiz->video_flushing = FALSE;
-      thiz->video_eos = FALSE;
+      g_atomic_int_set (&thiz->video_eos, FALSE);
       thiz->video_segment_done = FALSE;
       gst_segment_init (&thiz->segment, GST_FORMAT_TIME);
       GST_ALPHA_MASK_UNLOCK (thiz);
+      GST_OBJECT_LOCK (thiz);
+      gst_alpha_mask_reset_qos (thiz);
+      GST_OBJECT_UNLOCK (thiz);
       ret = gst_pad_event_default (pad, parent, event);
       break;
     default:
@@ -756,8 +3427,8 @@ gst_alpha_mask_video_event (GstPad * pad, GstObject * parent, GstEvent * event)
 }
 
 /* We receive alpha buffers here. If they are out of segment we just ignore them.
-   If the buffer is in our segment we keep it internally except if another one
-   is already waiting here, in that case we wait that it gets kicked out */
+   If the buffer is in our segment we queue it internally except if the queue
+   is already full, in that case we wait that one gets kicked out */
 static GstFlowReturn
 gst_alpha_mask_alpha_chain (GstPad * pad, GstObject * parent,
     GstBuffer * buffer)
@@ -766,25 +3437,28 @@ gst_alpha_mask_alpha_chain (GstPad * pad, GstObject * parent,
   GstAlphaMask *thiz = NULL;
   gboolean in_seg = FALSE;
   guint64 clip_start = 0, clip_stop = 0;
+  GstClockTime arrival = gst_util_get_timestamp ();
 
   thiz = GST_ALPHA_MASK (parent);
 
-  GST_ALPHA_MASK_LOCK (thiz);
-
-  if (thiz->alpha_flushing) {
-    GST_ALPHA_MASK_UNLOCK (thiz);
+  if (g_atomic_int_get (&thiz->alpha_flushing)) {
     ret = GST_FLOW_FLUSHING;
     GST_LOG_OBJECT (thiz, "alpha flushing");
     goto beach;
   }
 
-  if (thiz->alpha_eos) {
-    GST_ALPHA_MASK_UNLOCK (thiz);
+  if (g_atomic_int_get (&thiz->alpha_eos)) {
     ret = GST_FLOW_EOS;
     GST_LOG_OBJECT (thiz, "alpha EOS");
     goto beach;
   }
 
+  /* nothing would take it out of the queue */
+  if (thiz->packed) {
+    GST_LOG_OBJECT (thiz, "packed masks in use, dropping alpha buffer");
+    goto beach;
+  }
+
   GST_LOG_OBJECT (thiz, "%" GST_SEGMENT_FORMAT "  BUFFER: ts=%"
       GST_TIME_FORMAT ", end=%" GST_TIME_FORMAT, &thiz->segment,
       GST_TIME_ARGS (GST_BUFFER_TIMESTAMP (buffer)),
@@ -806,6 +3480,9 @@ gst_alpha_mask_alpha_chain (GstPad * pad, GstObject * parent,
   }
 
   if (in_seg) {
+    GstAlphaMaskEntry entry;
+    GstClockTime wait_start, wait_time = GST_CLOCK_TIME_NONE;
+
     /* about to change metadata */
     buffer = gst_buffer_make_writable (buffer);
     if (GST_BUFFER_TIMESTAMP_IS_VALID (buffer))
@@ -813,31 +3490,53 @@ gst_alpha_mask_alpha_chain (GstPad * pad, GstObject * parent,
     if (GST_BUFFER_DURATION_IS_VALID (buffer))
       GST_BUFFER_DURATION (buffer) = clip_stop - clip_start;
 
-    /* Wait for the previous buffer to go away */
-    while (thiz->alpha_buffer != NULL) {
-      GST_DEBUG ("Pad %s:%s has a buffer queued, waiting",
-          GST_DEBUG_PAD_NAME (pad));
-      GST_ALPHA_MASK_WAIT (thiz);
-      GST_DEBUG ("Pad %s:%s resuming", GST_DEBUG_PAD_NAME (pad));
+    /* the running time is taken with the segment the buffer belongs to, so
+     * the video chain never has to look at the alpha segment */
+    entry.buffer = buffer;
+    entry.running_time = GST_CLOCK_TIME_NONE;
+    entry.running_time_end = GST_CLOCK_TIME_NONE;
+    entry.arrival = arrival;
+    if (GST_BUFFER_TIMESTAMP_IS_VALID (buffer)) {
+      entry.running_time = gst_segment_to_running_time (&thiz->alpha_segment,
+          GST_FORMAT_TIME, clip_start);
+      if (GST_BUFFER_DURATION_IS_VALID (buffer))
+        entry.running_time_end =
+            gst_segment_to_running_time (&thiz->alpha_segment,
+            GST_FORMAT_TIME, clip_stop);
+    }
+
+    /* Wait for room in the queue */
+    while (!gst_alpha_mask_queue_push (thiz, &entry)) {
+      GST_ALPHA_MASK_LOCK (thiz);
+      /* tell the video chain to wake us up, then check again so we can't
+       * miss the room it made in the meantime */
+      g_atomic_int_inc (&thiz->alpha_waiting);
+      if (!thiz->alpha_flushing && gst_alpha_mask_queue_is_full (thiz)) {
+        GST_DEBUG ("Pad %s:%s has %u buffers queued, waiting",
+            GST_DEBUG_PAD_NAME (pad), thiz->alpha_queue_len);
+        wait_start = gst_util_get_timestamp ();
+        GST_ALPHA_MASK_WAIT (thiz);
+        wait_time = gst_util_get_timestamp () - wait_start;
+        GST_DEBUG ("Pad %s:%s resuming", GST_DEBUG_PAD_NAME (pad));
+      }
+      g_atomic_int_add (&thiz->alpha_waiting, -1);
       if (thiz->alpha_flushing) {
         GST_ALPHA_MASK_UNLOCK (thiz);
         ret = GST_FLOW_FLUSHING;
         goto beach;
       }
-    }
-
-    if (GST_BUFFER_TIMESTAMP_IS_VALID (buffer))
-      thiz->alpha_segment.position = clip_start;
-
-    thiz->alpha_buffer = buffer;        /* pass ownership of @buffer */
-    buffer = NULL;
+      GST_ALPHA_MASK_UNLOCK (thiz);
 
-    /* in case the video chain is waiting for a alpha buffer, wake it up */
-    GST_ALPHA_MASK_BROADCAST (thiz);
+      if (GST_CLOCK_TIME_IS_VALID (wait_time)) {
+        GST_OBJECT_LOCK (thiz);
+        gst_alpha_mask_timing_add (&thiz->stats.alpha_wait, wait_time);
+        GST_OBJECT_UNLOCK (thiz);
+        wait_time = GST_CLOCK_TIME_NONE;
+      }
+    }
+    buffer = NULL;              /* owned by the queue now */
   }
 
-  GST_ALPHA_MASK_UNLOCK (thiz);
-
 beach:
   if (buffer)
     gst_buffer_unref (buffer);
@@ -845,16 +3544,74 @@ beach:
   return ret;
 }
 
+/* Reads compact mask caps into @info, which only gets the size and the
+ * framerate */
+static gboolean
+gst_alpha_mask_parse_compact_caps (GstCaps * caps, GstVideoInfo * info,
+    GstAlphaMaskEncoding * encoding)
+{
+  GstStructure *s = gst_caps_get_structure (caps, 0);
+  const gchar *name;
+  gint width, height, fps_n, fps_d;
+
+  name = gst_structure_get_string (s, "encoding");
+  if (!name || !gst_structure_get_int (s, "width", &width) ||
+      !gst_structure_get_int (s, "height", &height))
+    return FALSE;
+
+  if (g_str_equal (name, "rle"))
+    *encoding = GST_ALPHA_MASK_ENCODING_RLE;
+  else if (g_str_equal (name, "bitmap"))
+    *encoding = GST_ALPHA_MASK_ENCODING_BITMAP;
+  else
+    return FALSE;
+
+  gst_video_info_init (info);
+  gst_video_info_set_format (info, GST_VIDEO_FORMAT_GRAY8, width, height);
+  if (gst_structure_get_fraction (s, "framerate", &fps_n, &fps_d)) {
+    GST_VIDEO_INFO_FPS_N (info) = fps_n;
+    GST_VIDEO_INFO_FPS_D (info) = fps_d;
+  }
+
+  return TRUE;
+}
+
 static gboolean
 gst_alpha_mask_alpha_setcaps (GstAlphaMask * thiz, GstCaps * caps)
 {
+  GstAlphaMaskEncoding encoding = GST_ALPHA_MASK_ENCODING_RAW;
   GstVideoInfo info;
 
-  if (!gst_video_info_from_caps (&info, caps))
+  if (gst_structure_has_name (gst_caps_get_structure (caps, 0),
+          "video/x-alpha-mask")) {
+    if (!gst_alpha_mask_parse_compact_caps (caps, &info, &encoding))
+      goto invalid_caps;
+  } else if (!gst_video_info_from_caps (&info, caps)) {
     goto invalid_caps;
+  }
 
   GST_DEBUG_OBJECT (thiz, "received alpha caps %" GST_PTR_FORMAT, caps);
+
+  /* the video frames carry the mask, ainfo describes their mask half */
+  if (thiz->packed)
+    return TRUE;
+
+  /* the mask size and layout decide whether the zero-copy output format is
+   * an option, rank the output formats again */
+  if (!gst_alpha_mask_has_alpha_info (thiz) ||
+      GST_VIDEO_INFO_WIDTH (&info) != GST_VIDEO_INFO_WIDTH (&thiz->ainfo) ||
+      GST_VIDEO_INFO_HEIGHT (&info) != GST_VIDEO_INFO_HEIGHT (&thiz->ainfo) ||
+      GST_VIDEO_INFO_FORMAT (&info) != GST_VIDEO_INFO_FORMAT (&thiz->ainfo) ||
+      encoding != thiz->alpha_encoding ||
+      gst_alpha_mask_caps_is_dmabuf (caps, 0) != thiz->alpha_dmabuf)
+    gst_pad_mark_reconfigure (thiz->srcpad);
+
   thiz->ainfo = info;
+  thiz->alpha_encoding = encoding;
+  thiz->alpha_dmabuf = gst_alpha_mask_caps_is_dmabuf (caps, 0);
+
+  GST_DEBUG_OBJECT (thiz, "alpha read from component %u",
+      gst_alpha_mask_mask_comp (thiz));
 
   return TRUE;
 
@@ -891,7 +3648,7 @@ gst_alpha_mask_alpha_event (GstPad * pad, GstObject * parent, GstEvent * event)
       const GstSegment *segment;
 
       GST_ALPHA_MASK_LOCK (thiz);
-      thiz->alpha_eos = FALSE;
+      g_atomic_int_set (&thiz->alpha_eos, FALSE);
       thiz->alpha_segment_done = FALSE;
       GST_ALPHA_MASK_UNLOCK (thiz);
 
@@ -927,11 +3684,11 @@ gst_alpha_mask_alpha_event (GstPad * pad, GstObject * parent, GstEvent * event)
         start += duration;
       /* we do not expect another buffer until after gap,
        * so that is our position now */
+      GST_ALPHA_MASK_LOCK (thiz);
       thiz->alpha_segment.position = start;
 
       /* wake up the video chain, it might be waiting for a alpha buffer or
        * a alpha segment update */
-      GST_ALPHA_MASK_LOCK (thiz);
       GST_ALPHA_MASK_BROADCAST (thiz);
       GST_ALPHA_MASK_UNLOCK (thiz);
 
@@ -940,12 +3697,12 @@ gst_alpha_mask_alpha_event (GstPad * pad, GstObject * parent, GstEvent * event)
       break;
     }
     case GST_EVENT_FLUSH_STOP:
+      gst_alpha_mask_flush_alpha (thiz);
       GST_ALPHA_MASK_LOCK (thiz);
       GST_INFO_OBJECT (thiz, "alpha flush stop");
       thiz->alpha_flushing = FALSE;
-      thiz->alpha_eos = FALSE;
+      g_atomic_int_set (&thiz->alpha_eos, FALSE);
       thiz->alpha_segment_done = FALSE;
-      gst_alpha_mask_pop_alpha (thiz);
       gst_segment_init (&thiz->alpha_segment, GST_FORMAT_TIME);
       GST_ALPHA_MASK_UNLOCK (thiz);
       gst_event_unref (event);
@@ -973,7 +3730,7 @@ gst_alpha_mask_alpha_event (GstPad * pad, GstObject * parent, GstEvent * event)
       break;
     case GST_EVENT_EOS:
       GST_ALPHA_MASK_LOCK (thiz);
-      thiz->alpha_eos = TRUE;
+      g_atomic_int_set (&thiz->alpha_eos, TRUE);
       GST_INFO_OBJECT (thiz, "alpha EOS");
       /* wake up the video chain, it might be waiting for a alpha buffer or
        * a alpha segment update */
@@ -1001,7 +3758,7 @@ gst_alpha_mask_alpha_pad_link (GstPad * pad, GstObject * parent, GstPad * peer)
 
   GST_DEBUG_OBJECT (thiz, "Alpha pad linked");
 
-  thiz->alpha_linked = TRUE;
+  g_atomic_int_set (&thiz->alpha_linked, TRUE);
 
   return GST_PAD_LINK_OK;
 }
@@ -1015,7 +3772,7 @@ gst_alpha_mask_alpha_pad_unlink (GstPad * pad, GstObject * parent)
 
   GST_DEBUG_OBJECT (thiz, "Alpha pad unlinked");
 
-  thiz->alpha_linked = FALSE;
+  g_atomic_int_set (&thiz->alpha_linked, FALSE);
 
   gst_segment_init (&thiz->alpha_segment, GST_FORMAT_UNDEFINED);
 }
@@ -1028,13 +3785,24 @@ gst_alpha_mask_src_event (GstPad * pad, GstObject * parent, GstEvent * event)
 
   thiz = GST_ALPHA_MASK (parent);
 
-  /* Drop QOS events to ensure we get both streams completely merged */
   if (GST_EVENT_TYPE (event) == GST_EVENT_QOS) {
-    gst_event_unref (event);
-    return TRUE;
+    GstQOSType type;
+    GstClockTimeDiff diff;
+    GstClockTime timestamp;
+    gdouble proportion;
+
+    /* Without QoS drop the events to ensure we get both streams completely
+     * merged, otherwise both upstreams get to know we're late */
+    if (!g_atomic_int_get (&thiz->qos)) {
+      gst_event_unref (event);
+      return TRUE;
+    }
+
+    gst_event_parse_qos (event, &type, &proportion, &diff, &timestamp);
+    gst_alpha_mask_update_qos (thiz, proportion, diff, timestamp);
   }
 
-  if (thiz->alpha_linked) {
+  if (g_atomic_int_get (&thiz->alpha_linked)) {
     gst_event_ref (event);
     ret = gst_pad_push_event (thiz->video_sinkpad, event);
     gst_pad_push_event (thiz->alpha_sinkpad, event);
@@ -1045,20 +3813,123 @@ gst_alpha_mask_src_event (GstPad * pad, GstObject * parent, GstEvent * event)
   return ret;
 }
 
+static gboolean
+gst_alpha_mask_query (GstPad * pad, GstObject * parent, GstQuery * query)
+{
+  GstAlphaMask *thiz = GST_ALPHA_MASK (parent);
+
+  return GST_ALPHA_MASK_GET_CLASS (thiz)->query (thiz, pad, query);
+}
+
+/* Combines the latency of both upstream branches, like GstAggregator does:
+ * live if either is, the largest minimum and the smallest maximum. The mask
+ * may arrive up to the latency property later than the video. */
+static gboolean
+gst_alpha_mask_query_latency (GstAlphaMask * thiz, GstQuery * query)
+{
+  GstPad *pads[2] = { thiz->video_sinkpad, thiz->alpha_sinkpad };
+  GstClockTime min = 0, max = GST_CLOCK_TIME_NONE;
+  gboolean live = FALSE;
+  guint i, n;
+
+  n = g_atomic_int_get (&thiz->alpha_linked) && !thiz->packed ? 2 : 1;
+  for (i = 0; i < n; i++) {
+    GstQuery *peer_query = gst_query_new_latency ();
+    GstClockTime peer_min, peer_max;
+    gboolean peer_live;
+
+    if (!gst_pad_peer_query (pads[i], peer_query)) {
+      gst_query_unref (peer_query);
+      GST_DEBUG_OBJECT (thiz, "%s:%s LATENCY query failed",
+          GST_DEBUG_PAD_NAME (pads[i]));
+      /* like GstAggregator, a mask source that can't answer is left out
+       * instead of failing the latency of the whole pipeline */
+      if (pads[i] == thiz->alpha_sinkpad)
+        continue;
+      return FALSE;
+    }
+
+    gst_query_parse_latency (peer_query, &peer_live, &peer_min, &peer_max);
+    gst_query_unref (peer_query);
+
+    if (!peer_live)
+      continue;
+
+    live = TRUE;
+    min = MAX (min, peer_min);
+    if (GST_CLOCK_TIME_IS_VALID (peer_max))
+      max = GST_CLOCK_TIME_IS_VALID (max) ? MIN (max, peer_max) : peer_max;
+  }
+
+  GST_OBJECT_LOCK (thiz);
+  g_atomic_int_set (&thiz->live, live);
+  thiz->upstream_latency = min;
+  if (live) {
+    min += thiz->latency;
+    if (GST_CLOCK_TIME_IS_VALID (max))
+      max += thiz->latency;
+  }
+  GST_OBJECT_UNLOCK (thiz);
+
+  if (GST_CLOCK_TIME_IS_VALID (max) && max < min)
+    GST_ELEMENT_WARNING (thiz, CORE, CLOCK, (NULL),
+        ("Impossible to configure latency: max %" GST_TIME_FORMAT " < min %"
+            GST_TIME_FORMAT, GST_TIME_ARGS (max), GST_TIME_ARGS (min)));
+
+  GST_DEBUG_OBJECT (thiz, "latency live %d min %" GST_TIME_FORMAT " max %"
+      GST_TIME_FORMAT, live, GST_TIME_ARGS (min), GST_TIME_ARGS (max));
+
+  gst_query_set_latency (query, live, min, max);
+
+  return TRUE;
+}
+
+static gboolean
+gst_alpha_mask_query_default (GstAlphaMask * thiz, GstPad * pad,
+    GstQuery * query)
+{
+  if (GST_QUERY_TYPE (query) == GST_QUERY_LATENCY && pad == thiz->srcpad)
+    return gst_alpha_mask_query_latency (thiz, query);
+
+  return gst_pad_query_default (pad, GST_OBJECT (thiz), query);
+}
+
 static GstStateChangeReturn
 gst_alpha_mask_change_state (GstElement * element, GstStateChange transition)
 {
   GstStateChangeReturn ret = GST_STATE_CHANGE_SUCCESS;
   GstAlphaMask *thiz = GST_ALPHA_MASK (element);
+  guint size;
 
   switch (transition) {
+    case GST_STATE_CHANGE_READY_TO_PAUSED:
+      GST_OBJECT_LOCK (thiz);
+      size = thiz->alpha_queue_size;
+      GST_OBJECT_UNLOCK (thiz);
+
+      /* no streaming yet, the queue is empty */
+      if (size != thiz->alpha_queue_len) {
+        g_free (thiz->alpha_queue);
+        thiz->alpha_queue = g_new0 (GstAlphaMaskEntry, size);
+        thiz->alpha_queue_len = size;
+      }
+      thiz->alpha_head = thiz->alpha_tail = 0;
+      thiz->alpha_last_running_time = GST_CLOCK_TIME_NONE;
+
+      GST_OBJECT_LOCK (thiz);
+      gst_alpha_mask_reset_qos (thiz);
+      thiz->processed = thiz->dropped = 0;
+      memset (&thiz->stats, 0, sizeof (GstAlphaMaskStats));
+      memset (&thiz->frame_stats, 0, sizeof (GstAlphaMaskStats));
+      thiz->stats_posted = GST_CLOCK_TIME_NONE;
+      GST_OBJECT_UNLOCK (thiz);
+      break;
     case GST_STATE_CHANGE_PAUSED_TO_READY:
       GST_ALPHA_MASK_LOCK (thiz);
       thiz->alpha_flushing = TRUE;
       thiz->video_flushing = TRUE;
-      /* pop_alpha will broadcast on the GCond and thus also make the video
-       * chain exit if it's waiting for a alpha buffer */
-      gst_alpha_mask_pop_alpha (thiz);
+      /* make both chains exit if they are waiting */
+      GST_ALPHA_MASK_BROADCAST (thiz);
       GST_ALPHA_MASK_UNLOCK (thiz);
       break;
     default:
@@ -1070,12 +3941,24 @@ gst_alpha_mask_change_state (GstElement * element, GstStateChange transition)
     return ret;
 
   switch (transition) {
+    case GST_STATE_CHANGE_PAUSED_TO_READY:
+      /* the streaming threads are stopped now */
+      gst_alpha_mask_flush_alpha (thiz);
+      gst_alpha_mask_pop_alpha (thiz);
+      gst_buffer_replace (&thiz->alpha_last, NULL);
+      gst_alpha_mask_clear_cache (thiz);
+      gst_alpha_mask_set_color_pool (thiz, NULL);
+      gst_alpha_mask_set_pool (thiz, NULL);
+      /* new alpha caps come with the next stream */
+      gst_video_info_init (&thiz->ainfo);
+      thiz->alpha_encoding = GST_ALPHA_MASK_ENCODING_RAW;
+      break;
     case GST_STATE_CHANGE_READY_TO_PAUSED:
       GST_ALPHA_MASK_LOCK (thiz);
       thiz->alpha_flushing = FALSE;
       thiz->video_flushing = FALSE;
-      thiz->video_eos = FALSE;
-      thiz->alpha_eos = FALSE;
+      g_atomic_int_set (&thiz->video_eos, FALSE);
+      g_atomic_int_set (&thiz->alpha_eos, FALSE);
       gst_segment_init (&thiz->segment, GST_FORMAT_TIME);
       gst_segment_init (&thiz->alpha_segment, GST_FORMAT_TIME);
       GST_ALPHA_MASK_UNLOCK (thiz);
@@ -1092,14 +3975,20 @@ gst_alpha_mask_finalize (GObject * object)
 {
   GstAlphaMask *thiz = GST_ALPHA_MASK (object);
 
-  if (thiz->alpha_buffer) {
-    gst_buffer_unref (thiz->alpha_buffer);
-    thiz->alpha_buffer = NULL;
-  }
+  gst_alpha_mask_flush_alpha (thiz);
+  gst_alpha_mask_pop_alpha (thiz);
+  gst_buffer_replace (&thiz->alpha_last, NULL);
+  g_free (thiz->alpha_queue);
+  thiz->alpha_queue = NULL;
 
-  if (thiz->convert)
-    gst_video_converter_free (thiz->convert);
-  thiz->convert = NULL;
+  gst_alpha_mask_clear_converters (thiz);
+
+  g_array_free (thiz->alpha_regions, TRUE);
+  g_free (thiz->clear_lines);
+
+  gst_alpha_mask_clear_cache (thiz);
+  gst_alpha_mask_set_color_pool (thiz, NULL);
+  gst_alpha_mask_set_pool (thiz, NULL);
 
   g_mutex_clear (&thiz->lock);
   g_cond_clear (&thiz->cond);
@@ -1107,17 +3996,342 @@ gst_alpha_mask_finalize (GObject * object)
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
+static void
+gst_alpha_mask_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstAlphaMask *thiz = GST_ALPHA_MASK (object);
+
+  GST_OBJECT_LOCK (thiz);
+  switch (prop_id) {
+    case PROP_DITHER:
+      thiz->dither = g_value_get_enum (value);
+      break;
+    case PROP_CHROMA_RESAMPLER:
+      thiz->chroma_resampler = g_value_get_enum (value);
+      break;
+    case PROP_MATRIX_MODE:
+      thiz->matrix_mode = g_value_get_enum (value);
+      break;
+    case PROP_N_THREADS:
+      thiz->n_threads = g_value_get_uint (value);
+      break;
+    case PROP_STATS_INTERVAL:
+      thiz->stats_interval = g_value_get_uint (value);
+      thiz->stats_posted = GST_CLOCK_TIME_NONE;
+      GST_OBJECT_UNLOCK (thiz);
+      return;
+    case PROP_QOS:
+      g_atomic_int_set (&thiz->qos, g_value_get_boolean (value));
+      gst_alpha_mask_reset_qos (thiz);
+      GST_OBJECT_UNLOCK (thiz);
+      return;
+    case PROP_ALPHA_QUEUE_SIZE:
+      /* only mutable in READY, the queue is resized on the way to PAUSED */
+      thiz->alpha_queue_size = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (thiz);
+      return;
+    case PROP_CACHE_ALPHA:
+      thiz->cache_alpha = g_value_get_boolean (value);
+      GST_OBJECT_UNLOCK (thiz);
+      /* the color pool is set up at negotiation time */
+      gst_pad_mark_reconfigure (thiz->srcpad);
+      return;
+    case PROP_ALPHA_SCALING:
+      thiz->alpha_scaling = g_value_get_enum (value);
+      GST_OBJECT_UNLOCK (thiz);
+      return;
+    case PROP_ANALYZE_ALPHA:
+      g_atomic_int_set (&thiz->analyze_alpha, g_value_get_boolean (value));
+      GST_OBJECT_UNLOCK (thiz);
+      return;
+    case PROP_SKIP_TRANSPARENT:
+      g_atomic_int_set (&thiz->skip_transparent, g_value_get_boolean (value));
+      GST_OBJECT_UNLOCK (thiz);
+      return;
+    case PROP_PACKED_LAYOUT:
+      thiz->packed_layout = g_value_get_enum (value);
+      GST_OBJECT_UNLOCK (thiz);
+      return;
+    case PROP_ALPHA_MODE:
+      g_atomic_int_set (&thiz->alpha_mode, g_value_get_enum (value));
+      GST_OBJECT_UNLOCK (thiz);
+      return;
+    case PROP_ALPHA_VALUE:
+      g_atomic_int_set (&thiz->alpha_value, g_value_get_uint (value));
+      GST_OBJECT_UNLOCK (thiz);
+      return;
+    case PROP_PREMULTIPLY:
+      thiz->premultiply = g_value_get_boolean (value);
+      GST_OBJECT_UNLOCK (thiz);
+      gst_pad_mark_reconfigure (thiz->srcpad);
+      return;
+    case PROP_STAGE_META:
+      g_atomic_int_set (&thiz->stage_meta, g_value_get_boolean (value));
+      GST_OBJECT_UNLOCK (thiz);
+      return;
+    case PROP_MASK_CHANNEL:
+      g_atomic_int_set (&thiz->mask_channel, g_value_get_enum (value));
+      GST_OBJECT_UNLOCK (thiz);
+      /* whether the mask can be passed on as it is may have changed */
+      gst_pad_mark_reconfigure (thiz->srcpad);
+      return;
+    case PROP_LATENCY:
+      thiz->latency = g_value_get_uint64 (value);
+      GST_OBJECT_UNLOCK (thiz);
+      gst_element_post_message (GST_ELEMENT_CAST (thiz),
+          gst_message_new_latency (GST_OBJECT_CAST (thiz)));
+      return;
+    case PROP_PREFERRED_FORMAT:
+      thiz->preferred_format = g_value_get_enum (value);
+      GST_OBJECT_UNLOCK (thiz);
+      gst_pad_mark_reconfigure (thiz->srcpad);
+      return;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      GST_OBJECT_UNLOCK (thiz);
+      return;
+  }
+  /* rebuild the converter on the next frame if one was already made */
+  if (thiz->convert)
+    thiz->convert_dirty = TRUE;
+  GST_OBJECT_UNLOCK (thiz);
+}
+
+static void
+gst_alpha_mask_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstAlphaMask *thiz = GST_ALPHA_MASK (object);
+
+  GST_OBJECT_LOCK (thiz);
+  switch (prop_id) {
+    case PROP_DITHER:
+      g_value_set_enum (value, thiz->dither);
+      break;
+    case PROP_CHROMA_RESAMPLER:
+      g_value_set_enum (value, thiz->chroma_resampler);
+      break;
+    case PROP_MATRIX_MODE:
+      g_value_set_enum (value, thiz->matrix_mode);
+      break;
+    case PROP_N_THREADS:
+      g_value_set_uint (value, thiz->n_threads);
+      break;
+    case PROP_CACHE_ALPHA:
+      g_value_set_boolean (value, thiz->cache_alpha);
+      break;
+    case PROP_ALPHA_QUEUE_SIZE:
+      g_value_set_uint (value, thiz->alpha_queue_size);
+      break;
+    case PROP_QOS:
+      g_value_set_boolean (value, thiz->qos);
+      break;
+    case PROP_STATS:
+      g_value_take_boxed (value, gst_alpha_mask_get_stats (thiz));
+      break;
+    case PROP_STATS_INTERVAL:
+      g_value_set_uint (value, thiz->stats_interval);
+      break;
+    case PROP_PREFERRED_FORMAT:
+      g_value_set_enum (value, thiz->preferred_format);
+      break;
+    case PROP_ALPHA_SCALING:
+      g_value_set_enum (value, thiz->alpha_scaling);
+      break;
+    case PROP_ANALYZE_ALPHA:
+      g_value_set_boolean (value, g_atomic_int_get (&thiz->analyze_alpha));
+      break;
+    case PROP_SKIP_TRANSPARENT:
+      g_value_set_boolean (value, g_atomic_int_get (&thiz->skip_transparent));
+      break;
+    case PROP_PACKED_LAYOUT:
+      g_value_set_enum (value, thiz->packed_layout);
+      break;
+    case PROP_LATENCY:
+      g_value_set_uint64 (value, thiz->latency);
+      break;
+    case PROP_ALPHA_MODE:
+      g_value_set_enum (value, g_atomic_int_get (&thiz->alpha_mode));
+      break;
+    case PROP_ALPHA_VALUE:
+      g_value_set_uint (value, g_atomic_int_get (&thiz->alpha_value));
+      break;
+    case PROP_PREMULTIPLY:
+      g_value_set_boolean (value, thiz->premultiply);
+      break;
+    case PROP_STAGE_META:
+      g_value_set_boolean (value, g_atomic_int_get (&thiz->stage_meta));
+      break;
+    case PROP_MASK_CHANNEL:
+      g_value_set_enum (value, g_atomic_int_get (&thiz->mask_channel));
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+  GST_OBJECT_UNLOCK (thiz);
+}
+
 static void
 gst_alpha_mask_class_init (GstAlphaMaskClass * klass)
 {
   GObjectClass *gobject_class;
   GstElementClass *gstelement_class;
+#if GST_CHECK_VERSION (1,14,0)
+  guint i;
+#endif
 
   gobject_class = (GObjectClass *) klass;
   gstelement_class = (GstElementClass *) klass;
 
+  parent_class = g_type_class_peek_parent (klass);
+
+  gobject_class->set_property = gst_alpha_mask_set_property;
+  gobject_class->get_property = gst_alpha_mask_get_property;
   gobject_class->finalize = gst_alpha_mask_finalize;
 
+  g_object_class_install_property (gobject_class, PROP_DITHER,
+      g_param_spec_enum ("dither", "Dither", "Apply dithering while converting",
+          GST_TYPE_VIDEO_DITHER_METHOD, DEFAULT_PROP_DITHER,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_CHROMA_RESAMPLER,
+      g_param_spec_enum ("chroma-resampler", "Chroma resampler",
+          "Chroma resampler method", GST_TYPE_VIDEO_RESAMPLER_METHOD,
+          DEFAULT_PROP_CHROMA_RESAMPLER,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_MATRIX_MODE,
+      g_param_spec_enum ("matrix-mode", "Matrix mode",
+          "Matrix conversion mode", GST_TYPE_VIDEO_MATRIX_MODE,
+          DEFAULT_PROP_MATRIX_MODE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_N_THREADS,
+      g_param_spec_uint ("n-threads", "Threads",
+          "Maximum number of threads to use for conversion and alpha "
+          "insertion (0 = auto)",
+          0, G_MAXINT, DEFAULT_PROP_N_THREADS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_CACHE_ALPHA,
+      g_param_spec_boolean ("cache-alpha", "Cache alpha",
+          "Reuse the alpha plane while the mask doesn't change, A420 output "
+          "then shares a single alpha memory between frames",
+          DEFAULT_PROP_CACHE_ALPHA,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_ALPHA_QUEUE_SIZE,
+      g_param_spec_uint ("alpha-queue-size", "Alpha queue size",
+          "Number of alpha buffers that can be queued ahead of the video",
+          1, 256, DEFAULT_PROP_ALPHA_QUEUE_SIZE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_QOS,
+      g_param_spec_boolean ("qos", "QoS",
+          "Handle Quality-of-Service events and drop late frames before "
+          "converting them", DEFAULT_PROP_QOS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_STATS,
+      g_param_spec_boxed ("stats", "Statistics",
+          "Frame counters and time spent waiting and converting",
+          GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_STATS_INTERVAL,
+      g_param_spec_uint ("stats-interval", "Statistics interval",
+          "Interval in milliseconds for posting the statistics in an element "
+          "message (0 = disabled)", 0, G_MAXUINT, DEFAULT_PROP_STATS_INTERVAL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_PREFERRED_FORMAT,
+      g_param_spec_enum ("preferred-format", "Preferred format",
+          "Output format to use whenever downstream accepts it instead of "
+          "the cheapest one to produce (unknown = cheapest)",
+          GST_TYPE_VIDEO_FORMAT, DEFAULT_PROP_PREFERRED_FORMAT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_ALPHA_SCALING,
+      g_param_spec_enum ("alpha-scaling", "Alpha scaling",
+          "Method to scale masks, or their crop region, that don't match "
+          "the video size", GST_TYPE_ALPHA_MASK_SCALING,
+          DEFAULT_PROP_ALPHA_SCALING,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_ANALYZE_ALPHA,
+      g_param_spec_boolean ("analyze-alpha", "Analyze alpha",
+          "Attach the fully transparent and fully opaque regions of the mask "
+          "to the output as GstVideoRegionOfInterestMeta of type "
+          "alpha-transparent or alpha-opaque", DEFAULT_PROP_ANALYZE_ALPHA,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_SKIP_TRANSPARENT,
+      g_param_spec_boolean ("skip-transparent", "Skip transparent",
+          "Don't convert the video where the mask is fully transparent, the "
+          "color there is left undefined", DEFAULT_PROP_SKIP_TRANSPARENT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_PACKED_LAYOUT,
+      g_param_spec_enum ("packed-layout", "Packed layout",
+          "Take the mask from the luma of one half of the video frames "
+          "instead of the alpha pad", GST_TYPE_ALPHA_MASK_PACKED_LAYOUT,
+          DEFAULT_PROP_PACKED_LAYOUT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_LATENCY,
+      g_param_spec_uint64 ("latency", "Latency",
+          "Additional latency in live mode, the time the mask may arrive "
+          "after the video before the frame goes out with the previous mask "
+          "(or an opaque one)", 0, G_MAXUINT64, DEFAULT_PROP_LATENCY,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_ALPHA_MODE,
+      g_param_spec_enum ("alpha-mode", "Alpha mode",
+          "How frames without a current mask are handled",
+          GST_TYPE_ALPHA_MASK_MODE, DEFAULT_PROP_ALPHA_MODE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_ALPHA_VALUE,
+      g_param_spec_uint ("alpha-value", "Alpha value",
+          "Alpha of the frames in constant mode while the alpha pad is "
+          "unlinked or at EOS", 0, 255, DEFAULT_PROP_ALPHA_VALUE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_PREMULTIPLY,
+      g_param_spec_boolean ("premultiply", "Premultiply",
+          "Multiply the color by the alpha in RGB output, the caps then "
+          "have premultiplied-alpha=true", DEFAULT_PROP_PREMULTIPLY,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_MASK_CHANNEL,
+      g_param_spec_enum ("mask-channel", "Mask channel",
+          "Component of raw masks the alpha is read from",
+          GST_TYPE_ALPHA_MASK_CHANNEL, DEFAULT_PROP_MASK_CHANNEL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+#if GST_CHECK_VERSION (1,14,0)
+  g_object_class_install_property (gobject_class, PROP_STAGE_META,
+      g_param_spec_boolean ("stage-meta", "Stage meta",
+          "Attach reference timestamp metas with the times the frame and "
+          "its mask came in and the frame was done", DEFAULT_PROP_STAGE_META,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  stage_caps[STAGE_VIDEO_IN] =
+      gst_caps_new_empty_simple ("timestamp/x-alphamask-video-in");
+  stage_caps[STAGE_ALPHA_IN] =
+      gst_caps_new_empty_simple ("timestamp/x-alphamask-alpha-in");
+  stage_caps[STAGE_DONE] =
+      gst_caps_new_empty_simple ("timestamp/x-alphamask-done");
+  for (i = 0; i < STAGE_LAST; i++)
+    GST_MINI_OBJECT_FLAG_SET (stage_caps[i],
+        GST_MINI_OBJECT_FLAG_MAY_BE_LEAKED);
+#endif
+
+#if GST_CHECK_VERSION (1,8,0)
+  stage_record = gst_tracer_record_new ("alphamask-stages.class",
+      "element", GST_TYPE_STRUCTURE, gst_structure_new ("scope",
+          "type", G_TYPE_GTYPE, G_TYPE_STRING,
+          "related-to", GST_TYPE_TRACER_VALUE_SCOPE,
+          GST_TRACER_VALUE_SCOPE_ELEMENT, NULL),
+      "video-in", GST_TYPE_STRUCTURE, gst_structure_new ("value",
+          "type", G_TYPE_GTYPE, G_TYPE_UINT64,
+          "description", G_TYPE_STRING, "frame reached the video chain",
+          NULL),
+      "alpha-in", GST_TYPE_STRUCTURE, gst_structure_new ("value",
+          "type", G_TYPE_GTYPE, G_TYPE_UINT64,
+          "description", G_TYPE_STRING, "its mask reached the alpha chain, "
+          "or GST_CLOCK_TIME_NONE", NULL),
+      "done", GST_TYPE_STRUCTURE, gst_structure_new ("value",
+          "type", G_TYPE_GTYPE, G_TYPE_UINT64,
+          "description", G_TYPE_STRING, "frame ready to be pushed", NULL),
+      NULL);
+  GST_OBJECT_FLAG_SET (stage_record, GST_OBJECT_FLAG_MAY_BE_LEAKED);
+#endif
+
   gst_element_class_set_static_metadata (gstelement_class,
       "Alpha mask combinator",
       "Filter/Effect/Video",
@@ -1129,31 +4343,40 @@ gst_alpha_mask_class_init (GstAlphaMaskClass * klass)
 
   gstelement_class->change_state =
       GST_DEBUG_FUNCPTR (gst_alpha_mask_change_state);
+
+  klass->negotiate = GST_DEBUG_FUNCPTR (gst_alpha_mask_negotiate);
+  klass->process = GST_DEBUG_FUNCPTR (gst_alpha_mask_process_default);
+  klass->query = GST_DEBUG_FUNCPTR (gst_alpha_mask_query_default);
 }
 
 static void
-gst_alpha_mask_init (GstAlphaMask * thiz)
+gst_alpha_mask_init (GstAlphaMask * thiz, GstAlphaMaskClass * klass)
 {
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
   GstPadTemplate *template;
 
+  /* the pads follow the templates of the subclass, if any */
+
   /* video sink */
-  template = gst_static_pad_template_get (&vsink_factory);
+  template = gst_element_class_get_pad_template (element_class, "video_sink");
   thiz->video_sinkpad = gst_pad_new_from_template (template, "video_sink");
-  gst_object_unref (template);
   gst_pad_set_chain_function (thiz->video_sinkpad,
       GST_DEBUG_FUNCPTR (gst_alpha_mask_video_chain));
   gst_pad_set_event_function (thiz->video_sinkpad,
       GST_DEBUG_FUNCPTR (gst_alpha_mask_video_event));
+  gst_pad_set_query_function (thiz->video_sinkpad,
+      GST_DEBUG_FUNCPTR (gst_alpha_mask_query));
   gst_element_add_pad (GST_ELEMENT (thiz), thiz->video_sinkpad);
 
   /* alpha sink */
-  template = gst_static_pad_template_get (&asink_factory);
+  template = gst_element_class_get_pad_template (element_class, "alpha_sink");
   thiz->alpha_sinkpad = gst_pad_new_from_template (template, "alpha_sink");
-  gst_object_unref (template);
   gst_pad_set_chain_function (thiz->alpha_sinkpad,
       GST_DEBUG_FUNCPTR (gst_alpha_mask_alpha_chain));
   gst_pad_set_event_function (thiz->alpha_sinkpad,
       GST_DEBUG_FUNCPTR (gst_alpha_mask_alpha_event));
+  gst_pad_set_query_function (thiz->alpha_sinkpad,
+      GST_DEBUG_FUNCPTR (gst_alpha_mask_query));
   gst_pad_set_link_function (thiz->alpha_sinkpad,
       GST_DEBUG_FUNCPTR (gst_alpha_mask_alpha_pad_link));
   gst_pad_set_unlink_function (thiz->alpha_sinkpad,
@@ -1161,15 +4384,81 @@ gst_alpha_mask_init (GstAlphaMask * thiz)
   gst_element_add_pad (GST_ELEMENT (thiz), thiz->alpha_sinkpad);
 
   /* video source */
-  template = gst_static_pad_template_get (&src_factory);
+  template = gst_element_class_get_pad_template (element_class, "src");
   thiz->srcpad = gst_pad_new_from_template (template, "src");
-  gst_object_unref (template);
   gst_pad_set_event_function (thiz->srcpad,
       GST_DEBUG_FUNCPTR (gst_alpha_mask_src_event));
+  gst_pad_set_query_function (thiz->srcpad,
+      GST_DEBUG_FUNCPTR (gst_alpha_mask_query));
   gst_element_add_pad (GST_ELEMENT (thiz), thiz->srcpad);
 
+  /* no alpha caps yet, the format reads as unknown until they arrive */
+  gst_video_info_init (&thiz->ainfo);
+  thiz->alpha_encoding = GST_ALPHA_MASK_ENCODING_RAW;
   thiz->convert = NULL;
+  thiz->converters = NULL;
+  thiz->convert_dirty = FALSE;
+  thiz->fuse = NULL;
+  thiz->in_place = FALSE;
+  thiz->pool = NULL;
+  thiz->dither = DEFAULT_PROP_DITHER;
+  thiz->chroma_resampler = DEFAULT_PROP_CHROMA_RESAMPLER;
+  thiz->matrix_mode = DEFAULT_PROP_MATRIX_MODE;
+  thiz->n_threads = DEFAULT_PROP_N_THREADS;
+  thiz->cache_alpha = DEFAULT_PROP_CACHE_ALPHA;
+  thiz->color_pool = NULL;
+  thiz->cache_mem = NULL;
+  thiz->cache_key = NULL;
+  thiz->cache_key_size = 0;
+  thiz->cache_scaling = DEFAULT_PROP_ALPHA_SCALING;
+  thiz->cache_comp = 0;
+  thiz->alpha_queue_size = DEFAULT_PROP_ALPHA_QUEUE_SIZE;
+  thiz->qos = DEFAULT_PROP_QOS;
+  thiz->proportion = 1.0;
+  thiz->earliest_time = GST_CLOCK_TIME_NONE;
+  thiz->processed = 0;
+  thiz->dropped = 0;
+  thiz->stats_interval = DEFAULT_PROP_STATS_INTERVAL;
+  thiz->preferred_format = DEFAULT_PROP_PREFERRED_FORMAT;
+  thiz->alpha_scaling = DEFAULT_PROP_ALPHA_SCALING;
+  thiz->analyze_alpha = DEFAULT_PROP_ANALYZE_ALPHA;
+  thiz->skip_transparent = DEFAULT_PROP_SKIP_TRANSPARENT;
+  thiz->packed_layout = DEFAULT_PROP_PACKED_LAYOUT;
+  thiz->packed = GST_ALPHA_MASK_PACKED_NONE;
+  thiz->latency = DEFAULT_PROP_LATENCY;
+  thiz->alpha_mode = DEFAULT_PROP_ALPHA_MODE;
+  thiz->alpha_value = DEFAULT_PROP_ALPHA_VALUE;
+  thiz->premultiply = DEFAULT_PROP_PREMULTIPLY;
+  thiz->premultiplied = FALSE;
+  thiz->stage_meta = DEFAULT_PROP_STAGE_META;
+  thiz->mask_channel = DEFAULT_PROP_MASK_CHANNEL;
+  thiz->fill_alpha = -1;
+  thiz->live = FALSE;
+  thiz->upstream_latency = 0;
+  thiz->alpha_last = NULL;
+  thiz->alpha_regions =
+      g_array_new (FALSE, FALSE, sizeof (GstAlphaMaskRegion));
+  thiz->video_dmabuf = FALSE;
+  thiz->alpha_dmabuf = FALSE;
+  thiz->out_dmabuf = FALSE;
+  thiz->dmabuf_disabled = FALSE;
+  memset (&thiz->stats, 0, sizeof (GstAlphaMaskStats));
+  memset (&thiz->frame_stats, 0, sizeof (GstAlphaMaskStats));
+  thiz->stats_posted = GST_CLOCK_TIME_NONE;
+  thiz->alpha_queue = g_new0 (GstAlphaMaskEntry, DEFAULT_PROP_ALPHA_QUEUE_SIZE);
+  thiz->alpha_queue_len = DEFAULT_PROP_ALPHA_QUEUE_SIZE;
+  thiz->alpha_head = 0;
+  thiz->alpha_tail = 0;
+  thiz->alpha_flush_seq = 0;
+  thiz->video_waiting = 0;
+  thiz->alpha_waiting = 0;
   thiz->alpha_buffer = NULL;
+  thiz->alpha_running_time = GST_CLOCK_TIME_NONE;
+  thiz->alpha_arrival = GST_CLOCK_TIME_NONE;
+  thiz->video_arrival = GST_CLOCK_TIME_NONE;
+  thiz->alpha_running_time_end = GST_CLOCK_TIME_NONE;
+  thiz->alpha_last_running_time = GST_CLOCK_TIME_NONE;
+  thiz->alpha_seen_seq = 0;
   thiz->alpha_linked = FALSE;
 
   g_mutex_init (&thiz->lock);
@@ -1184,10 +4473,30 @@ plugin_init (GstPlugin * plugin)
           GST_TYPE_ALPHA_MASK)) {
     return FALSE;
   }
+#ifdef HAVE_GST_GL
+  if (!gst_element_register (plugin, "glalphamask", GST_RANK_NONE,
+          GST_TYPE_GL_ALPHA_MASK)) {
+    return FALSE;
+  }
+#endif
+  if (!gst_element_register (plugin, "multialphamask", GST_RANK_NONE,
+          GST_TYPE_MULTI_ALPHA_MASK)) {
+    return FALSE;
+  }
 
   GST_DEBUG_CATEGORY_INIT (alphamask_debug, "alphamask", 0,
       "Alpha mask element");
 
+  gst_alpha_mask_kernels_init ();
+  copy_alpha_packed_func =
+      gst_alpha_mask_get_copy_alpha_packed (gst_alpha_mask_get_cpu_flags ());
+  premultiply_func =
+      gst_alpha_mask_get_premultiply (gst_alpha_mask_get_cpu_flags ());
+  copy_alpha_premultiply_func =
+      gst_alpha_mask_get_copy_alpha_premultiply
+      (gst_alpha_mask_get_cpu_flags ());
+  GST_DEBUG ("cpu flags 0x%x", gst_alpha_mask_get_cpu_flags ());
+
   return TRUE;
 }
 
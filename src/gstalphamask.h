@@ -23,6 +23,8 @@
 #include <gst/gst.h>
 #include <gst/video/video.h>
 
+#include "alphakernels.h"
+
 G_BEGIN_DECLS
 
 #define GST_TYPE_ALPHA_MASK            (gst_alpha_mask_get_type())
@@ -40,6 +42,116 @@ G_BEGIN_DECLS
 typedef struct _GstAlphaMask      GstAlphaMask;
 typedef struct _GstAlphaMaskClass GstAlphaMaskClass;
 
+/**
+ * GstAlphaMaskScaling:
+ * @GST_ALPHA_MASK_SCALING_NEAREST: nearest neighbour
+ * @GST_ALPHA_MASK_SCALING_BILINEAR: bilinear interpolation
+ *
+ * How masks that don't match the video size are scaled.
+ */
+typedef enum {
+    GST_ALPHA_MASK_SCALING_NEAREST,
+    GST_ALPHA_MASK_SCALING_BILINEAR,
+} GstAlphaMaskScaling;
+
+/**
+ * GstAlphaMaskPackedLayout:
+ * @GST_ALPHA_MASK_PACKED_NONE: the mask comes from the alpha pad
+ * @GST_ALPHA_MASK_PACKED_SIDE_BY_SIDE: color on the left, mask on the right
+ * @GST_ALPHA_MASK_PACKED_TOP_BOTTOM: color on top, mask at the bottom
+ *
+ * Where the mask is found in the video frames. Packed masks are the luma of
+ * their half of the frame.
+ */
+typedef enum {
+    GST_ALPHA_MASK_PACKED_NONE,
+    GST_ALPHA_MASK_PACKED_SIDE_BY_SIDE,
+    GST_ALPHA_MASK_PACKED_TOP_BOTTOM,
+} GstAlphaMaskPackedLayout;
+
+/**
+ * GstAlphaMaskMode:
+ * @GST_ALPHA_MASK_MODE_STRICT: every frame waits for the mask of its time
+ * @GST_ALPHA_MASK_MODE_HOLD_LAST: the previous mask is used until the next
+ *   one is due, without waiting
+ * @GST_ALPHA_MASK_MODE_CONSTANT: like strict, but without a mask stream the
+ *   alpha is set to a constant
+ *
+ * How frames without a current mask are handled.
+ */
+typedef enum {
+    GST_ALPHA_MASK_MODE_STRICT,
+    GST_ALPHA_MASK_MODE_HOLD_LAST,
+    GST_ALPHA_MASK_MODE_CONSTANT,
+} GstAlphaMaskMode;
+
+/**
+ * GstAlphaMaskChannel:
+ * @GST_ALPHA_MASK_CHANNEL_AUTO: the alpha of masks that have one, else the
+ *   first component
+ * @GST_ALPHA_MASK_CHANNEL_LUMA: the luma of YUV masks
+ * @GST_ALPHA_MASK_CHANNEL_ALPHA: the alpha of masks that have one
+ * @GST_ALPHA_MASK_CHANNEL_RED: the red of RGB masks
+ * @GST_ALPHA_MASK_CHANNEL_GREEN: the green of RGB masks
+ * @GST_ALPHA_MASK_CHANNEL_BLUE: the blue of RGB masks
+ *
+ * Which component of a raw mask is the alpha. A channel the mask format
+ * lacks falls back to the first component.
+ */
+typedef enum {
+    GST_ALPHA_MASK_CHANNEL_AUTO,
+    GST_ALPHA_MASK_CHANNEL_LUMA,
+    GST_ALPHA_MASK_CHANNEL_ALPHA,
+    GST_ALPHA_MASK_CHANNEL_RED,
+    GST_ALPHA_MASK_CHANNEL_GREEN,
+    GST_ALPHA_MASK_CHANNEL_BLUE,
+} GstAlphaMaskChannel;
+
+/**
+ * GstAlphaMaskEncoding:
+ * @GST_ALPHA_MASK_ENCODING_RAW: raw video, the mask is the first plane
+ * @GST_ALPHA_MASK_ENCODING_RLE: run-length encoded lines
+ * @GST_ALPHA_MASK_ENCODING_BITMAP: 1 bit per pixel
+ *
+ * How the alpha buffers carry the mask.
+ */
+typedef enum {
+    GST_ALPHA_MASK_ENCODING_RAW,
+    GST_ALPHA_MASK_ENCODING_RLE,
+    GST_ALPHA_MASK_ENCODING_BITMAP,
+} GstAlphaMaskEncoding;
+
+/* a queued alpha buffer with its running time, @running_time_end is
+ * GST_CLOCK_TIME_NONE when the buffer has no usable timestamp or duration */
+typedef struct {
+    GstBuffer                *buffer;
+    GstClockTime              running_time;
+    GstClockTime              running_time_end;
+    GstClockTime              arrival;  /* gst_util_get_timestamp() when it
+                                         * reached the alpha chain */
+} GstAlphaMaskEntry;
+
+/* time spent in one place, in nanoseconds */
+typedef struct {
+    guint64                   count;
+    GstClockTime              total;
+    GstClockTime              max;
+} GstAlphaMaskTiming;
+
+typedef struct {
+    guint64                   frames_in;
+    guint64                   frames_out;   /* pushed downstream */
+    guint64                   frames_dropped; /* not pushed, for any
+                                               * reason */
+    guint64                   alpha_too_old;
+    guint64                   alpha_in_future;
+    guint64                   alpha_late;   /* live, frames sent without
+                                             * waiting for their mask */
+    GstAlphaMaskTiming        video_wait;   /* video chain waiting for alpha */
+    GstAlphaMaskTiming        alpha_wait;   /* alpha chain waiting for room */
+    GstAlphaMaskTiming        convert;
+} GstAlphaMaskStats;
+
 /**
  * GstAlphaMask:
  *
@@ -54,13 +166,37 @@ struct _GstAlphaMask {
 
     GstSegment               segment;
     GstSegment               alpha_segment;
+
+    /* Single producer, single consumer ring of alpha buffers. The alpha
+     * chain publishes entries by moving the tail, entries are taken by
+     * moving the head with a compare and exchange. The lock is only taken
+     * to wait for the other side. */
+    GstAlphaMaskEntry       *alpha_queue;
+    guint                    alpha_queue_len;
+    gint                     alpha_head;
+    gint                     alpha_tail;
+    gint                     alpha_flush_seq;
+    gint                     video_waiting;
+    gint                     alpha_waiting;
+
+    /* alpha buffer in use, owned by the video streaming thread */
     GstBuffer               *alpha_buffer;
+    GstClockTime             alpha_running_time;
+    GstClockTime             alpha_running_time_end;
+    GstClockTime             alpha_arrival;
+    GstClockTime             alpha_last_running_time;
+    GstBuffer               *alpha_last;  /* previous mask, used when live
+                                           * and the next one is late, or
+                                           * held */
+    gint                     alpha_seen_seq;
+    GstClockTime             video_arrival;  /* of the frame in the video
+                                              * chain */
     gboolean                 alpha_linked;
     gboolean                 video_flushing;
-    gboolean                 video_eos;
+    gboolean                 video_eos;  /* atomic, set under the lock */
     gboolean                 video_segment_done;
     gboolean                 alpha_flushing;
-    gboolean                 alpha_eos;
+    gboolean                 alpha_eos;  /* atomic, set under the lock */
     gboolean                 alpha_segment_done;
 
     GMutex                   lock;
@@ -71,22 +207,126 @@ struct _GstAlphaMask {
 
     /* stream details */
     GstVideoInfo             iinfo;
-    GstVideoInfo             ainfo;
+    GstVideoInfo             ainfo;  /* only the size for compact masks */
+    GstAlphaMaskEncoding     alpha_encoding;
+    GstAlphaMaskPackedLayout packed;  /* layout in use, iinfo and ainfo
+                                       * describe the halves of the frame */
     GstVideoInfo             oinfo;
+    GstVideoInfo             cinfo;  /* color planes produced by the converter */
     gint                     width;
     gint                     height;
     GstVideoFormat           iformat;
     GstVideoFormat           oformat;
 
-    GstVideoConverter       *convert;
+    /* memory:DMABuf caps feature on the pads */
+    gboolean                 video_dmabuf;
+    gboolean                 alpha_dmabuf;
+    gboolean                 out_dmabuf;
+    gboolean                 dmabuf_disabled;  /* planes didn't fit */
+
+    GstVideoConverter       *convert;  /* owned by the cache below */
+    GList                   *converters;  /* recently used, newest first */
+    gboolean                 convert_dirty;
+    GstAlphaMaskFuseLineFunc fuse;  /* single pass convert + alpha, or NULL */
+    GstAlphaMaskYuvMatrix    fuse_matrix;  /* of a YUV to RGB fuse */
+    gboolean                 in_place;  /* input already in output format */
+    gboolean                 premultiplied;  /* RGB output, premultiply set */
+
+    /* slices the alpha pass is split into at most, they run on a pool
+     * shared by all instances */
+    guint                    n_slices;
+
+    /* properties */
+    GstVideoDitherMethod     dither;
+    GstVideoResamplerMethod  chroma_resampler;
+    GstVideoMatrixMode       matrix_mode;
+    guint                    n_threads;
+    gboolean                 cache_alpha;
+    guint                    alpha_queue_size;
+    gboolean                 qos;
+    guint                    stats_interval;
+    GstVideoFormat           preferred_format;
+    GstAlphaMaskScaling      alpha_scaling;
+    GstAlphaMaskPackedLayout packed_layout;
+    GstClockTime             latency;
+    gboolean                 premultiply;
+    GstAlphaMaskMode         alpha_mode;
+    guint                    alpha_value;
+    gboolean                 stage_meta;
+    GstAlphaMaskChannel      mask_channel;
+
+    /* upstream latency, from the last LATENCY query, protected by the object
+     * lock */
+    gboolean                 live;
+    GstClockTime             upstream_latency;
+    gboolean                 analyze_alpha;
+    gboolean                 skip_transparent;
+
+    /* uniform regions of the current mask in output coordinates, made once
+     * per mask buffer and owned by the video streaming thread */
+    gboolean                 analysis_valid;
+    GArray                  *alpha_regions;
+    guint8                  *clear_lines;  /* output lines fully transparent */
+    guint                    clear_lines_len;
+    gboolean                 frame_clear;
+    gboolean                 skip_clear;  /* color work skipped this frame */
+    gint                     fill_alpha;  /* constant alpha of this frame,
+                                           * or -1, set before process */
+
+    /* output buffer allocation */
+    GstBufferPool           *pool;
+    gboolean                 use_video_meta;
+
+    /* QoS, protected by the object lock */
+    gdouble                  proportion;
+    GstClockTime             earliest_time;
+    guint64                  processed;
+    guint64                  dropped;
+
+    /* statistics, protected by the object lock. The frame stats are
+     * collected by the video chain and folded in once per frame. */
+    GstAlphaMaskStats        stats;
+    GstAlphaMaskStats        frame_stats;
+    GstClockTime             stats_posted;
+
+    /* alpha plane cache, A420 color planes are pooled on their own */
+    GstBufferPool           *color_pool;
+    GstMemory               *cache_mem;  /* prepared alpha plane */
+    guint64                  cache_hash;
+    guint8                  *cache_key;  /* copy of the mask it was made from */
+    gsize                    cache_key_size;
+    GstVideoRectangle        cache_rect;  /* mask region it was made from */
+    GstAlphaMaskScaling      cache_scaling;
+    guint                    cache_comp;  /* mask component it was made from */
 };
 
+/**
+ * GstAlphaMaskClass:
+ * @negotiate: configure the output for the video caps @caps, called again
+ *     when downstream asks to reconfigure
+ * @process: combine @video with the current alpha buffer, which may be NULL,
+ *     takes ownership of @video and sets @output to the buffer to push, or
+ *     to NULL to drop the frame. Errors are returned as a #GstFlowReturn.
+ * @query: handle a query on any of the pads
+ *
+ * Subclasses replace the pad templates and keep the stream synchronisation
+ * of the base class.
+ */
 struct _GstAlphaMaskClass {
     GstElementClass parent_class;
+
+    gboolean      (*negotiate) (GstAlphaMask * thiz, GstCaps * caps);
+    GstFlowReturn (*process)   (GstAlphaMask * thiz, GstBuffer * video,
+                                GstBuffer ** output);
+    gboolean      (*query)     (GstAlphaMask * thiz, GstPad * pad,
+                                GstQuery * query);
 };
 
 GType gst_alpha_mask_get_type(void) G_GNUC_CONST;
 
+/* for subclasses, the mask component the mask-channel property picks */
+guint gst_alpha_mask_mask_comp (GstAlphaMask * thiz);
+
 G_END_DECLS
 
 #endif /* __GST_ALPHA_MASK_H */
@@ -0,0 +1,700 @@
+/* GStreamer AlphaMask plugin
+ * Copyright (C) 2016 Oblong Industries
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/**
+ * SECTION:element-glalphamask
+ *
+ * The glalphamask element is the OpenGL variant of alphamask. It takes
+ * the video and the alpha mask as textures and renders RGBA textures where
+ * the alpha comes from the mask channel picked like alphamask does, without
+ * going through system memory. The streams are synchronised like alphamask
+ * does, the alpha-mode and premultiply properties work the same too.
+ *
+ * The properties of alphamask that configure its system memory paths have
+ * no effect here: dither, chroma-resampler, matrix-mode, n-threads,
+ * cache-alpha, alpha-scaling, analyze-alpha, skip-transparent,
+ * preferred-format and packed-layout. A mask of another size is scaled by
+ * the texture sampler and the output is always RGBA.
+ *
+ * Sample pipeline:
+ * |[
+ * gst-launch-1.0 videotestsrc pattern=18 ! glupload ! am.alpha_sink \
+ *   videotestsrc ! glupload ! glalphamask name=am ! glvideomixer ! \
+ *   glimagesink
+ * ]|
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstglalphamask.h"
+
+GST_DEBUG_CATEGORY_STATIC (glalphamask_debug);
+#define GST_CAT_DEFAULT glalphamask_debug
+
+#define SUPPORTED_GL_APIS \
+    (GST_GL_API_OPENGL | GST_GL_API_OPENGL3 | GST_GL_API_GLES2)
+
+static GstStaticPadTemplate vsink_factory =
+GST_STATIC_PAD_TEMPLATE ("video_sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (GST_VIDEO_CAPS_MAKE_WITH_FEATURES
+        (GST_CAPS_FEATURE_MEMORY_GL_MEMORY, "RGBA") ", "
+        "texture-target = (string) 2D")
+    );
+
+static GstStaticPadTemplate asink_factory =
+GST_STATIC_PAD_TEMPLATE ("alpha_sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (GST_VIDEO_CAPS_MAKE_WITH_FEATURES
+        (GST_CAPS_FEATURE_MEMORY_GL_MEMORY, "{ GRAY8, RGBA }") ", "
+        "texture-target = (string) 2D")
+    );
+
+static GstStaticPadTemplate src_factory =
+GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (GST_VIDEO_CAPS_MAKE_WITH_FEATURES
+        (GST_CAPS_FEATURE_MEMORY_GL_MEMORY, "RGBA") ", "
+        "texture-target = (string) 2D")
+    );
+
+#define gst_gl_alpha_mask_parent_class parent_class
+G_DEFINE_TYPE_WITH_CODE (GstGLAlphaMask, gst_gl_alpha_mask,
+    GST_TYPE_ALPHA_MASK, GST_DEBUG_CATEGORY_INIT (glalphamask_debug,
+        "glalphamask", 0, "OpenGL alpha mask element"));
+
+/* the mask channel is picked by a dot product with a unit vector, the red
+ * channel is the luma for GRAY8. Without mask the alpha is fill_alpha, 1.0
+ * unless it is constant. */
+static const gchar *alpha_mask_fragment =
+    "#ifdef GL_ES\n"
+    "precision mediump float;\n"
+    "#endif\n"
+    "varying vec2 v_texcoord;\n"
+    "uniform sampler2D video_tex;\n"
+    "uniform sampler2D alpha_tex;\n"
+    "uniform vec4 channel;\n"
+    "uniform float have_alpha;\n"
+    "uniform float fill_alpha;\n"
+    "uniform float premultiply;\n"
+    "void main ()\n"
+    "{\n"
+    "  vec4 rgba = texture2D (video_tex, v_texcoord);\n"
+    "  float a = mix (fill_alpha,\n"
+    "      dot (texture2D (alpha_tex, v_texcoord), channel), have_alpha);\n"
+    "  gl_FragColor = vec4 (rgba.rgb * mix (1.0, a, premultiply), a);\n"
+    "}\n";
+
+static const GLfloat vertices[] = {
+  -1.0f, -1.0f, 0.0f, 0.0f, 0.0f,
+  1.0f, -1.0f, 0.0f, 1.0f, 0.0f,
+  1.0f, 1.0f, 0.0f, 1.0f, 1.0f,
+  -1.0f, 1.0f, 0.0f, 0.0f, 1.0f,
+};
+
+static const GLushort indices[] = { 0, 1, 2, 0, 2, 3 };
+
+static void
+gst_gl_alpha_mask_release_gl (GstGLAlphaMask * thiz)
+{
+  if (thiz->context) {
+    gst_object_unref (thiz->context);
+    thiz->context = NULL;
+  }
+  if (thiz->other_context) {
+    gst_object_unref (thiz->other_context);
+    thiz->other_context = NULL;
+  }
+  if (thiz->display) {
+    gst_object_unref (thiz->display);
+    thiz->display = NULL;
+  }
+}
+
+static void
+gst_gl_alpha_mask_set_pool (GstGLAlphaMask * thiz, GstBufferPool * pool)
+{
+  if (thiz->pool) {
+    gst_buffer_pool_set_active (thiz->pool, FALSE);
+    gst_object_unref (thiz->pool);
+  }
+  thiz->pool = pool;
+}
+
+/* Finds the GL display and a context to render with, either shared by the
+ * application and the neighbour elements or made by us */
+static gboolean
+gst_gl_alpha_mask_ensure_context (GstGLAlphaMask * thiz)
+{
+  GError *error = NULL;
+
+  if (!gst_gl_ensure_element_data (thiz, &thiz->display,
+          &thiz->other_context))
+    return FALSE;
+
+  gst_gl_display_filter_gl_api (thiz->display, SUPPORTED_GL_APIS);
+
+  if (thiz->context)
+    return TRUE;
+
+  GST_OBJECT_LOCK (thiz->display);
+  do {
+    if (thiz->context) {
+      gst_object_unref (thiz->context);
+      thiz->context = NULL;
+    }
+    thiz->context =
+        gst_gl_display_get_gl_context_for_thread (thiz->display, NULL);
+    if (!thiz->context) {
+      if (!gst_gl_display_create_context (thiz->display, thiz->other_context,
+              &thiz->context, &error)) {
+        GST_OBJECT_UNLOCK (thiz->display);
+        goto context_error;
+      }
+    }
+  } while (!gst_gl_display_add_context (thiz->display, thiz->context));
+  GST_OBJECT_UNLOCK (thiz->display);
+
+  return TRUE;
+
+  /* ERRORS */
+context_error:
+  {
+    GST_ELEMENT_ERROR (thiz, RESOURCE, NOT_FOUND, ("%s", error->message),
+        (NULL));
+    g_clear_error (&error);
+    return FALSE;
+  }
+}
+
+/* GL thread: makes the shader and the quad once, the framebuffer whenever
+ * the output size changes */
+static void
+gst_gl_alpha_mask_gl_setup (GstGLContext * context, GstGLAlphaMask * thiz)
+{
+  GstAlphaMask *base = GST_ALPHA_MASK (thiz);
+  const GstGLFuncs *gl = context->gl_vtable;
+  GError *error = NULL;
+
+  thiz->gl_ok = FALSE;
+
+  if (!thiz->shader) {
+    thiz->shader = gst_gl_shader_new_link_with_stages (context, &error,
+        gst_glsl_stage_new_default_vertex (context),
+        gst_glsl_stage_new_with_string (context, GL_FRAGMENT_SHADER,
+            GST_GLSL_VERSION_NONE,
+            GST_GLSL_PROFILE_ES | GST_GLSL_PROFILE_COMPATIBILITY,
+            alpha_mask_fragment), NULL);
+    if (!thiz->shader) {
+      GST_ERROR_OBJECT (thiz, "failed to build shader: %s",
+          error ? error->message : "unknown");
+      g_clear_error (&error);
+      return;
+    }
+  }
+
+  if (!thiz->vertex_buffer) {
+    if (gl->GenVertexArrays) {
+      gl->GenVertexArrays (1, &thiz->vao);
+      gl->BindVertexArray (thiz->vao);
+    }
+
+    gl->GenBuffers (1, &thiz->vertex_buffer);
+    gl->BindBuffer (GL_ARRAY_BUFFER, thiz->vertex_buffer);
+    gl->BufferData (GL_ARRAY_BUFFER, sizeof (vertices), vertices,
+        GL_STATIC_DRAW);
+
+    gl->GenBuffers (1, &thiz->index_buffer);
+    gl->BindBuffer (GL_ELEMENT_ARRAY_BUFFER, thiz->index_buffer);
+    gl->BufferData (GL_ELEMENT_ARRAY_BUFFER, sizeof (indices), indices,
+        GL_STATIC_DRAW);
+
+    if (gl->GenVertexArrays)
+      gl->BindVertexArray (0);
+    gl->BindBuffer (GL_ARRAY_BUFFER, 0);
+    gl->BindBuffer (GL_ELEMENT_ARRAY_BUFFER, 0);
+  }
+
+  if (thiz->fbo)
+    gst_object_unref (thiz->fbo);
+  thiz->fbo = gst_gl_framebuffer_new_with_default_depth (context,
+      base->width, base->height);
+
+  thiz->gl_ok = TRUE;
+}
+
+/* GL thread: releases everything made by gst_gl_alpha_mask_gl_setup() */
+static void
+gst_gl_alpha_mask_gl_reset (GstGLContext * context, GstGLAlphaMask * thiz)
+{
+  const GstGLFuncs *gl = context->gl_vtable;
+
+  if (thiz->vao) {
+    gl->DeleteVertexArrays (1, &thiz->vao);
+    thiz->vao = 0;
+  }
+  if (thiz->vertex_buffer) {
+    gl->DeleteBuffers (1, &thiz->vertex_buffer);
+    thiz->vertex_buffer = 0;
+  }
+  if (thiz->index_buffer) {
+    gl->DeleteBuffers (1, &thiz->index_buffer);
+    thiz->index_buffer = 0;
+  }
+  if (thiz->shader) {
+    gst_object_unref (thiz->shader);
+    thiz->shader = NULL;
+  }
+  if (thiz->fbo) {
+    gst_object_unref (thiz->fbo);
+    thiz->fbo = NULL;
+  }
+}
+
+static void
+gst_gl_alpha_mask_bind_quad (GstGLAlphaMask * thiz, const GstGLFuncs * gl)
+{
+  GLint pos, tex;
+
+  gl->BindBuffer (GL_ARRAY_BUFFER, thiz->vertex_buffer);
+  gl->BindBuffer (GL_ELEMENT_ARRAY_BUFFER, thiz->index_buffer);
+
+  pos = gst_gl_shader_get_attribute_location (thiz->shader, "a_position");
+  tex = gst_gl_shader_get_attribute_location (thiz->shader, "a_texcoord");
+
+  gl->VertexAttribPointer (pos, 3, GL_FLOAT, GL_FALSE, 5 * sizeof (GLfloat),
+      (void *) 0);
+  gl->VertexAttribPointer (tex, 2, GL_FLOAT, GL_FALSE, 5 * sizeof (GLfloat),
+      (void *) (3 * sizeof (GLfloat)));
+  gl->EnableVertexAttribArray (pos);
+  gl->EnableVertexAttribArray (tex);
+}
+
+/* GL thread, with the output framebuffer bound */
+static gboolean
+gst_gl_alpha_mask_draw (GstGLAlphaMask * thiz)
+{
+  GstAlphaMask *base = GST_ALPHA_MASK (thiz);
+  GstGLContext *context = thiz->context;
+  const GstGLFuncs *gl = context->gl_vtable;
+  gfloat channel[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+  gst_gl_shader_use (thiz->shader);
+
+  gl->ActiveTexture (GL_TEXTURE0);
+  gl->BindTexture (GL_TEXTURE_2D, thiz->video_tex);
+  gst_gl_shader_set_uniform_1i (thiz->shader, "video_tex", 0);
+
+  gl->ActiveTexture (GL_TEXTURE1);
+  gl->BindTexture (GL_TEXTURE_2D, thiz->alpha_tex);
+  gst_gl_shader_set_uniform_1i (thiz->shader, "alpha_tex", 1);
+  /* RGBA textures keep the components in their GstVideoFormat order */
+  channel[gst_alpha_mask_mask_comp (base)] = 1.0f;
+  gst_gl_shader_set_uniform_4fv (thiz->shader, "channel", 1, channel);
+  gst_gl_shader_set_uniform_1f (thiz->shader, "have_alpha",
+      thiz->alpha_tex ? 1.0f : 0.0f);
+  gst_gl_shader_set_uniform_1f (thiz->shader, "fill_alpha",
+      base->fill_alpha < 0 ? 1.0f : base->fill_alpha / 255.0f);
+  gst_gl_shader_set_uniform_1f (thiz->shader, "premultiply",
+      base->premultiplied ? 1.0f : 0.0f);
+
+  if (gl->GenVertexArrays)
+    gl->BindVertexArray (thiz->vao);
+  gst_gl_alpha_mask_bind_quad (thiz, gl);
+
+  gl->DrawElements (GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+
+  if (gl->GenVertexArrays)
+    gl->BindVertexArray (0);
+  gl->BindBuffer (GL_ARRAY_BUFFER, 0);
+  gl->BindBuffer (GL_ELEMENT_ARRAY_BUFFER, 0);
+  gl->ActiveTexture (GL_TEXTURE0);
+  gst_gl_context_clear_shader (context);
+
+  return TRUE;
+}
+
+static void
+gst_gl_alpha_mask_gl_render (GstGLContext * context, GstGLAlphaMask * thiz)
+{
+  thiz->gl_ok = gst_gl_framebuffer_draw_to_texture (thiz->fbo, thiz->out_mem,
+      (GstGLFramebufferFunc) gst_gl_alpha_mask_draw, thiz);
+}
+
+/* Send an ALLOCATION query downstream and set up a GL pool for the output
+ * textures, reusing the downstream one when it's a GL pool */
+static gboolean
+gst_gl_alpha_mask_decide_allocation (GstGLAlphaMask * thiz, GstCaps * caps)
+{
+  GstAlphaMask *base = GST_ALPHA_MASK (thiz);
+  GstQuery *query;
+  GstBufferPool *pool = NULL;
+  GstStructure *config;
+  guint size, min = 0, max = 0;
+
+  size = GST_VIDEO_INFO_SIZE (&base->oinfo);
+
+  query = gst_query_new_allocation (caps, TRUE);
+  if (!gst_pad_peer_query (base->srcpad, query))
+    GST_DEBUG_OBJECT (thiz, "peer ALLOCATION query failed");
+
+  if (gst_query_get_n_allocation_pools (query) > 0) {
+    gst_query_parse_nth_allocation_pool (query, 0, &pool, &size, &min, &max);
+    if (pool && !GST_IS_GL_BUFFER_POOL (pool)) {
+      gst_object_unref (pool);
+      pool = NULL;
+    }
+  }
+  gst_query_unref (query);
+
+  if (!pool) {
+    GST_DEBUG_OBJECT (thiz, "no downstream GL pool, making our own");
+    pool = gst_gl_buffer_pool_new (thiz->context);
+  }
+
+  config = gst_buffer_pool_get_config (pool);
+  gst_buffer_pool_config_set_params (config, caps, size, min, max);
+  gst_buffer_pool_config_add_option (config, GST_BUFFER_POOL_OPTION_VIDEO_META);
+  gst_buffer_pool_config_add_option (config,
+      GST_BUFFER_POOL_OPTION_GL_SYNC_META);
+
+  if (!gst_buffer_pool_set_config (pool, config))
+    goto config_failed;
+
+  if (!gst_buffer_pool_set_active (pool, TRUE))
+    goto activate_failed;
+
+  gst_gl_alpha_mask_set_pool (thiz, pool);
+
+  return TRUE;
+
+  /* ERRORS */
+config_failed:
+  {
+    GST_ERROR_OBJECT (thiz, "failed to configure buffer pool");
+    gst_object_unref (pool);
+    return FALSE;
+  }
+activate_failed:
+  {
+    GST_ERROR_OBJECT (thiz, "failed to activate buffer pool");
+    gst_object_unref (pool);
+    return FALSE;
+  }
+}
+
+static gboolean
+gst_gl_alpha_mask_negotiate (GstAlphaMask * base, GstCaps * caps)
+{
+  GstGLAlphaMask *thiz = GST_GL_ALPHA_MASK (base);
+  GstCaps *output_caps;
+  GstVideoInfo info;
+  gboolean ret;
+
+  GST_DEBUG_OBJECT (thiz, "performing negotiation");
+
+  /* Clear any pending reconfigure to avoid negotiating twice */
+  gst_pad_check_reconfigure (base->srcpad);
+
+  if (!gst_gl_alpha_mask_ensure_context (thiz))
+    return FALSE;
+
+  gst_video_info_set_format (&info, GST_VIDEO_FORMAT_RGBA, base->width,
+      base->height);
+  info.par_n = base->iinfo.par_n;
+  info.par_d = base->iinfo.par_d;
+  info.fps_n = base->iinfo.fps_n;
+  info.fps_d = base->iinfo.fps_d;
+  info.colorimetry = base->iinfo.colorimetry;
+
+  GST_OBJECT_LOCK (thiz);
+  base->premultiplied = base->premultiply;
+  GST_OBJECT_UNLOCK (thiz);
+  if (base->premultiplied)
+    GST_VIDEO_INFO_FLAGS (&info) |= GST_VIDEO_FLAG_PREMULTIPLIED_ALPHA;
+
+  base->oinfo = info;
+  base->oformat = GST_VIDEO_FORMAT_RGBA;
+
+  output_caps = gst_video_info_to_caps (&info);
+  if (base->premultiplied)
+    gst_caps_set_simple (output_caps, "premultiplied-alpha", G_TYPE_BOOLEAN,
+        TRUE, NULL);
+  gst_caps_set_features (output_caps, 0,
+      gst_caps_features_new (GST_CAPS_FEATURE_MEMORY_GL_MEMORY, NULL));
+  gst_caps_set_simple (output_caps, "texture-target", G_TYPE_STRING,
+      GST_GL_TEXTURE_TARGET_2D_STR, NULL);
+
+  GST_DEBUG_OBJECT (thiz, "output video caps %" GST_PTR_FORMAT, output_caps);
+  ret = gst_pad_set_caps (base->srcpad, output_caps);
+  if (ret)
+    ret = gst_gl_alpha_mask_decide_allocation (thiz, output_caps);
+  if (ret) {
+    gst_gl_context_thread_add (thiz->context,
+        (GstGLContextThreadFunc) gst_gl_alpha_mask_gl_setup, thiz);
+    ret = thiz->gl_ok;
+  }
+
+  if (!ret) {
+    GST_DEBUG_OBJECT (thiz, "negotiation failed, schedule reconfigure");
+    gst_pad_mark_reconfigure (base->srcpad);
+  }
+
+  gst_caps_unref (output_caps);
+
+  return ret;
+}
+
+static void
+gst_gl_alpha_mask_wait (GstGLAlphaMask * thiz, GstBuffer * buffer)
+{
+  GstGLSyncMeta *sync_meta = gst_buffer_get_gl_sync_meta (buffer);
+
+  if (sync_meta)
+    gst_gl_sync_meta_wait (sync_meta, thiz->context);
+}
+
+static GstFlowReturn
+gst_gl_alpha_mask_process (GstAlphaMask * base, GstBuffer * ibuf,
+    GstBuffer ** output)
+{
+  GstGLAlphaMask *thiz = GST_GL_ALPHA_MASK (base);
+  GstBuffer *abuf = base->alpha_buffer;
+  GstBuffer *obuf = NULL;
+  GstVideoFrame iframe, aframe, oframe;
+  gboolean have_alpha = FALSE;
+  GstGLSyncMeta *sync_meta;
+  GstFlowReturn ret;
+
+  *output = NULL;
+
+  ret = gst_buffer_pool_acquire_buffer (thiz->pool, &obuf, NULL);
+  if (ret != GST_FLOW_OK) {
+    GST_DEBUG_OBJECT (thiz, "could not acquire output buffer: %s",
+        gst_flow_get_name (ret));
+    goto beach;
+  }
+
+  ret = GST_FLOW_ERROR;
+  gst_gl_alpha_mask_wait (thiz, ibuf);
+  if (!gst_video_frame_map (&iframe, &base->iinfo, ibuf,
+          GST_MAP_READ | GST_MAP_GL)) {
+    GST_ELEMENT_ERROR (thiz, RESOURCE, READ, (NULL),
+        ("failed to map video texture"));
+    goto beach;
+  }
+
+  if (abuf) {
+    gst_gl_alpha_mask_wait (thiz, abuf);
+    have_alpha = gst_video_frame_map (&aframe, &base->ainfo, abuf,
+        GST_MAP_READ | GST_MAP_GL);
+    if (!have_alpha)
+      GST_WARNING_OBJECT (thiz, "failed to map alpha texture");
+  }
+
+  if (!gst_video_frame_map (&oframe, &base->oinfo, obuf,
+          GST_MAP_WRITE | GST_MAP_GL)) {
+    GST_ELEMENT_ERROR (thiz, RESOURCE, WRITE, (NULL),
+        ("failed to map output texture"));
+    if (have_alpha)
+      gst_video_frame_unmap (&aframe);
+    gst_video_frame_unmap (&iframe);
+    goto beach;
+  }
+
+  thiz->video_tex = *(guint *) iframe.data[0];
+  thiz->alpha_tex = have_alpha ? *(guint *) aframe.data[0] : 0;
+  thiz->out_mem = (GstGLMemory *) oframe.map[0].memory;
+
+  gst_gl_context_thread_add (thiz->context,
+      (GstGLContextThreadFunc) gst_gl_alpha_mask_gl_render, thiz);
+
+  thiz->out_mem = NULL;
+  gst_video_frame_unmap (&oframe);
+  if (have_alpha)
+    gst_video_frame_unmap (&aframe);
+  gst_video_frame_unmap (&iframe);
+
+  if (!thiz->gl_ok) {
+    GST_ELEMENT_ERROR (thiz, RESOURCE, FAILED, (NULL), ("failed to render"));
+    goto beach;
+  }
+
+  sync_meta = gst_buffer_get_gl_sync_meta (obuf);
+  if (sync_meta)
+    gst_gl_sync_meta_set_sync_point (sync_meta, thiz->context);
+
+  gst_buffer_copy_into (obuf, ibuf, GST_BUFFER_COPY_FLAGS |
+      GST_BUFFER_COPY_TIMESTAMPS, 0, -1);
+  gst_buffer_unref (ibuf);
+
+  *output = obuf;
+  return GST_FLOW_OK;
+
+beach:
+  if (obuf)
+    gst_buffer_unref (obuf);
+  gst_buffer_unref (ibuf);
+
+  return ret;
+}
+
+static gboolean
+gst_gl_alpha_mask_query (GstAlphaMask * base, GstPad * pad, GstQuery * query)
+{
+  GstGLAlphaMask *thiz = GST_GL_ALPHA_MASK (base);
+
+  switch (GST_QUERY_TYPE (query)) {
+    case GST_QUERY_CONTEXT:
+      if (gst_gl_handle_context_query (GST_ELEMENT (thiz), query,
+              thiz->display, thiz->context, thiz->other_context))
+        return TRUE;
+      break;
+    case GST_QUERY_ALLOCATION:
+      if (GST_PAD_DIRECTION (pad) == GST_PAD_SINK) {
+        /* we wait for upstream rendering before sampling */
+        gst_query_add_allocation_meta (query, GST_GL_SYNC_META_API_TYPE, NULL);
+        return TRUE;
+      }
+      break;
+    default:
+      break;
+  }
+
+  return GST_ALPHA_MASK_CLASS (parent_class)->query (base, pad, query);
+}
+
+static void
+gst_gl_alpha_mask_set_context (GstElement * element, GstContext * context)
+{
+  GstGLAlphaMask *thiz = GST_GL_ALPHA_MASK (element);
+
+  gst_gl_handle_set_context (element, context, &thiz->display,
+      &thiz->other_context);
+  if (thiz->display)
+    gst_gl_display_filter_gl_api (thiz->display, SUPPORTED_GL_APIS);
+
+  GST_ELEMENT_CLASS (parent_class)->set_context (element, context);
+}
+
+static GstStateChangeReturn
+gst_gl_alpha_mask_change_state (GstElement * element,
+    GstStateChange transition)
+{
+  GstGLAlphaMask *thiz = GST_GL_ALPHA_MASK (element);
+  GstStateChangeReturn ret;
+
+  switch (transition) {
+    case GST_STATE_CHANGE_NULL_TO_READY:
+      if (!gst_gl_ensure_element_data (element, &thiz->display,
+              &thiz->other_context))
+        return GST_STATE_CHANGE_FAILURE;
+      gst_gl_display_filter_gl_api (thiz->display, SUPPORTED_GL_APIS);
+      break;
+    default:
+      break;
+  }
+
+  ret = GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
+  if (ret == GST_STATE_CHANGE_FAILURE)
+    return ret;
+
+  switch (transition) {
+    case GST_STATE_CHANGE_PAUSED_TO_READY:
+      gst_gl_alpha_mask_set_pool (thiz, NULL);
+      if (thiz->context)
+        gst_gl_context_thread_add (thiz->context,
+            (GstGLContextThreadFunc) gst_gl_alpha_mask_gl_reset, thiz);
+      break;
+    case GST_STATE_CHANGE_READY_TO_NULL:
+      gst_gl_alpha_mask_release_gl (thiz);
+      break;
+    default:
+      break;
+  }
+
+  return ret;
+}
+
+static void
+gst_gl_alpha_mask_finalize (GObject * object)
+{
+  GstGLAlphaMask *thiz = GST_GL_ALPHA_MASK (object);
+
+  gst_gl_alpha_mask_set_pool (thiz, NULL);
+  gst_gl_alpha_mask_release_gl (thiz);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static void
+gst_gl_alpha_mask_class_init (GstGLAlphaMaskClass * klass)
+{
+  GObjectClass *gobject_class;
+  GstElementClass *gstelement_class;
+  GstAlphaMaskClass *alphamask_class;
+
+  gobject_class = (GObjectClass *) klass;
+  gstelement_class = (GstElementClass *) klass;
+  alphamask_class = (GstAlphaMaskClass *) klass;
+
+  gobject_class->finalize = gst_gl_alpha_mask_finalize;
+
+  gst_element_class_set_static_metadata (gstelement_class,
+      "OpenGL alpha mask combinator",
+      "Filter/Effect/Video",
+      "Combines video and alpha textures", "Josep Torra <jtorra@oblong.com>");
+
+  /* replace the system memory templates of the base class */
+  gst_element_class_add_static_pad_template (gstelement_class, &vsink_factory);
+  gst_element_class_add_static_pad_template (gstelement_class, &asink_factory);
+  gst_element_class_add_static_pad_template (gstelement_class, &src_factory);
+
+  gstelement_class->change_state =
+      GST_DEBUG_FUNCPTR (gst_gl_alpha_mask_change_state);
+  gstelement_class->set_context =
+      GST_DEBUG_FUNCPTR (gst_gl_alpha_mask_set_context);
+
+  alphamask_class->negotiate = GST_DEBUG_FUNCPTR (gst_gl_alpha_mask_negotiate);
+  alphamask_class->process = GST_DEBUG_FUNCPTR (gst_gl_alpha_mask_process);
+  alphamask_class->query = GST_DEBUG_FUNCPTR (gst_gl_alpha_mask_query);
+}
+
+static void
+gst_gl_alpha_mask_init (GstGLAlphaMask * thiz)
+{
+  thiz->display = NULL;
+  thiz->context = NULL;
+  thiz->other_context = NULL;
+  thiz->shader = NULL;
+  thiz->fbo = NULL;
+  thiz->vao = 0;
+  thiz->vertex_buffer = 0;
+  thiz->index_buffer = 0;
+  thiz->pool = NULL;
+  thiz->video_tex = 0;
+  thiz->alpha_tex = 0;
+  thiz->out_mem = NULL;
+  thiz->gl_ok = FALSE;
+}
@@ -0,0 +1,78 @@
+/* GStreamer AlphaMask plugin
+ * Copyright (C) 2016 Oblong Industries
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_GL_ALPHA_MASK_H__
+#define __GST_GL_ALPHA_MASK_H__
+
+#include <gst/gl/gl.h>
+
+#include "gstalphamask.h"
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_GL_ALPHA_MASK            (gst_gl_alpha_mask_get_type())
+#define GST_GL_ALPHA_MASK(obj)            (G_TYPE_CHECK_INSTANCE_CAST((obj),\
+                                            GST_TYPE_GL_ALPHA_MASK, GstGLAlphaMask))
+#define GST_GL_ALPHA_MASK_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST((klass),\
+                                            GST_TYPE_GL_ALPHA_MASK, GstGLAlphaMaskClass))
+#define GST_IS_GL_ALPHA_MASK(obj)         (G_TYPE_CHECK_INSTANCE_TYPE((obj),\
+                                            GST_TYPE_GL_ALPHA_MASK))
+#define GST_IS_GL_ALPHA_MASK_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE((klass),\
+                                            GST_TYPE_GL_ALPHA_MASK))
+
+typedef struct _GstGLAlphaMask      GstGLAlphaMask;
+typedef struct _GstGLAlphaMaskClass GstGLAlphaMaskClass;
+
+/**
+ * GstGLAlphaMask:
+ *
+ * Opaque glalphamask object structure
+ */
+struct _GstGLAlphaMask {
+    GstAlphaMask             parent;
+
+    GstGLDisplay            *display;
+    GstGLContext            *context;
+    GstGLContext            *other_context;
+
+    /* GL resources, only touched from the GL thread */
+    GstGLShader             *shader;
+    GstGLFramebuffer        *fbo;
+    GLuint                   vao;
+    GLuint                   vertex_buffer;
+    GLuint                   index_buffer;
+
+    GstBufferPool           *pool;
+
+    /* textures of the frame being rendered */
+    GLuint                   video_tex;
+    GLuint                   alpha_tex;
+    GstGLMemory             *out_mem;
+    gboolean                 gl_ok;
+};
+
+struct _GstGLAlphaMaskClass {
+    GstAlphaMaskClass parent_class;
+};
+
+GType gst_gl_alpha_mask_get_type(void) G_GNUC_CONST;
+
+G_END_DECLS
+
+#endif /* __GST_GL_ALPHA_MASK_H */
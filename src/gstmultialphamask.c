@@ -0,0 +1,349 @@
+/* GStreamer AlphaMask plugin
+ * Copyright (C) 2016 Oblong Industries
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/**
+ * SECTION:element-multialphamask
+ *
+ * The multialphamask element combines several video and alpha mask pairs
+ * at once. Every video_sink_%u / alpha_sink_%u pair of request pads is
+ * handled by an alphamask inside the bin which output appears on src_%u.
+ * The alphamask instances split their alpha passes on a worker pool shared
+ * by the whole process, so adding streams doesn't add threads.
+ *
+ * Sample pipeline:
+ * |[
+ * gst-launch-1.0 multialphamask name=m \
+ *   videotestsrc ! m.video_sink_0 videotestsrc pattern=18 ! m.alpha_sink_0 \
+ *   videotestsrc pattern=ball ! m.video_sink_1 \
+ *   videotestsrc pattern=18 ! m.alpha_sink_1 \
+ *   compositor name=c ! videoconvert ! autovideosink \
+ *   m.src_0 ! c. m.src_1 ! c.
+ * ]|
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstmultialphamask.h"
+#include "gstalphamask.h"
+
+#include <string.h>
+
+GST_DEBUG_CATEGORY_STATIC (multialphamask_debug);
+#define GST_CAT_DEFAULT multialphamask_debug
+
+#define gst_multi_alpha_mask_parent_class parent_class
+G_DEFINE_TYPE_WITH_CODE (GstMultiAlphaMask, gst_multi_alpha_mask,
+    GST_TYPE_BIN, GST_DEBUG_CATEGORY_INIT (multialphamask_debug,
+        "multialphamask", 0, "Multi-stream alpha mask element"));
+
+static GstMultiAlphaMaskPair *
+gst_multi_alpha_mask_find_pair (GstMultiAlphaMask * thiz, guint index)
+{
+  GList *l;
+
+  for (l = thiz->pairs; l; l = l->next) {
+    GstMultiAlphaMaskPair *pair = l->data;
+
+    if (pair->index == index)
+      return pair;
+  }
+  return NULL;
+}
+
+static gint
+gst_multi_alpha_mask_compare_pair (gconstpointer a, gconstpointer b)
+{
+  const GstMultiAlphaMaskPair *pa = a, *pb = b;
+
+  return pa->index < pb->index ? -1 : pa->index > pb->index;
+}
+
+/* the pair an unnamed pad request goes to: the first one still missing
+ * that pad, or a new one after the last */
+static guint
+gst_multi_alpha_mask_pick_index (GstMultiAlphaMask * thiz, gboolean is_video)
+{
+  GList *l;
+  guint index = 0;
+
+  for (l = thiz->pairs; l; l = l->next) {
+    GstMultiAlphaMaskPair *pair = l->data;
+
+    if (!(is_video ? pair->video_pad : pair->alpha_pad))
+      return pair->index;
+    index = pair->index + 1;
+  }
+  return index;
+}
+
+/* Reads the pair index of a requested pad name, the whole name has to be
+ * @prefix followed by a decimal number */
+static gboolean
+gst_multi_alpha_mask_parse_index (const gchar * name, const gchar * prefix,
+    guint * index)
+{
+  gchar *end;
+  guint64 value;
+
+  if (!g_str_has_prefix (name, prefix))
+    return FALSE;
+
+  name += strlen (prefix);
+  if (!g_ascii_isdigit (*name))
+    return FALSE;
+
+  value = g_ascii_strtoull (name, &end, 10);
+  if (*end != '\0' || value > G_MAXUINT)
+    return FALSE;
+
+  *index = value;
+  return TRUE;
+}
+
+/* Adds a ghost pad, activated first when the bin is already streaming or
+ * it would stay flushing */
+static void
+gst_multi_alpha_mask_add_ghost_pad (GstElement * element, GstPad * pad)
+{
+  if (GST_STATE (element) > GST_STATE_READY)
+    gst_pad_set_active (pad, TRUE);
+  gst_element_add_pad (element, pad);
+}
+
+static GstMultiAlphaMaskPair *
+gst_multi_alpha_mask_add_pair (GstMultiAlphaMask * thiz, guint index)
+{
+  GstElement *element = GST_ELEMENT (thiz);
+  GstMultiAlphaMaskPair *pair;
+  GstPad *target;
+  gchar *name;
+
+  pair = g_new0 (GstMultiAlphaMaskPair, 1);
+  pair->index = index;
+
+  /* n-threads=0 picks the slice count from the machine, the slices go to the
+   * shared pool either way */
+  name = g_strdup_printf ("alphamask_%u", index);
+  pair->mask = g_object_new (GST_TYPE_ALPHA_MASK, "name", name,
+      "n-threads", 0, NULL);
+  g_free (name);
+  /* the bin owns the child, the pair only borrows it */
+  gst_bin_add (GST_BIN (thiz), pair->mask);
+
+  target = gst_element_get_static_pad (pair->mask, "src");
+  name = g_strdup_printf ("src_%u", index);
+  pair->src_pad = gst_ghost_pad_new_from_template (name, target,
+      gst_element_class_get_pad_template (GST_ELEMENT_GET_CLASS (element),
+          "src_%u"));
+  g_free (name);
+  gst_object_unref (target);
+
+  thiz->pairs = g_list_insert_sorted (thiz->pairs, pair,
+      gst_multi_alpha_mask_compare_pair);
+
+  gst_element_sync_state_with_parent (pair->mask);
+  gst_multi_alpha_mask_add_ghost_pad (element, pair->src_pad);
+
+  GST_DEBUG_OBJECT (thiz, "added pair %u", index);
+  return pair;
+}
+
+static GstPad *
+gst_multi_alpha_mask_request_new_pad (GstElement * element,
+    GstPadTemplate * templ, const gchar * name, const GstCaps * caps)
+{
+  GstMultiAlphaMask *thiz = GST_MULTI_ALPHA_MASK (element);
+  GstElementClass *klass = GST_ELEMENT_GET_CLASS (element);
+  GstMultiAlphaMaskPair *pair;
+  GstPad *target, *pad;
+  GstPad **slot;
+  const gchar *prefix;
+  gchar *pad_name;
+  gboolean is_video;
+  guint index;
+
+  if (templ == gst_element_class_get_pad_template (klass, "video_sink_%u"))
+    is_video = TRUE;
+  else if (templ == gst_element_class_get_pad_template (klass,
+          "alpha_sink_%u"))
+    is_video = FALSE;
+  else
+    return NULL;
+
+  prefix = is_video ? "video_sink_" : "alpha_sink_";
+
+  g_rec_mutex_lock (&thiz->lock);
+  if (name) {
+    if (!gst_multi_alpha_mask_parse_index (name, prefix, &index))
+      goto bad_name;
+  } else {
+    index = gst_multi_alpha_mask_pick_index (thiz, is_video);
+  }
+
+  pair = gst_multi_alpha_mask_find_pair (thiz, index);
+  if (!pair)
+    pair = gst_multi_alpha_mask_add_pair (thiz, index);
+
+  slot = is_video ? &pair->video_pad : &pair->alpha_pad;
+  if (*slot)
+    goto pad_taken;
+
+  target = gst_element_get_static_pad (pair->mask,
+      is_video ? "video_sink" : "alpha_sink");
+  pad_name = g_strdup_printf ("%s%u", prefix, index);
+  pad = gst_ghost_pad_new_from_template (pad_name, target, templ);
+  g_free (pad_name);
+  gst_object_unref (target);
+  *slot = pad;
+
+  gst_multi_alpha_mask_add_ghost_pad (element, pad);
+  g_rec_mutex_unlock (&thiz->lock);
+
+  return pad;
+
+bad_name:
+  {
+    g_rec_mutex_unlock (&thiz->lock);
+    GST_WARNING_OBJECT (thiz, "invalid pad name %s", name);
+    return NULL;
+  }
+pad_taken:
+  {
+    g_rec_mutex_unlock (&thiz->lock);
+    GST_WARNING_OBJECT (thiz, "pad %s of pair %u already requested",
+        is_video ? "video_sink" : "alpha_sink", index);
+    return NULL;
+  }
+}
+
+static void
+gst_multi_alpha_mask_release_pad (GstElement * element, GstPad * pad)
+{
+  GstMultiAlphaMask *thiz = GST_MULTI_ALPHA_MASK (element);
+  GstMultiAlphaMaskPair *pair = NULL;
+  gboolean remove;
+  GList *l;
+
+  g_rec_mutex_lock (&thiz->lock);
+  for (l = thiz->pairs; l; l = l->next) {
+    GstMultiAlphaMaskPair *p = l->data;
+
+    if (p->video_pad == pad) {
+      p->video_pad = NULL;
+      pair = p;
+      break;
+    }
+    if (p->alpha_pad == pad) {
+      p->alpha_pad = NULL;
+      pair = p;
+      break;
+    }
+  }
+  if (!pair) {
+    g_rec_mutex_unlock (&thiz->lock);
+    return;
+  }
+
+  /* the alphamask goes away with the last of its sink pads */
+  remove = !pair->video_pad && !pair->alpha_pad;
+  if (remove)
+    thiz->pairs = g_list_remove (thiz->pairs, pair);
+
+  gst_element_remove_pad (element, pad);
+  if (remove) {
+    GST_DEBUG_OBJECT (thiz, "removing pair %u", pair->index);
+    gst_element_remove_pad (element, pair->src_pad);
+    gst_element_set_locked_state (pair->mask, TRUE);
+    gst_element_set_state (pair->mask, GST_STATE_NULL);
+    gst_bin_remove (GST_BIN (thiz), pair->mask);
+    g_free (pair);
+  }
+  g_rec_mutex_unlock (&thiz->lock);
+}
+
+static void
+gst_multi_alpha_mask_finalize (GObject * object)
+{
+  GstMultiAlphaMask *thiz = GST_MULTI_ALPHA_MASK (object);
+
+  /* the children themselves are disposed by the bin */
+  g_list_free_full (thiz->pairs, g_free);
+  thiz->pairs = NULL;
+  g_rec_mutex_clear (&thiz->lock);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+/* the caps of the pads are the ones of the alphamask inside */
+static void
+gst_multi_alpha_mask_add_pad_template (GstElementClass * klass,
+    GstElementClass * mask_class, const gchar * mask_name,
+    const gchar * name, GstPadPresence presence)
+{
+  GstPadTemplate *templ;
+  GstCaps *caps;
+
+  templ = gst_element_class_get_pad_template (mask_class, mask_name);
+  caps = gst_pad_template_get_caps (templ);
+  gst_element_class_add_pad_template (klass, gst_pad_template_new (name,
+          GST_PAD_TEMPLATE_DIRECTION (templ), presence, caps));
+  gst_caps_unref (caps);
+}
+
+static void
+gst_multi_alpha_mask_class_init (GstMultiAlphaMaskClass * klass)
+{
+  GObjectClass *gobject_class;
+  GstElementClass *gstelement_class;
+  GstElementClass *mask_class;
+
+  gobject_class = (GObjectClass *) klass;
+  gstelement_class = (GstElementClass *) klass;
+
+  gobject_class->finalize = gst_multi_alpha_mask_finalize;
+
+  gst_element_class_set_static_metadata (gstelement_class,
+      "Multi-stream alpha mask combinator",
+      "Filter/Effect/Video",
+      "Combines several video and alpha stream pairs",
+      "Josep Torra <jtorra@oblong.com>");
+
+  mask_class = g_type_class_ref (GST_TYPE_ALPHA_MASK);
+  gst_multi_alpha_mask_add_pad_template (gstelement_class, mask_class,
+      "video_sink", "video_sink_%u", GST_PAD_REQUEST);
+  gst_multi_alpha_mask_add_pad_template (gstelement_class, mask_class,
+      "alpha_sink", "alpha_sink_%u", GST_PAD_REQUEST);
+  gst_multi_alpha_mask_add_pad_template (gstelement_class, mask_class,
+      "src", "src_%u", GST_PAD_SOMETIMES);
+  g_type_class_unref (mask_class);
+
+  gstelement_class->request_new_pad =
+      GST_DEBUG_FUNCPTR (gst_multi_alpha_mask_request_new_pad);
+  gstelement_class->release_pad =
+      GST_DEBUG_FUNCPTR (gst_multi_alpha_mask_release_pad);
+}
+
+static void
+gst_multi_alpha_mask_init (GstMultiAlphaMask * thiz)
+{
+  g_rec_mutex_init (&thiz->lock);
+  thiz->pairs = NULL;
+}
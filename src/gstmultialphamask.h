@@ -0,0 +1,71 @@
+/* GStreamer AlphaMask plugin
+ * Copyright (C) 2016 Oblong Industries
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_MULTI_ALPHA_MASK_H__
+#define __GST_MULTI_ALPHA_MASK_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_MULTI_ALPHA_MASK            (gst_multi_alpha_mask_get_type())
+#define GST_MULTI_ALPHA_MASK(obj)            (G_TYPE_CHECK_INSTANCE_CAST((obj),\
+                                               GST_TYPE_MULTI_ALPHA_MASK, GstMultiAlphaMask))
+#define GST_MULTI_ALPHA_MASK_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST((klass),\
+                                               GST_TYPE_MULTI_ALPHA_MASK, GstMultiAlphaMaskClass))
+#define GST_IS_MULTI_ALPHA_MASK(obj)         (G_TYPE_CHECK_INSTANCE_TYPE((obj),\
+                                               GST_TYPE_MULTI_ALPHA_MASK))
+#define GST_IS_MULTI_ALPHA_MASK_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE((klass),\
+                                               GST_TYPE_MULTI_ALPHA_MASK))
+
+typedef struct _GstMultiAlphaMask      GstMultiAlphaMask;
+typedef struct _GstMultiAlphaMaskClass GstMultiAlphaMaskClass;
+
+/* one video + mask pair, handled by an alphamask inside the bin */
+typedef struct {
+    guint                    index;
+    GstElement              *mask;
+    GstPad                  *video_pad;  /* ghost pads, NULL until requested */
+    GstPad                  *alpha_pad;
+    GstPad                  *src_pad;
+} GstMultiAlphaMaskPair;
+
+/**
+ * GstMultiAlphaMask:
+ *
+ * Opaque multialphamask object structure
+ */
+struct _GstMultiAlphaMask {
+    GstBin                   bin;
+
+    GRecMutex                lock;   /* protects the pairs, taken again
+                                      * by pad-added handlers requesting
+                                      * pads */
+    GList                   *pairs;  /* GstMultiAlphaMaskPair, by index */
+};
+
+struct _GstMultiAlphaMaskClass {
+    GstBinClass parent_class;
+};
+
+GType gst_multi_alpha_mask_get_type(void) G_GNUC_CONST;
+
+G_END_DECLS
+
+#endif /* __GST_MULTI_ALPHA_MASK_H */